@@ -0,0 +1,153 @@
+// 把各进程写出的 mprpc_trace.<pid>.log 按 trace_id 拼成端到端时间线
+// 用法: trace_join [--trace=<id>] [--top=N] [--min_ms=M] file1.log file2.log ...
+//   默认输出最慢的10条trace的时间线，以及按span名字汇总的耗时分布
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Span {
+    std::string trace, span, parent, kind, name, proc;
+    long long start_us = 0;
+    long long dur_us = 0;
+    int status = 0;
+};
+
+struct Cmd {
+    std::string trace;   // 只看这一条trace
+    int top = 10;        // 输出最慢的N条
+    double min_ms = 0;   // 只看端到端耗时不小于它的trace
+    std::vector<std::string> files;
+};
+
+// 行格式由 RpcTracer 固定写出，这里只需要按key取值，不做通用JSON解析
+static bool field(const std::string& line, const char* key, std::string& out) {
+    std::string k = std::string("\"") + key + "\":";
+    size_t p = line.find(k);
+    if (p == std::string::npos) return false;
+    p += k.size();
+    out.clear();
+    if (p < line.size() && line[p] == '"') {
+        for (++p; p < line.size() && line[p] != '"'; ++p) {
+            if (line[p] == '\\' && p + 1 < line.size()) ++p;
+            out.push_back(line[p]);
+        }
+        return true;
+    }
+    size_t e = line.find_first_of(",}", p);
+    out = line.substr(p, e == std::string::npos ? std::string::npos : e - p);
+    return true;
+}
+
+static bool parse_line(const std::string& line, Span& s) {
+    std::string v;
+    if (!field(line, "trace", s.trace) || !field(line, "span", s.span) || !field(line, "parent", s.parent)) return false;
+    field(line, "kind", s.kind);
+    field(line, "name", s.name);
+    field(line, "proc", s.proc);
+    if (field(line, "start_us", v)) s.start_us = std::atoll(v.c_str());
+    if (field(line, "dur_us", v)) s.dur_us = std::atoll(v.c_str());
+    if (field(line, "status", v)) s.status = std::atoi(v.c_str());
+    return true;
+}
+
+struct Trace {
+    std::vector<Span> spans;
+    long long begin = 0, end = 0;
+    long long duration() const { return end - begin; }
+};
+
+// 按父子关系深度优先输出，同一层按开始时间排序；父span不在文件里的当作根
+static void print_tree(const Trace& t) {
+    std::unordered_map<std::string, std::vector<const Span*>> children;
+    std::unordered_map<std::string, bool> present;
+    for (const Span& s : t.spans) present[s.span] = true;
+    std::vector<const Span*> roots;
+    for (const Span& s : t.spans) {
+        if (present.count(s.parent) && s.parent != s.span) children[s.parent].push_back(&s);
+        else roots.push_back(&s);
+    }
+    auto by_start = [](const Span* a, const Span* b) { return a->start_us < b->start_us; };
+    std::sort(roots.begin(), roots.end(), by_start);
+    for (auto& kv : children) std::sort(kv.second.begin(), kv.second.end(), by_start);
+
+    std::vector<std::pair<const Span*, int>> stack;
+    for (auto it = roots.rbegin(); it != roots.rend(); ++it) stack.emplace_back(*it, 0);
+    while (!stack.empty()) {
+        const Span* s = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+        printf("  +%9.3fms %9.3fms %*s%s %s [%s]%s\n",
+               (s->start_us - t.begin) / 1000.0, s->dur_us / 1000.0, depth * 2, "",
+               s->kind.c_str(), s->name.c_str(), s->proc.c_str(),
+               s->status != 0 ? (" status=" + std::to_string(s->status)).c_str() : "");
+        auto cit = children.find(s->span);
+        if (cit == children.end()) continue;
+        for (auto it = cit->second.rbegin(); it != cit->second.rend(); ++it) stack.emplace_back(*it, depth + 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    Cmd cmd;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a.rfind("--trace=", 0) == 0) cmd.trace = a.substr(8);
+        else if (a.rfind("--top=", 0) == 0) cmd.top = std::stoi(a.substr(6));
+        else if (a.rfind("--min_ms=", 0) == 0) cmd.min_ms = std::stod(a.substr(9));
+        else cmd.files.push_back(a);
+    }
+    if (cmd.files.empty()) {
+        std::cerr << "usage: trace_join [--trace=<id>] [--top=N] [--min_ms=M] trace.log...\n";
+        return 1;
+    }
+
+    std::unordered_map<std::string, Trace> traces;
+    size_t bad = 0;
+    for (const std::string& f : cmd.files) {
+        std::ifstream in(f);
+        if (!in) { std::cerr << "open " << f << " failed\n"; continue; }
+        std::string line;
+        while (std::getline(in, line)) {
+            Span s;
+            if (!parse_line(line, s)) { ++bad; continue; }
+            if (!cmd.trace.empty() && s.trace != cmd.trace) continue;
+            Trace& t = traces[s.trace];
+            if (t.spans.empty() || s.start_us < t.begin) t.begin = s.start_us;
+            if (t.spans.empty() || s.start_us + s.dur_us > t.end) t.end = s.start_us + s.dur_us;
+            t.spans.push_back(std::move(s));
+        }
+    }
+
+    std::vector<const Trace*> sorted;
+    for (auto& kv : traces)
+        if (kv.second.duration() >= (long long)(cmd.min_ms * 1000)) sorted.push_back(&kv.second);
+    std::sort(sorted.begin(), sorted.end(), [](const Trace* a, const Trace* b) { return a->duration() > b->duration(); });
+
+    printf("[trace-join] traces=%zu matched=%zu bad_lines=%zu\n", traces.size(), sorted.size(), bad);
+    for (size_t i = 0; i < sorted.size() && (int)i < cmd.top; ++i) {
+        const Trace* t = sorted[i];
+        printf("trace %s total=%.3fms spans=%zu\n", t->spans[0].trace.c_str(), t->duration() / 1000.0, t->spans.size());
+        print_tree(*t);
+    }
+
+    // 按span名字汇总：端到端延迟主要花在哪一跳
+    std::map<std::string, std::vector<long long>> by_name;
+    for (const Trace* t : sorted)
+        for (const Span& s : t->spans) by_name[s.kind + " " + s.name].push_back(s.dur_us);
+    printf("\n%-40s %8s %10s %10s %10s %10s\n", "span", "count", "avg_ms", "p50_ms", "p99_ms", "max_ms");
+    for (auto& kv : by_name) {
+        std::vector<long long>& v = kv.second;
+        std::sort(v.begin(), v.end());
+        long long sum = 0;
+        for (long long d : v) sum += d;
+        auto pct = [&v](double q) { return v[std::min(v.size() - 1, (size_t)(q * v.size()))] / 1000.0; };
+        printf("%-40s %8zu %10.3f %10.3f %10.3f %10.3f\n", kv.first.c_str(), v.size(),
+               (double)sum / v.size() / 1000.0, pct(0.5), pct(0.99), v.back() / 1000.0);
+    }
+    return 0;
+}
@@ -13,6 +13,7 @@
 // mprpc
 #include "mprpcchannel.h"
 #include "mprpccontroller.h"
+#include "mprpcclosure.h"
 
 // 业务 proto
 #include "user.pb.h"
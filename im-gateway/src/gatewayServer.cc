@@ -1,4 +1,5 @@
 #include "gatewayServer.h"
+#include "rpctrace.h"
 #include <chrono>
 #include <sstream>
 #include <functional>
@@ -44,8 +45,8 @@ std::vector<std::string> GatewayServer::splitOnce(const std::string &s, char d,
 
 void GatewayServer::sendLine(const TcpConnectionPtr &c, const std::string &s)
 {
-	c->send(s);
-	c->send("\n");
+	// 整行一次发送：异步RPC的回调可能在其他线程上同时给同一个连接写回复，分两次send会交错
+	c->send(s + "\n");
 }
 
 GatewayServer::Session &GatewayServer::sessionOf(const TcpConnectionPtr &c)
@@ -122,6 +123,7 @@ void GatewayServer::initMessageQueue()
 // 处理从 Redis 接收到的消息
 void GatewayServer::handleRedisMessage(const std::string &payload)
 {
+	const RpcTracer::Clock::time_point received = RpcTracer::Clock::now();
 	LOG_DEBUG << "Gateway: Received message from Redis, payload size=" << payload.size();
 
 	// 解析 Protobuf 消息
@@ -159,8 +161,15 @@ void GatewayServer::handleRedisMessage(const std::string &payload)
 		return;
 	}
 
+	// 推送环节作为消息服务Send span的子span：从收到Redis消息到写给接收方连接
+	RpcTraceContext parent;
+	parent.traceId = m.trace_id();
+	parent.spanId = m.span_id();
+	parent.sampled = m.trace_sampled();
+	RpcTraceContext span = RpcTracer::GetInstance().StartSpan(parent);
+
 	// 投递到连接所属的 IO 线程发送（避免跨线程调用和 Redis 线程阻塞）
-	conn->getLoop()->runInLoop([conn, m]() {
+	conn->getLoop()->runInLoop([conn, m, span, received]() {
 		if (!conn->connected()) {
 			return;  // 连接已断开
 		}
@@ -173,6 +182,8 @@ void GatewayServer::handleRedisMessage(const std::string &payload)
 		   << " text=" << m.text();
 		conn->send(os.str());
 		conn->send("\n");
+		RpcTracer::GetInstance().Record(span, m.span_id(), RpcTracer::kInternal, "Gateway.Push", received,
+										RpcTracer::Clock::now());
 		
 		LOG_DEBUG << "Gateway: Message delivered to user " << m.to();
 	});
@@ -473,19 +484,37 @@ bool GatewayServer::handleSEND(const TcpConnectionPtr &c, const std::vector<std:
 					 .count();
 	m.set_ts_ms(nowms);
 
-	mpim::SendReq req;
-	*req.mutable_msg() = m;
-	mpim::SendResp resp;
-	MprpcController ctl;
-	message_->Send(&ctl, &req, &resp, nullptr);
-	if (ctl.Failed() || !ok(resp.result()))
-	{
-		sendLine(c, "-ERR send");
-		return false;
-	}
-	std::ostringstream os;
-	os << "+OK msg_id=" << resp.msg_id();
-	sendLine(c, os.str());
+	// 异步调用 Message.Send：IO线程不等待下游，响应到达后在RPC读线程上回复客户端
+	struct SendCall
+	{
+		mpim::SendReq req;
+		mpim::SendResp resp;
+		MprpcController ctl;
+	};
+	auto call = std::make_shared<SendCall>();
+	*call->req.mutable_msg() = m;
+	WeakConn weak = c;
+	// 一次SEND是一条trace的起点（按 trace_sample_rate 采样），Message.Send 及其下游调用都是它的子span
+	const RpcTraceContext span = RpcTracer::GetInstance().StartSpan(RpcTraceContext());
+	const RpcTracer::Clock::time_point span_start = RpcTracer::Clock::now();
+	RpcTraceScope trace_scope(span);
+	message_->Send(&call->ctl, &call->req, &call->resp, NewMprpcClosure([this, call, weak, span, span_start]() {
+		const bool failed = call->ctl.Failed() || !ok(call->resp.result());
+		RpcTracer::GetInstance().Record(span, 0, RpcTracer::kServer, "Gateway.SEND", span_start,
+										RpcTracer::Clock::now(), failed ? 1 : 0);
+		TcpConnectionPtr conn = weak.lock();
+		if (!conn)
+			return;
+		if (failed)
+		{
+			LOG_ERROR << "Message.Send RPC failed: " << call->ctl.ErrorText();
+			sendLine(conn, "-ERR send");
+			return;
+		}
+		std::ostringstream os;
+		os << "+OK msg_id=" << call->resp.msg_id();
+		sendLine(conn, os.str());
+	}));
 	return true;
 }
 
@@ -3,6 +3,7 @@
 #include "presence.pb.h"
 #include "mprpcchannel.h"
 #include "mprpccontroller.h"
+#include "mprpccoro.h"
 #include "offline_model.h"
 #include <memory>
 
@@ -35,6 +36,10 @@ public:
                  ::mpim::SendGroupResp*,
                  ::google::protobuf::Closure*) override;
 private:
+  // Send 的协程实现：QueryRoute -> Deliver -> 失败时离线落库，结束后由 MprpcSpawn 调用 done
+  MprpcTask<> SendCo(const ::mpim::SendReq* req, ::mpim::SendResp* resp);
+  void storeOffline(const ::mpim::C2CMsg& m, ::mpim::SendResp* resp);
+
   OfflineModel offline_;
   std::unique_ptr<MprpcChannel> ch_presence_;
   std::unique_ptr<mpim::PresenceService_Stub> presence_;
@@ -1,4 +1,5 @@
 #include "message_service.h"
+#include "rpctrace.h"
 #include "logger/logger.h"
 #include "logger/log_init.h"
 
@@ -28,88 +29,91 @@ MessageServiceImpl::MessageServiceImpl()
 	}
 }
 
-// 
+// 发送消息：协程实现，对 Presence 的两次 RPC 挂起等待，处理线程不再阻塞等待下游
 void MessageServiceImpl::Send(google::protobuf::RpcController *,
 							  const mpim::SendReq *req,
 							  mpim::SendResp *resp,
 							  google::protobuf::Closure *done)
+{
+	MprpcSpawn(SendCo(req, resp), done);
+}
+
+// req/resp 在 done 执行前一直有效；每次 co_await 之后回到原来的业务线程继续执行
+MprpcTask<> MessageServiceImpl::SendCo(const mpim::SendReq *req, mpim::SendResp *resp)
 {
 	const auto &m = req->msg();
+
+	// demo: 生成一个递增 msg_id（真实可用库自增或雪花）
+	static std::atomic<long long> g_id{1};
+	resp->set_msg_id(g_id++);
+
+	LOG_INFO << "MessageService::Send: from=" << m.from() << " to=" << m.to() << " text=" << m.text();
+
+	// 检查RPC通道是否有效
+	if (!ch_presence_ || !presence_) {
+		LOG_ERROR << "MessageService::Send: Presence RPC channel or stub is null!";
+		storeOffline(m, resp);
+		co_return;
+	}
+
 	// 1) 调用Presence服务的QueryRoute方法，查询接收者的路由信息
 	mpim::QueryRouteReq qr;
-	qr.set_user_id(m.to());
 	mpim::QueryRouteResp qrs;
 	MprpcController ctl1;
+	qr.set_user_id(m.to());
 	LOG_INFO << "MessageService::Send: Calling Presence QueryRoute for user " << m.to();
-	
-	// 检查RPC通道是否有效
-	if (!ch_presence_ || !presence_) {
-		LOG_ERROR << "MessageService::Send: Presence RPC channel or stub is null!";
-		ctl1.SetFailed("Presence RPC channel not available");
-	} else {
-		LOG_DEBUG << "MessageService::Send: Presence RPC channel is valid";
-		presence_->QueryRoute(&ctl1, &qr, &qrs, nullptr);
-	}
-	
+	co_await MprpcAsync([&](google::protobuf::Closure *d) { presence_->QueryRoute(&ctl1, &qr, &qrs, d); });
+
 	if (ctl1.Failed()) {
 		LOG_ERROR << "MessageService::Send: Presence QueryRoute RPC failed: " << ctl1.ErrorText();
-		LOG_ERROR << "MessageService::Send: RPC error details - errno: " << errno;
 	} else {
 		LOG_INFO << "MessageService::Send: Presence QueryRoute result code=" << qrs.result().code() << " gateway_id=" << qrs.gateway_id();
 	}
 
-	// demo: 生成一个递增 msg_id（真实可用库自增或雪花）
-	static std::atomic<long long> g_id{1};
-	resp->set_msg_id(g_id++);
-
-	LOG_INFO << "MessageService::Send: from=" << m.from() << " to=" << m.to() << " text=" << m.text();
+	if (ctl1.Failed() || qrs.result().code() != mpim::Code::Ok || qrs.gateway_id().empty())
+	{
+		LOG_WARN << "User " << m.to() << " is offline or route not found";
+		storeOffline(m, resp);
+		co_return;
+	}
 
 	// 2) 在线 -> 让 presence 代投（Redis 发给对应网关）
-	if (!ctl1.Failed() && qrs.result().code() == mpim::Code::Ok && !qrs.gateway_id().empty())
-	{
-		LOG_INFO << "User " << m.to() << " is online, gateway=" << qrs.gateway_id();
-		LOG_INFO << "MessageService::Send: QueryRoute successful, proceeding with delivery";
-		mpim::DeliveReq dr;
-		dr.set_to(m.to());
-		std::string bytes = m.SerializeAsString();
-		dr.set_payload(bytes);
-		mpim::DeliveResp dresp;
-		MprpcController ctl2;
-		LOG_INFO << "MessageService::Send: Calling Presence Deliver for user " << m.to();
-		
-		if (presence_) {
-			presence_->Deliver(&ctl2, &dr, &dresp, nullptr);
-		} else {
-			ctl2.SetFailed("Presence RPC stub not available");
-		}
-		
-		if (ctl2.Failed()) {
-			LOG_ERROR << "MessageService::Send: Presence Deliver RPC failed: " << ctl2.ErrorText();
-		} else {
-			LOG_INFO << "MessageService::Send: Presence Deliver result code=" << dresp.result().code() << " msg=" << dresp.result().msg();
-		}
-		
-		if (!ctl2.Failed() && dresp.result().code() == mpim::Code::Ok)
-		{
-			LOG_INFO << "Message delivered successfully to user " << m.to();
-			resp->mutable_result()->set_code(mpim::Code::Ok);
-			resp->mutable_result()->set_msg("delivered");
-			if (done)
-				done->Run();
-			return; // 在线投递成功，直接返回，不执行离线存储
-		}
-		else
-		{
-			LOG_ERROR << "Message delivery failed: " << ctl2.ErrorText() << " result_code=" << dresp.result().code();
-			// 在线投递失败，继续执行离线存储
-		}
+	LOG_INFO << "User " << m.to() << " is online, gateway=" << qrs.gateway_id();
+	const RpcTraceContext trace = RpcTracer::Current();
+	mpim::DeliveReq dr;
+	mpim::DeliveResp dresp;
+	MprpcController ctl2;
+	dr.set_to(m.to());
+	mpim::C2CMsg pushed = m;
+	pushed.set_trace_id(trace.traceId);
+	pushed.set_span_id(trace.spanId);
+	pushed.set_trace_sampled(trace.sampled);
+	dr.set_payload(pushed.SerializeAsString());
+	LOG_INFO << "MessageService::Send: Calling Presence Deliver for user " << m.to();
+	co_await MprpcAsync([&](google::protobuf::Closure *d) { presence_->Deliver(&ctl2, &dr, &dresp, d); });
+
+	if (ctl2.Failed()) {
+		LOG_ERROR << "MessageService::Send: Presence Deliver RPC failed: " << ctl2.ErrorText();
+	} else {
+		LOG_INFO << "MessageService::Send: Presence Deliver result code=" << dresp.result().code() << " msg=" << dresp.result().msg();
 	}
-	else
+
+	if (!ctl2.Failed() && dresp.result().code() == mpim::Code::Ok)
 	{
-		LOG_WARN << "User " << m.to() << " is offline or route not found";
+		LOG_INFO << "Message delivered successfully to user " << m.to();
+		resp->mutable_result()->set_code(mpim::Code::Ok);
+		resp->mutable_result()->set_msg("delivered");
+		co_return; // 在线投递成功，不执行离线存储
 	}
 
-	// 3) 不在线/投递失败 -> 离线落库
+	LOG_ERROR << "Message delivery failed: " << ctl2.ErrorText() << " result_code=" << dresp.result().code();
+	// 3) 在线投递失败，继续执行离线存储
+	storeOffline(m, resp);
+}
+
+// 不在线/投递失败 -> 离线落库
+void MessageServiceImpl::storeOffline(const mpim::C2CMsg &m, mpim::SendResp *resp)
+{
 	LOG_INFO << "Storing message offline for user " << m.to();
 	if (offline_.insert(m.to(), m.SerializeAsString()))
 	{
@@ -122,8 +126,6 @@ void MessageServiceImpl::Send(google::protobuf::RpcController *,
 	}
 	resp->mutable_result()->set_code(mpim::Code::Ok);
 	resp->mutable_result()->set_msg("queued");
-	if (done)
-		done->Run();
 }
 
 // 处理拉取离线消息的请求
@@ -0,0 +1,72 @@
+#include "mprpcapplication.h"
+#include "rpcprovider.h"
+#include "user_service.h"
+#include "presence_service.h"
+#include "message_service.h"
+#include "group_service.h"
+#include "gatewayServer.h"
+#include "logger/log_init.h"
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/InetAddress.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+单进程部署：网关和 user/presence/message/group 四个服务跑在同一个进程里
+服务照常注册到zookeeper，其他进程仍然可以远程调用；本进程内发给这些服务的调用（网关->服务、服务->服务）
+经 MprpcLocalRegistry 直接调用服务对象，不做序列化、不经过网络（rpc_local_shortcut=0 可以关掉）
+配置文件和拆开部署时相同；网关端口和实例ID取 gateway_port（默认9000）、gateway_id（默认gateway-1）
+*/
+int main(int argc, char **argv)
+{
+	mpim::logger::LogInit::InitDefault("im-monolith");
+	MprpcApplication::Init(argc, argv);
+
+	auto userService = std::make_unique<UserServiceImpl>();
+	// 服务启动时将所有用户状态设为离线（防止上次异常退出导致的状态不一致）
+	userService->resetAllUsersToOffline();
+
+	RpcProvider provider;
+	provider.NotifyService(std::move(userService));
+	provider.NotifyService(std::make_unique<PresenceServiceImpl>());
+	provider.NotifyService(std::make_unique<MessageServiceImpl>());
+	provider.NotifyService(std::make_unique<GroupServiceImpl>());
+
+	MprpcConfig &conf = MprpcApplication::GetConfig();
+	const uint16_t gatewayPort = (uint16_t)conf.LoadInt("gateway_port", 9000);
+	std::string gatewayId = conf.Load("gateway_id");
+	if (gatewayId.empty()) gatewayId = "gateway-1";
+
+	// 网关跑在自己的EventLoop线程上；服务全部注册完成后才启动，网关发出的第一个调用就能走进程内调用
+	std::mutex gatewayMu;
+	muduo::net::EventLoop *gatewayLoop = nullptr;
+	bool gatewayStopped = false;
+	std::thread gatewayThread;
+	provider.SetReadyCallback([&]() {
+		gatewayThread = std::thread([&]() {
+			muduo::net::EventLoop loop;
+			GatewayServer server(&loop, muduo::net::InetAddress(gatewayPort), gatewayId);
+			server.start();
+			{
+				// provider已经退出时不再进入事件循环，否则下面的quit会错过
+				std::lock_guard<std::mutex> lk(gatewayMu);
+				if (gatewayStopped) return;
+				gatewayLoop = &loop;
+			}
+			loop.loop();
+			std::lock_guard<std::mutex> lk(gatewayMu);
+			gatewayLoop = nullptr;
+		});
+	});
+
+	provider.Run(); // 阻塞运行，优雅下线后返回
+
+	{
+		std::lock_guard<std::mutex> lk(gatewayMu);
+		gatewayStopped = true;
+		if (gatewayLoop != nullptr) gatewayLoop->quit();
+	}
+	if (gatewayThread.joinable()) gatewayThread.join();
+	return 0;
+}
@@ -0,0 +1,24 @@
+# mprpc_generate_cpp(<HDRS_VAR> proto...)
+# 用 protoc-gen-mprpc 为每个 .proto 生成 <name>.mprpc.h（静态分发的服务端骨架和有类型的客户端stub）
+# 输出到当前二进制目录，和 protobuf_generate_cpp 生成的 <name>.pb.h 放在一起；import 按 .proto 所在目录查找
+function(mprpc_generate_cpp HDRS)
+  set(_hdrs)
+  foreach(_proto ${ARGN})
+    get_filename_component(_abs ${_proto} ABSOLUTE)
+    get_filename_component(_dir ${_abs} DIRECTORY)
+    get_filename_component(_name ${_abs} NAME_WE)
+    set(_out ${CMAKE_CURRENT_BINARY_DIR}/${_name}.mprpc.h)
+    add_custom_command(
+      OUTPUT ${_out}
+      COMMAND ${Protobuf_PROTOC_EXECUTABLE}
+              --plugin=protoc-gen-mprpc=$<TARGET_FILE:protoc-gen-mprpc>
+              --mprpc_out=${CMAKE_CURRENT_BINARY_DIR}
+              -I ${_dir} ${_abs}
+      DEPENDS ${_abs} protoc-gen-mprpc
+      COMMENT "Running mprpc protoc plugin on ${_proto}"
+      VERBATIM)
+    list(APPEND _hdrs ${_out})
+  endforeach()
+  set_source_files_properties(${_hdrs} PROPERTIES GENERATED TRUE)
+  set(${HDRS} ${_hdrs} PARENT_SCOPE)
+endfunction()
@@ -1,6 +1,6 @@
 #include <iostream>
 #include <string>
-#include "user.pb.h"
+#include "user.mprpc.h"
 #include "mprpcapplication.h"
 #include "rpcprovider.h"
 #include <muduo/base/Logging.h>
@@ -8,7 +8,8 @@
 /*
 UserService原来是一个本地服务，提供了两个进程内的本地方法，Login和GetFriendLists
 */
-class UserService : public fixbug::UserServiceRpc	//使用在rpc服务发布端
+// 继承protoc-gen-mprpc生成的骨架，请求按方法下标直接分发到下面的同名方法，不经过反射
+class UserService : public fixbug::UserServiceRpc_Skeleton<UserService>	//使用在rpc服务发布端
 {
 public:
 	bool Login(std::string name, std::string pwd)
@@ -31,7 +32,7 @@ public:
 	}
 
 	/*
-	重写基类UserServiceRpc的虚函数 下面这些方法都是框架直接调用的
+	实现骨架要求的方法 下面这些方法都是框架直接调用的
 	1. caller ====> Login(LoginRequest) => muduo => callee
 	2. callee ====> Login(LoginRequest) => 交到下面重写的Login方法上
 	*/
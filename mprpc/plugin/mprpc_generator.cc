@@ -0,0 +1,244 @@
+// protoc-gen-mprpc：为 .proto 中的每个 service 生成静态分发的服务端骨架和有类型的客户端stub
+// 用法: protoc --plugin=protoc-gen-mprpc=<path> --mprpc_out=<dir> foo.proto  ->  <dir>/foo.mprpc.h
+// 生成的代码只有一个头文件，和 foo.pb.h 放在同一个目录；没有 service 的 .proto 也会生成（内容为空），方便构建系统统一处理
+#include <google/protobuf/compiler/code_generator.h>
+#include <google/protobuf/compiler/plugin.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/printer.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace {
+
+using google::protobuf::Descriptor;
+using google::protobuf::FileDescriptor;
+using google::protobuf::MethodDescriptor;
+using google::protobuf::ServiceDescriptor;
+using google::protobuf::io::Printer;
+
+std::string StripProto(const std::string &filename)
+{
+    const std::string suffix = ".proto";
+    if (filename.size() > suffix.size() &&
+        filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0)
+    {
+        return filename.substr(0, filename.size() - suffix.size());
+    }
+    return filename;
+}
+
+std::string Replace(std::string s, const std::string &from, const std::string &to)
+{
+    for (size_t pos = s.find(from); pos != std::string::npos; pos = s.find(from, pos + to.size()))
+    {
+        s.replace(pos, from.size(), to);
+    }
+    return s;
+}
+
+// package a.b -> ::a::b
+std::string Namespace(const FileDescriptor *file)
+{
+    return file->package().empty() ? "" : "::" + Replace(file->package(), ".", "::");
+}
+
+// 和 protoc 的 C++ 生成器一致：嵌套消息 Outer.Inner 生成的类名是 Outer_Inner
+std::string ClassName(const Descriptor *message)
+{
+    std::string name = message->full_name();
+    const std::string &package = message->file()->package();
+    if (!package.empty()) name = name.substr(package.size() + 1);
+    return Namespace(message->file()) + "::" + Replace(name, ".", "_");
+}
+
+void GenerateDescriptors(Printer &p, const ServiceDescriptor *service)
+{
+    p.Print("// $service$ 的描述符和方法下标，描述符只在首次使用时查找一次\n"
+            "struct $service$_Mprpc\n"
+            "{\n",
+            "service", service->name());
+    p.Indent();
+    p.Print("enum MethodIndex\n{\n");
+    for (int i = 0; i < service->method_count(); ++i)
+    {
+        p.Print("  k$method$ = $index$,\n", "method", service->method(i)->name(), "index", std::to_string(i));
+    }
+    p.Print("  kMethodCount = $count$,\n};\n\n", "count", std::to_string(service->method_count()));
+    p.Print("static const ::google::protobuf::ServiceDescriptor *descriptor()\n"
+            "{\n"
+            "  static const ::google::protobuf::ServiceDescriptor *d =\n"
+            "      ::google::protobuf::DescriptorPool::generated_pool()->FindServiceByName(\"$full_name$\");\n"
+            "  return d;\n"
+            "}\n",
+            "full_name", service->full_name());
+    if (service->method_count() > 0)
+    {
+        p.Print("\nstatic const ::google::protobuf::MethodDescriptor *method(int index)\n"
+                "{\n"
+                "  static const ::google::protobuf::MethodDescriptor *const methods[kMethodCount] = {\n");
+        for (int i = 0; i < service->method_count(); ++i)
+        {
+            p.Print("      descriptor()->method($index$),\n", "index", std::to_string(i));
+        }
+        p.Print("  };\n"
+                "  return methods[index];\n"
+                "}\n");
+    }
+    p.Outdent();
+    p.Print("};\n\n");
+}
+
+void GenerateSkeleton(Printer &p, const ServiceDescriptor *service)
+{
+    std::map<std::string, std::string> vars{{"service", service->name()}};
+    p.Print(vars,
+            "/*\n"
+            "$service$ 的服务端骨架：业务类以 class Impl : public $service$_Skeleton<Impl> 的形式继承，\n"
+            "并实现下列同名方法（普通成员函数，不需要virtual）：\n");
+    for (int i = 0; i < service->method_count(); ++i)
+    {
+        const MethodDescriptor *method = service->method(i);
+        p.Print("  void $method$(::google::protobuf::RpcController *, const $req$ *, $resp$ *, ::google::protobuf::Closure *);\n",
+                "method", method->name(), "req", ClassName(method->input_type()), "resp",
+                ClassName(method->output_type()));
+    }
+    p.Print(vars,
+            "通过 RpcProvider::NotifyService 发布，请求按方法下标 switch 直接分发到 Impl，不经过反射\n"
+            "*/\n"
+            "template <typename Impl>\n"
+            "class $service$_Skeleton : public ::RpcStaticService\n"
+            "{\n"
+            "public:\n");
+    p.Indent();
+    p.Print(vars,
+            "const ::google::protobuf::ServiceDescriptor *GetDescriptor() override\n"
+            "{\n"
+            "  return $service$_Mprpc::descriptor();\n"
+            "}\n\n");
+
+    const char *factories[2][2] = {{"NewRequest", "input"}, {"NewResponse", "output"}};
+    for (const auto &factory : factories)
+    {
+        p.Print("::google::protobuf::Message *$name$(int method_index, ::google::protobuf::Arena *arena) const override\n"
+                "{\n"
+                "  switch (method_index)\n"
+                "  {\n",
+                "name", factory[0]);
+        for (int i = 0; i < service->method_count(); ++i)
+        {
+            const MethodDescriptor *method = service->method(i);
+            const Descriptor *type = std::string(factory[1]) == "input" ? method->input_type() : method->output_type();
+            p.Print("  case $index$:\n"
+                    "    return ::google::protobuf::Arena::CreateMessage<$type$>(arena);\n",
+                    "index", std::to_string(i), "type", ClassName(type));
+        }
+        p.Print("  default:\n"
+                "    return nullptr;\n"
+                "  }\n"
+                "}\n\n");
+    }
+
+    p.Print("void Dispatch(int method_index, ::google::protobuf::RpcController *controller,\n"
+            "              const ::google::protobuf::Message *request, ::google::protobuf::Message *response,\n"
+            "              ::google::protobuf::Closure *done) override\n"
+            "{\n"
+            "  Impl *impl = static_cast<Impl *>(this);\n"
+            "  switch (method_index)\n"
+            "  {\n");
+    for (int i = 0; i < service->method_count(); ++i)
+    {
+        const MethodDescriptor *method = service->method(i);
+        p.Print("  case $index$:\n"
+                "    impl->$method$(controller, static_cast<const $req$ *>(request), static_cast<$resp$ *>(response), done);\n"
+                "    break;\n",
+                "index", std::to_string(i), "method", method->name(), "req", ClassName(method->input_type()),
+                "resp", ClassName(method->output_type()));
+    }
+    p.Print("  default:\n"
+            "    // 下标来自注册时的描述符，不会走到这里；仍然回包，避免调用方一直等待\n"
+            "    if (done) done->Run();\n"
+            "    break;\n"
+            "  }\n"
+            "}\n");
+    p.Outdent();
+    p.Print("};\n\n");
+}
+
+void GenerateClient(Printer &p, const ServiceDescriptor *service)
+{
+    std::map<std::string, std::string> vars{{"service", service->name()}};
+    p.Print(vars,
+            "// $service$ 的客户端stub：方法描述符在首次调用时解析一次，直接以非虚调用进入 MprpcChannel::CallMethod\n"
+            "// done为nullptr时同步调用，否则异步调用，语义同 MprpcChannel::CallMethod\n"
+            "class $service$_Client\n"
+            "{\n"
+            "public:\n");
+    p.Indent();
+    p.Print(vars, "explicit $service$_Client(::MprpcChannel *channel) : m_channel(channel) {}\n\n");
+    for (int i = 0; i < service->method_count(); ++i)
+    {
+        const MethodDescriptor *method = service->method(i);
+        p.Print("void $method$(::google::protobuf::RpcController *controller, const $req$ &request, $resp$ *response,\n"
+                "    ::google::protobuf::Closure *done = nullptr)\n"
+                "{\n"
+                "  m_channel->MprpcChannel::CallMethod($service$_Mprpc::method($service$_Mprpc::k$method$), controller,\n"
+                "                                      &request, response, done);\n"
+                "}\n\n",
+                "service", service->name(), "method", method->name(), "req", ClassName(method->input_type()),
+                "resp", ClassName(method->output_type()));
+    }
+    p.Print("::MprpcChannel *channel() const { return m_channel; }\n");
+    p.Outdent();
+    p.Print("\nprivate:\n"
+            "  ::MprpcChannel *m_channel;\n"
+            "};\n\n");
+}
+
+class MprpcGenerator : public google::protobuf::compiler::CodeGenerator
+{
+public:
+    bool Generate(const FileDescriptor *file, const std::string &, google::protobuf::compiler::GeneratorContext *context,
+                  std::string *) const override
+    {
+        const std::string base = StripProto(file->name());
+        std::unique_ptr<google::protobuf::io::ZeroCopyOutputStream> out(context->Open(base + ".mprpc.h"));
+        Printer p(out.get(), '$');
+
+        p.Print("// Generated by protoc-gen-mprpc. DO NOT EDIT!\n"
+                "// source: $file$\n"
+                "#pragma once\n\n",
+                "file", file->name());
+        if (file->service_count() == 0)
+        {
+            return true;
+        }
+        p.Print("#include \"$base$.pb.h\"\n"
+                "#include \"mprpcchannel.h\"\n"
+                "#include \"rpcstaticservice.h\"\n"
+                "#include <google/protobuf/arena.h>\n"
+                "#include <google/protobuf/descriptor.h>\n\n",
+                "base", base);
+
+        const std::string ns = Namespace(file);
+        if (!ns.empty()) p.Print("namespace $ns$ {\n\n", "ns", ns.substr(2));
+        for (int i = 0; i < file->service_count(); ++i)
+        {
+            const ServiceDescriptor *service = file->service(i);
+            GenerateDescriptors(p, service);
+            GenerateSkeleton(p, service);
+            GenerateClient(p, service);
+        }
+        if (!ns.empty()) p.Print("} // namespace $ns$\n", "ns", ns.substr(2));
+        return true;
+    }
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    MprpcGenerator generator;
+    return google::protobuf::compiler::PluginMain(argc, argv, &generator);
+}
@@ -4,37 +4,142 @@
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
 #include <string>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <cstdint>
+#include <vector>
 #include <netinet/in.h>
 
+class MprpcConnection;
+class MprpcLoadBalancer;
+class MprpcHedgePolicy;
+class MprpcStreamReader;
+struct MprpcEndpoint;
+struct MprpcEndpointList;
+struct RpcTraceContext;
+
+// 批量调用中的一项，结果写入各自的response/controller；controller可以为空，这时不关心这一项是否出错
+struct MprpcBatchCall
+{
+	const google::protobuf::MethodDescriptor *method = nullptr;
+	const google::protobuf::Message *request = nullptr;
+	google::protobuf::Message *response = nullptr;
+	google::protobuf::RpcController *controller = nullptr;
+};
 
 class MprpcChannel: public google::protobuf::RpcChannel
 {
 public:
 	// 所有通过stub代理对象调用的rpc方法，都走到这里了，统一做rpc方法调用的数据序列化和网络发送
+	// 截止时间取controller上设置的，没有则继承当前handler所处理请求的截止时间，再没有则用配置项 rpc_timeout_ms
+	// done为nullptr时同步阻塞；传入done时立即返回，响应到达后在连接的读线程上执行done
+	// （此时controller/response必须存活到done执行完，done中的耗时操作应转投到自己的线程/loop）
 	void CallMethod(const google::protobuf::MethodDescriptor* method,
 					google::protobuf::RpcController* controller,
 					const google::protobuf::Message* request,
 					google::protobuf::Message* response,
 					google::protobuf::Closure* done);
 
+	// 异步调用的future封装：返回的future在调用结束时就绪，值为调用是否成功（失败原因见controller）
+	std::future<bool> CallMethodAsync(const google::protobuf::MethodDescriptor* method,
+									  google::protobuf::RpcController* controller,
+									  const google::protobuf::Message* request,
+									  google::protobuf::Message* response);
+
+	// 服务端流式调用：返回的reader逐条读取响应（类型为方法的返回类型），服务端须用RpcProvider::NotifyStreamMethod注册该方法
+	// 截止时间的来源与CallMethod相同，限制的是整个流；接收窗口由配置项 rpc_stream_window 决定（默认64条）
+	// 失败时同样返回reader，第一次Read返回false，原因见controller；controller须存活到读完或reader析构
+	std::unique_ptr<MprpcStreamReader> CallStream(const google::protobuf::MethodDescriptor* method,
+												  google::protobuf::RpcController* controller,
+												  const google::protobuf::Message* request);
+
+	// 批量调用：calls中的调用打包进一个请求帧发给同一个实例，服务端各自分发（可以并行执行），响应在一个响应帧里一起返回
+	// calls必须属于同一个service，按第一项的方法选择实例；每一项的结果写入它自己的controller（为空时不写），
+	// 整体失败（连不上、超时等）时controller和每一项都以同样的错误结束；controller同样可以为空，截止时间的来源与CallMethod相同
+	// done语义同CallMethod，异步时calls及其中的对象须存活到done执行完
+	void CallBatch(std::vector<MprpcBatchCall>& calls,
+				   google::protobuf::RpcController* controller,
+				   google::protobuf::Closure* done);
+
+	// 为这个channel指定负载均衡策略，覆盖配置项 lb_policy；需要在发起调用前设置
+	void SetLoadBalancer(std::shared_ptr<MprpcLoadBalancer> balancer) { m_balancer = std::move(balancer); }
+
 private:
-	// 将 method/request 序列化为 header(len, service, method) + body 的帧
-	bool buildRequestFrame(const google::protobuf::MethodDescriptor* method,
+	using Clock = std::chrono::steady_clock;
+	using EndpointListPtr = std::shared_ptr<const MprpcEndpointList>;
+	struct HedgedCall; // 一次对冲调用的共享状态
+
+	// 将 method/request 序列化为 header(len, service, method, request_id) + body 的帧
+	// method_id非0时header里只带id，省掉service/method名字；timeout_ms为剩余预算，0表示不限制；
+	// stream_window非0表示服务端流式请求；trace为本次调用的客户端span
+	// peer_accepted为服务端在这条连接上声明过的accept_compression，args够大时按它压缩
+	static bool buildRequestFrame(const google::protobuf::MethodDescriptor* method,
 							 const google::protobuf::Message* request,
+							 uint64_t request_id,
+							 uint32_t method_id,
+							 uint32_t timeout_ms,
+							 uint32_t stream_window,
+							 const RpcTraceContext& trace,
+							 uint32_t peer_accepted,
 							 std::string& out,
 							 google::protobuf::RpcController* controller);
 
-	// 解析 ZK 地址并做简单 TTL 缓存
-	bool resolveEndpoint(const std::string& service,
-						 const std::string& method,
-						 struct sockaddr_in& out,
-						 google::protobuf::RpcController* controller);
+	// 解析 ZK 上的实例列表，缓存由 MprpcResolver 按 zk watch 事件失效；失败时设置controller并返回nullptr
+	std::shared_ptr<const MprpcEndpointList> resolveEndpoints(const std::string& service,
+															  const std::string& method,
+															  google::protobuf::RpcController* controller);
 
-	// 连接池：按 key 复用/归还连接（必要时拨号）
-	int getConnection(const std::string& key, const struct sockaddr_in& addr);
-	void returnConnection(const std::string& key, int fd);
+	// 向endpoint发出一次请求，done为nullptr时同步；hedge不为空时把成功请求的延迟计入对冲延迟的统计
+	// ticket为选实例时熔断器给的放行凭证（MprpcCircuitBreaker::Ticket），结束时随结果交回
+	// 下面几个函数都不访问channel的成员：异步调用结束或对冲请求发出时channel可能已经析构
+	static void sendTo(const EndpointListPtr& endpoints,
+					   const MprpcEndpoint& endpoint,
+					   uint64_t ticket,
+					   const google::protobuf::MethodDescriptor* method,
+					   const google::protobuf::Message* request,
+					   google::protobuf::Message* response,
+					   google::protobuf::RpcController* controller,
+					   google::protobuf::Closure* done,
+					   Clock::time_point deadline,
+					   int timeout_ms,
+					   const RpcTraceContext& trace,
+					   MprpcHedgePolicy* hedge);
 
-	// 阻塞发送/接收（带错误上报）
-	bool sendAll(int fd, const char* data, size_t len, google::protobuf::RpcController* controller);
-	bool recvResponse(int fd, google::protobuf::Message* response, google::protobuf::RpcController* controller);
+	// 对冲调用：主请求hedge_delay_us内没有结束时向另一个实例再发一份，先成功的结果写入response
+	static void hedgedCall(const EndpointListPtr& endpoints,
+						   const MprpcEndpoint& primary,
+						   uint64_t primary_ticket,
+						   const google::protobuf::MethodDescriptor* method,
+						   const google::protobuf::Message* request,
+						   google::protobuf::Message* response,
+						   google::protobuf::RpcController* controller,
+						   google::protobuf::Closure* done,
+						   Clock::time_point deadline,
+						   const RpcTraceContext& trace,
+						   MprpcHedgePolicy* hedge,
+						   uint64_t hedge_delay_us);
+	static void launchHedge(const std::shared_ptr<HedgedCall>& call,
+							const EndpointListPtr& endpoints,
+							const MprpcEndpoint& primary,
+							const google::protobuf::MethodDescriptor* method,
+							Clock::time_point deadline,
+							const RpcTraceContext& trace,
+							MprpcHedgePolicy* hedge);
+	// 发出对冲调用中的第index个请求（0为主请求）
+	static void launchAttempt(const std::shared_ptr<HedgedCall>& call,
+							  int index,
+							  const EndpointListPtr& endpoints,
+							  const MprpcEndpoint& endpoint,
+							  uint64_t ticket,
+							  const google::protobuf::Message* request,
+							  const google::protobuf::MethodDescriptor* method,
+							  Clock::time_point deadline,
+							  const RpcTraceContext& trace,
+							  MprpcHedgePolicy* hedge);
+	// 第index个请求结束：第一个成功的请求胜出，全部失败时以最后一个失败结束
+	static void onAttemptDone(const std::shared_ptr<HedgedCall>& call, int index);
+
+private:
+	std::shared_ptr<MprpcLoadBalancer> m_balancer; // 为空时使用配置的策略
 };
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+/*
+客户端对单个服务实例的熔断器，同一实例的所有方法共享，实例列表刷新后保持不变
+  closed    正常放行；连续失败达到 cb_consecutive_failures 次，或者被判定为延迟离群时熔断
+  open      被摘除，负载均衡跳过该实例；熔断时长从 cb_base_eject_ms 开始，每连续熔断一次翻倍，最长 cb_max_eject_ms
+  half_open 熔断到期后只放行一个探测请求：成功则恢复，失败则再次熔断
+            探测请求由Allow发给它的凭证识别，熔断前发出、迟到的其他调用的结果不改变half_open状态
+失败只统计说明实例本身有问题的框架错误（连不上、超时、过载、内部错误），业务返回的错误码不算
+延迟离群：实例的平均延迟(EWMA)超过同一方法其他实例中位数的 cb_outlier_factor_pct%，并且超过 cb_outlier_min_ms 时熔断，
+同一方法同时被摘除的实例不超过一半，避免整体容量不足时把剩下的实例全部摘掉
+*/
+class MprpcCircuitBreaker
+{
+public:
+	// 放行凭证：探测请求拿到一个非0的编号，其他调用（closed时放行的，或者没有经过Allow的）都是kNoTicket
+	using Ticket = uint64_t;
+	static const Ticket kNoTicket = 0;
+
+	MprpcCircuitBreaker();
+
+	// 选实例时调用：是否允许把这次调用发往该实例（half_open时只有抢到探测名额的调用返回true），凭证写入ticket
+	bool Allow(Ticket *ticket);
+	// 调用结束，ticket为Allow给的凭证：failed表示发生了计入熔断的失败，latency_us只在成功时计入平均延迟，为0表示没有可参考的延迟（例如流式调用）
+	// Allow()放行的调用都必须Report或Release，否则half_open的探测名额一直被占着，实例再也不会被放行
+	void Report(Ticket ticket, bool failed, uint64_t latency_us);
+	// Allow()放行之后请求并没有发出（例如序列化失败）：归还探测名额，不改变状态
+	void Release(Ticket ticket);
+	// 判定为延迟离群时直接熔断
+	void Eject();
+
+	// 当前是否处于熔断状态（open或half_open）
+	bool Ejected() const { return m_state.load(std::memory_order_relaxed) != kClosed; }
+	// 成功调用的平均延迟，还没有样本时为0
+	uint64_t LatencyUs() const { return m_ewmaUs.load(std::memory_order_relaxed); }
+	// 每隔若干次成功调用返回一次true，提示调用方做一次离群检测，避免每次调用都比较所有实例
+	bool ShouldCheckOutlier() { return (m_reports.fetch_add(1, std::memory_order_relaxed) & 15) == 15; }
+
+	// 错误码(RpcErrorCode)是否计入熔断
+	static bool IsFailure(int error_code);
+	// 离群判定的参数
+	static double OutlierFactor();
+	static uint64_t OutlierMinUs();
+
+private:
+	enum State
+	{
+		kClosed = 0,
+		kOpen = 1,
+		kHalfOpen = 2,
+	};
+
+	// 转入open状态，熔断时长按连续熔断次数翻倍
+	void Trip();
+
+private:
+	std::atomic<int> m_state;
+	std::atomic<uint32_t> m_consecutiveFailures;
+	std::atomic<int64_t> m_openUntilUs; // open状态的到期时间
+	std::atomic<Ticket> m_probe;		 // half_open时在途探测请求的凭证，没有时为kNoTicket
+	std::atomic<Ticket> m_nextTicket;
+	std::atomic<uint64_t> m_ewmaUs;
+	std::atomic<uint64_t> m_reports;
+
+	std::mutex m_tripMu;	// 状态迁移时保护熔断次数
+	uint32_t m_ejections;	// 连续熔断的次数，恢复后清零
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <google/protobuf/service.h>
+#include <functional>
+#include <utility>
+
+// 把任意可调用对象包装成protobuf的Closure，Run()执行一次后自动delete
+// google::protobuf::NewCallback最多只能绑定两个参数，框架内部的回调需要携带更多的调用上下文
+class MprpcClosure : public google::protobuf::Closure
+{
+public:
+	explicit MprpcClosure(std::function<void()> fn) : m_fn(std::move(fn)) {}
+
+	void Run() override
+	{
+		std::function<void()> fn = std::move(m_fn);
+		delete this;
+		if (fn) fn();
+	}
+
+private:
+	std::function<void()> m_fn;
+};
+
+inline google::protobuf::Closure *NewMprpcClosure(std::function<void()> fn)
+{
+	return new MprpcClosure(std::move(fn));
+}
@@ -12,6 +12,8 @@ public:
 	void LoadConfigFile(const char *config_file);
 	// 查询配置项信息
 	std::string Load(const std::string &key);
+	// 查询整数配置项，不存在或不合法时返回default_value
+	int LoadInt(const std::string &key, int default_value);
 private:
 	std::unordered_map<std::string, std::string> m_configMap;
 	// 去掉字符串前后的空格
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <google/protobuf/service.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mprpc { class RpcResponseHeader; }
+struct MprpcStreamQueue;
+struct MprpcBatchCall;
+
+/*
+客户端侧的一条多路复用TCP连接
+多个线程的请求共用同一个fd：发送时按帧加锁写入，响应由独立的读线程按request_id分发给等待者，
+因此同一连接上可以同时有任意多个在途请求，服务端也可以乱序返回
+开启写合并（rpc_write_coalesce）后，写入进行中排队的帧由正在写的线程一起用一次sendmsg发出
+*/
+class MprpcConnection : public std::enable_shared_from_this<MprpcConnection>
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// 建立到addr的连接并启动读线程，失败返回nullptr（errno保留connect的错误，超时为ETIMEDOUT）
+	// timeout_ms>0时用非阻塞connect+poll限制建连时间
+	static std::shared_ptr<MprpcConnection> Connect(const struct sockaddr_in &addr, int timeout_ms = 0);
+	// 连接同机实例的unix域socket，其余与Connect相同
+	static std::shared_ptr<MprpcConnection> ConnectUnix(const std::string &path, int timeout_ms = 0);
+
+	~MprpcConnection();
+
+	// 发送一个已经编码好的请求帧(帧内的request_id必须与参数一致)，method用于从响应中学习方法id
+	// done为nullptr时阻塞直到响应到达或连接失效；否则立即返回，响应到达后在读线程上执行done
+	// 异步模式下response/controller必须存活到done执行，done里不要做耗时操作，以免拖住同一连接上的其他响应
+	// 到deadline还没有响应时以RPC_DEADLINE_EXCEEDED结束（之后迟到的响应直接丢弃）
+	bool Call(uint64_t request_id, const google::protobuf::MethodDescriptor *method, const std::string &frame,
+			  google::protobuf::Message *response,
+			  google::protobuf::RpcController *controller,
+			  google::protobuf::Closure *done = nullptr,
+			  Clock::time_point deadline = Clock::time_point::max());
+
+	// 发送一个批量请求帧，批量响应到达后把各子响应写入calls中对应的项；其余语义与Call相同
+	// 整体失败（连接失效、超时）时controller和calls中的每一项都以同样的错误结束
+	bool CallBatch(uint64_t request_id, const std::string &frame, std::vector<MprpcBatchCall> *calls,
+				   google::protobuf::RpcController *controller,
+				   google::protobuf::Closure *done = nullptr,
+				   Clock::time_point deadline = Clock::time_point::max());
+
+	// 发出一个服务端流式请求，之后同一request_id的每条消息依次放入queue，
+	// 流结束、连接失效或到deadline时queue->End；发送失败返回false（此时queue已经End）
+	bool CallStream(uint64_t request_id, const google::protobuf::MethodDescriptor *method, const std::string &frame,
+					const std::shared_ptr<MprpcStreamQueue> &queue,
+					Clock::time_point deadline = Clock::time_point::max());
+	// 流控帧：为request_id的流追加credit条发送窗口；cancel为true时请求服务端结束该流
+	bool SendStreamControl(uint64_t request_id, uint32_t credit, bool cancel);
+
+	// 连接是否仍然可用（读线程发现对端关闭或出错后置为false）
+	bool Alive() const { return m_alive.load(std::memory_order_acquire); }
+	// 当前在途请求数量，连接池据此挑选最空闲的连接
+	size_t Inflight() const { return m_inflight.load(std::memory_order_relaxed); }
+	// 最近一次发出请求或收到响应的时间，连接池据此关闭空闲连接
+	Clock::time_point LastActive() const
+	{
+		return Clock::time_point(Clock::duration(m_lastActive.load(std::memory_order_relaxed)));
+	}
+	void Touch() { m_lastActive.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed); }
+
+	// 服务端在这条连接上告知过的方法id，未知返回0（此时请求需带上service/method名字）
+	// 方法id只在同一个服务端进程内有效，所以按连接缓存，重连后重新学习
+	uint32_t MethodId(const google::protobuf::MethodDescriptor *method);
+
+	// 服务端在这条连接上声明过的accept_compression（能解压的算法位图），还没收到过时为0，请求不压缩
+	uint32_t PeerAcceptedCompression() const { return m_peerAccepted.load(std::memory_order_relaxed); }
+
+	// 主动关闭：唤醒读线程，所有在途请求以失败结束
+	void Close();
+
+private:
+	// 一次在途调用的等待状态
+	struct PendingCall
+	{
+		const google::protobuf::MethodDescriptor *method = nullptr;
+		google::protobuf::Message *response = nullptr;
+		google::protobuf::RpcController *controller = nullptr;
+		google::protobuf::Closure *done = nullptr; // 异步调用的完成回调
+		std::shared_ptr<MprpcStreamQueue> stream;   // 流式调用的接收队列，非空时response/controller/done都不使用
+		std::vector<MprpcBatchCall> *batch = nullptr; // 批量调用的各项，非空时response不使用
+		std::mutex mu;
+		std::condition_variable cv;
+		bool finished = false;
+	};
+	using PendingCallPtr = std::shared_ptr<PendingCall>;
+
+	explicit MprpcConnection(int fd);
+	// 连接已建立：创建连接对象并启动读线程
+	static std::shared_ptr<MprpcConnection> Start(int fd);
+
+	// 登记在途调用并发出请求帧，同步调用等到结束；Call和CallBatch共用
+	bool Issue(const PendingCallPtr &call, uint64_t request_id, const std::string &frame, Clock::time_point deadline);
+	// 把批量响应的body拆成各子响应，写入call->batch中对应的项
+	void DispatchBatch(const PendingCallPtr &call, const char *body, size_t body_size);
+	// 整帧写出，m_sendMu保证多个线程的帧不会交错；开启写合并时转给CoalesceFrame
+	bool SendFrame(const std::string &frame);
+	// 写合并：帧先进入发送队列，没有线程在写时由当前线程成为写者，把队列里的帧（包括写的过程中新排进来的）
+	// 成批发出直到队列为空；其他线程等到自己的帧被写出再返回，因此frame不需要拷贝
+	bool CoalesceFrame(const std::string &frame);
+	// 读线程：循环读取响应帧并分发
+	void ReadLoop();
+	// 处理一个完整的响应帧
+	void Dispatch(const mprpc::RpcResponseHeader &header, const char *body, size_t body_size);
+	// 截止时间已到：如果调用还在途，以超时失败结束它
+	void Expire(uint64_t request_id);
+	// 从在途表中摘除request_id，返回nullptr表示已经被别人摘走
+	PendingCallPtr TakePending(uint64_t request_id);
+	// 标记连接失效，并让所有在途请求以reason失败
+	void FailAll(const std::string &reason);
+	// 以错误码结束一个已经摘下的调用（普通调用写controller，流式调用结束接收队列）
+	void FailCall(const PendingCallPtr &call, int error_code, const std::string &reason);
+	// 把错误写到调用上：普通调用写controller（批量调用连同每一项），流式调用结束接收队列
+	static void SetCallError(const PendingCallPtr &call, int error_code, const std::string &reason);
+	// 结束一次在途调用：扣减在途计数，然后Complete
+	void Finish(const PendingCallPtr &call);
+	// 同步调用唤醒等待者，异步调用执行done；不涉及在途计数，还没登记为在途的调用直接用它结束
+	static void Complete(const PendingCallPtr &call);
+
+private:
+	int m_fd;
+	std::atomic<bool> m_alive;
+	std::atomic<size_t> m_inflight;
+	std::atomic<Clock::rep> m_lastActive;
+
+	std::mutex m_sendMu;	// 保护fd上的写
+
+	// 写合并的发送队列，由m_queueMu保护；m_queuedSeq/m_sentSeq是入队/写完的帧数，用来判断自己的帧是否已经发出
+	std::mutex m_queueMu;
+	std::condition_variable m_queueCv;
+	std::vector<const std::string *> m_sendQueue;
+	uint64_t m_queuedSeq = 0;
+	uint64_t m_sentSeq = 0;
+	bool m_writing = false;	   // 是否有线程正在作为写者发送
+	bool m_sendBroken = false; // 写失败过，之后的帧都不再发送
+	std::mutex m_pendingMu; // 保护在途表
+	std::unordered_map<uint64_t, PendingCallPtr> m_pending;
+
+	std::atomic<uint32_t> m_peerAccepted{0};
+
+	std::mutex m_methodIdMu; // 保护方法id缓存
+	std::unordered_map<const google::protobuf::MethodDescriptor *, uint32_t> m_methodIds;
+
+	std::thread m_reader;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MprpcConnection;
+struct MprpcEndpoint;
+
+/*
+客户端连接池：按提供者实例(ip:port)分组，每个实例只保留少量多路复用连接，所有方法、所有线程的在途请求共享
+后台维护线程定期巡检：
+  - 剔除读线程已经判定失效的连接
+  - 关闭空闲超过 rpc_pool_idle_timeout_ms 的连接（预热实例保留 rpc_pool_prewarm 条）
+  - 为预热实例补足 rpc_pool_prewarm 条连接，避免长时间空闲后的第一次调用承担connect延迟
+对端静默消失（没有FIN）的情况由连接上的TCP keepalive探测，读线程出错后下一轮巡检即剔除
+*/
+class MprpcConnectionPool
+{
+public:
+	// 连接池的累计计数
+	struct Stats
+	{
+		uint64_t hits = 0;			// 直接复用了已有连接
+		uint64_t misses = 0;		// 需要新拨一条连接
+		uint64_t dials = 0;			// 拨号次数（含预热）
+		uint64_t dialFailures = 0;	// 拨号失败次数
+		uint64_t unixDials = 0;		// 其中走unix域socket成功的次数
+		uint64_t evictedIdle = 0;	// 因空闲被关闭的连接数
+		uint64_t evictedDead = 0;	// 因失效被剔除的连接数
+		size_t connections = 0;		// 当前池中的连接数
+	};
+
+	static MprpcConnectionPool &GetInstance();
+
+	// 取一条到实例endpoint的连接：优先复用在途请求最少的连接，
+	// 所有连接都在忙且数量未到上限时再拨一条新连接；connect_timeout_ms>0时限制拨号时间，失败返回nullptr
+	// 实例公布了unix域socket时优先拨它，连不上再退回TCP
+	std::shared_ptr<MprpcConnection> Acquire(const MprpcEndpoint &endpoint, int connect_timeout_ms = 0);
+
+	// 发现了这些实例：配置了 rpc_pool_prewarm 时由维护线程在后台为它们预先拨好连接，否则什么也不做
+	void Prewarm(const std::vector<MprpcEndpoint> &endpoints);
+
+	Stats GetStats() const;
+	// GetStats的文本形式（一行），附在RpcProvider的统计输出中，也由维护线程按 rpc_pool_stats_log_ms 周期打日志
+	std::string Dump() const;
+
+private:
+	MprpcConnectionPool();
+	MprpcConnectionPool(const MprpcConnectionPool &) = delete;
+	MprpcConnectionPool &operator=(const MprpcConnectionPool &) = delete;
+
+	// 实例的拨号地址
+	struct Target
+	{
+		sockaddr_in addr{};
+		std::string unixPath; // 为空时只走TCP
+	};
+
+	// 同一实例的所有连接，warm为true时维护线程负责保持预热连接数
+	struct Bucket
+	{
+		Target target;
+		bool warm = false;
+		std::vector<std::shared_ptr<MprpcConnection>> conns;
+	};
+
+	// 维护线程：按 rpc_pool_sweep_interval_ms 周期巡检
+	void MaintainLoop();
+	// 一次巡检：剔除失效/空闲连接，返回需要补连接的实例
+	void Sweep(std::vector<std::pair<std::string, Target>> &to_dial);
+	// 为预热实例拨一条连接，失败时取消该实例的预热（实例下线后不再反复拨号，重新发现时再预热）
+	void DialWarm(const std::string &key, const Target &target);
+	// 拨号：有unix域socket时先试它，失败（例如调用方在另一个容器里看不到socket文件）再走TCP
+	std::shared_ptr<MprpcConnection> Dial(const Target &target, int timeout_ms);
+
+private:
+	size_t m_maxConnsPerKey;
+	size_t m_prewarm;
+	int m_idleTimeoutMs;
+	int m_sweepIntervalMs;
+	int m_statsLogMs;
+
+	mutable std::mutex m_mu;
+	std::condition_variable m_cv; // Prewarm时唤醒维护线程立即补连接
+	std::unordered_map<std::string, Bucket> m_buckets;
+	uint64_t m_rr; // 池满时多拨的连接被放弃，按轮询改用池里的连接
+
+	std::atomic<uint64_t> m_hits;
+	std::atomic<uint64_t> m_misses;
+	std::atomic<uint64_t> m_dials;
+	std::atomic<uint64_t> m_dialFailures;
+	std::atomic<uint64_t> m_unixDials;
+	std::atomic<uint64_t> m_evictedIdle;
+	std::atomic<uint64_t> m_evictedDead;
+};
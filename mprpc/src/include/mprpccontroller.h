@@ -1,16 +1,39 @@
 #pragma once
 #include <google/protobuf/service.h>
+#include <chrono>
 #include <string>
 
 class MprpcController : public google::protobuf::RpcController
 {
 public:
+	using Clock = std::chrono::steady_clock;
+
 	MprpcController();
 	void Reset();
 	bool Failed() const;
 	std::string ErrorText() const;
 	void SetFailed(const std::string& reason);
-    // 还原：不提供超时接口
+	// 带错误码的失败，error_code取值见rpcheader.proto中的RpcErrorCode
+	void SetFailed(int error_code, const std::string& reason);
+	// 失败时的错误码；只调用了SetFailed(reason)时为RPC_INTERNAL，成功时为0
+	int ErrorCode() const;
+	// 框架内部使用：controller是MprpcController时带上错误码，否则只设置原因；controller为nullptr时什么也不做
+	static void Fail(google::protobuf::RpcController* controller, int error_code, const std::string& reason);
+
+	// 超时：从现在起timeout_ms毫秒内必须拿到响应，<=0表示不限制
+	void SetTimeout(int timeout_ms);
+	// 截止时间：剩余预算随请求头带到服务端，服务端在排队期间已经过期的请求直接丢弃
+	void SetDeadline(Clock::time_point deadline);
+	bool HasDeadline() const;
+	Clock::time_point Deadline() const;	// 未设置时为time_point::max()
+
+	// 服务端执行handler期间，本线程发起的下游调用在没有设置截止时间时默认继承它
+	static void SetInheritedDeadline(Clock::time_point deadline);
+	static Clock::time_point InheritedDeadline();
+
+	// 一致性哈希负载均衡的路由键（例如uid），相同的键总是落到同一个服务实例上；为空时按其他策略选择
+	void SetHashKey(const std::string& key);
+	const std::string& HashKey() const;
 
 	// 目前未实现具体的功能
 	void StartCancel();
@@ -18,6 +41,8 @@ public:
 	void NotifyOnCancel(google::protobuf::Closure* callback);
 private:
 	bool m_failed;	//RPC方法执行过程中的状态
+	int m_errorCode;	//RPC方法执行过程中的错误码
 	std::string m_errText;	//RPC方法执行过程中的错误信息
-    // 还原：不保存超时字段
-};
\ No newline at end of file
+	Clock::time_point m_deadline;	//调用的截止时间
+	std::string m_hashKey;	//一致性哈希的路由键
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+/*
+mprpc的C++20协程层：把异步RPC写成顺序代码，等待下游期间不占用任何线程
+框架本身仍按C++17编译，只有以 -std=c++20 编译的使用方才能用到本文件的内容
+
+客户端，等待一次RPC调用（stub和channel两种写法）：
+  MprpcController ctl;
+  co_await MprpcAsync([&](google::protobuf::Closure *done) { stub.QueryRoute(&ctl, &req, &resp, done); });
+  co_await MprpcCall(&channel, method, &ctl, &req, &resp);
+
+服务端，用协程实现rpc方法，co_return之后自动调用done回包：
+  void Send(RpcController *ctl, const SendReq *req, SendResp *resp, Closure *done) override
+  {
+      MprpcSpawn(SendCo(req, resp), done);
+  }
+  MprpcTask<> SendCo(const SendReq *req, SendResp *resp);
+
+恢复线程：挂起时如果在业务线程池的线程上，结果到达后把协程提交回同一个线程池恢复，后续的阻塞操作（例如MySQL）
+仍然在业务线程上执行；否则直接在执行done的rpc IO线程上恢复。线程池队列满时也在IO线程上恢复，不会丢掉协程
+恢复前重新设置链路追踪上下文和继承的deadline，下游调用和同步写法一样串在同一条trace上、继承同一个deadline
+*/
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include "mprpcclosure.h"
+#include "mprpccontroller.h"
+#include "rpcthreadpool.h"
+#include "rpctrace.h"
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <typename T = void>
+class MprpcTask;
+
+namespace mprpc_detail {
+
+struct TaskPromiseBase
+{
+	// 任务结束时切回等待它的协程（对称转移，不会随调用链加深而爆栈）
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			std::coroutine_handle<> next = h.promise().m_continuation;
+			return next ? next : std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	FinalAwaiter final_suspend() const noexcept { return {}; }
+	void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+	std::coroutine_handle<> m_continuation;
+	std::exception_ptr m_exception;
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase
+{
+	MprpcTask<T> get_return_object() noexcept;
+	template <typename U>
+	void return_value(U &&value) { m_value.emplace(std::forward<U>(value)); }
+
+	T take()
+	{
+		if (m_exception) std::rethrow_exception(m_exception);
+		return std::move(*m_value);
+	}
+
+	std::optional<T> m_value;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase
+{
+	MprpcTask<void> get_return_object() noexcept;
+	void return_void() const noexcept {}
+
+	void take()
+	{
+		if (m_exception) std::rethrow_exception(m_exception);
+	}
+};
+
+// MprpcSpawn的外层协程：立即开始执行，结束时自己释放协程帧
+struct Detached
+{
+	struct promise_type
+	{
+		Detached get_return_object() const noexcept { return {}; }
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		// 和同步handler抛出异常一样，没有人能接住，直接终止
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+};
+
+} // namespace mprpc_detail
+
+/*
+惰性启动的协程任务：co_await时才开始执行，结束后恢复等待它的协程
+只能被co_await一次；最外层的任务交给MprpcSpawn启动
+*/
+template <typename T>
+class MprpcTask
+{
+public:
+	using promise_type = mprpc_detail::TaskPromise<T>;
+
+	explicit MprpcTask(std::coroutine_handle<promise_type> h) noexcept : m_handle(h) {}
+	MprpcTask(MprpcTask &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+	MprpcTask &operator=(MprpcTask &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_handle) m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+	MprpcTask(const MprpcTask &) = delete;
+	MprpcTask &operator=(const MprpcTask &) = delete;
+	~MprpcTask()
+	{
+		if (m_handle) m_handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		m_handle.promise().m_continuation = awaiting;
+		return m_handle;
+	}
+	T await_resume() { return m_handle.promise().take(); }
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+MprpcTask<T> mprpc_detail::TaskPromise<T>::get_return_object() noexcept
+{
+	return MprpcTask<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline MprpcTask<void> mprpc_detail::TaskPromise<void>::get_return_object() noexcept
+{
+	return MprpcTask<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/*
+等待一次异步RPC：start收到一个done，把它传给stub方法或者channel->CallMethod
+done在发起调用时同步执行（例如没有可用实例直接失败）时不挂起，直接继续往下执行
+*/
+template <typename Start>
+class MprpcCallAwaiter
+{
+public:
+	explicit MprpcCallAwaiter(Start start) : m_start(std::move(start)), m_completed(false) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		m_handle = h;
+		m_pool = RpcThreadPool::Current();
+		m_trace = RpcTracer::Current();
+		m_deadline = MprpcController::InheritedDeadline();
+		m_start(NewMprpcClosure([this]() { OnDone(); }));
+		// 先到的一方只做标记，后到的一方负责继续执行：done已经执行过时返回false，不挂起
+		return !m_completed.exchange(true, std::memory_order_acq_rel);
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+	void OnDone()
+	{
+		// await_suspend还没返回：由它返回false继续执行，这之后awaiter可能已经销毁，不能再访问成员
+		if (!m_completed.exchange(true, std::memory_order_acq_rel)) return;
+
+		auto resume = [h = m_handle, trace = m_trace, deadline = m_deadline]() {
+			const MprpcController::Clock::time_point saved = MprpcController::InheritedDeadline();
+			{
+				RpcTraceScope trace_scope(trace);
+				MprpcController::SetInheritedDeadline(deadline);
+				h.resume();
+			}
+			MprpcController::SetInheritedDeadline(saved);
+		};
+		RpcThreadPool *pool = m_pool;
+		if (pool != nullptr && pool->Submit(resume)) return;
+		resume();
+	}
+
+private:
+	Start m_start;
+	std::atomic<bool> m_completed;
+	std::coroutine_handle<> m_handle;
+	RpcThreadPool *m_pool = nullptr;
+	RpcTraceContext m_trace;
+	MprpcController::Clock::time_point m_deadline;
+};
+
+template <typename Start>
+MprpcCallAwaiter<Start> MprpcAsync(Start start)
+{
+	return MprpcCallAwaiter<Start>(std::move(start));
+}
+
+inline auto MprpcCall(google::protobuf::RpcChannel *channel, const google::protobuf::MethodDescriptor *method,
+					  google::protobuf::RpcController *controller, const google::protobuf::Message *request,
+					  google::protobuf::Message *response)
+{
+	return MprpcAsync([=](google::protobuf::Closure *done) {
+		channel->CallMethod(method, controller, request, response, done);
+	});
+}
+
+namespace mprpc_detail {
+inline Detached RunDetached(MprpcTask<void> task, google::protobuf::Closure *done)
+{
+	co_await task;
+	if (done) done->Run();
+}
+} // namespace mprpc_detail
+
+// 启动一个协程实现的rpc方法：在当前线程上执行到第一次挂起为止，task结束后调用done
+inline void MprpcSpawn(MprpcTask<void> task, google::protobuf::Closure *done = nullptr)
+{
+	mprpc_detail::RunDetached(std::move(task), done);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "rpcmetrics.h"
+#include <google/protobuf/descriptor.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+/*
+幂等读方法的请求对冲(hedging)：第一次请求在对冲延迟内没有返回时，向另一个实例再发一份，取先成功的响应，后到的直接丢弃
+对冲延迟取该方法上一个统计窗口内单次请求延迟的分位数；还没有足够样本时不对冲
+对冲请求受预算限制：每次调用积累 rpc_hedge_budget_pct% 个令牌，发一次对冲消耗一个，实例整体变慢时请求量不会翻倍
+
+配置项：
+rpc_hedge.<Service>.<Method> / rpc_hedge.<Service>   1表示允许对冲，默认0；只能对没有副作用的读方法开启
+rpc_hedge_percentile       对冲延迟取的分位数，默认95
+rpc_hedge_min_delay_ms     对冲延迟的下限，默认1
+rpc_hedge_budget_pct       对冲请求数占调用数的上限(百分比)，默认10
+rpc_hedge_window_ms        延迟统计窗口，默认1000
+*/
+class MprpcHedgePolicy
+{
+public:
+	// 方法没有开启对冲时返回nullptr；返回的对象在进程内一直有效
+	static MprpcHedgePolicy *For(const google::protobuf::MethodDescriptor *method);
+
+	// 一次调用开始：积累对冲预算，返回这次调用的对冲延迟(微秒)，0表示不对冲
+	uint64_t OnCall();
+	// 对冲延迟到期、准备发对冲请求时申请预算，返回false表示预算已用完
+	bool TryHedge();
+	// TryHedge成功但最终没有发出对冲请求（例如没有其他可用实例）时退回预算
+	void RefundHedge();
+	// 单次请求（主请求或对冲请求）成功结束时的延迟
+	void Record(uint64_t latency_us);
+
+private:
+	MprpcHedgePolicy();
+
+	// 统计窗口结束：按窗口内的分位数更新对冲延迟，并开始新窗口（只有一个线程进入）
+	void Roll(int64_t now_us);
+
+private:
+	double m_percentile;
+	uint64_t m_minDelayUs;
+	int64_t m_budgetMilli; // 每次调用积累的令牌，单位千分之一个
+	int64_t m_windowUs;
+
+	RpcLatencyHistogram m_window;
+	std::atomic<int64_t> m_windowEndUs;
+	std::mutex m_rollMu;
+	std::atomic<uint64_t> m_delayUs;
+	std::atomic<int64_t> m_tokensMilli;
+};
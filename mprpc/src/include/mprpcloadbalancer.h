@@ -0,0 +1,26 @@
+#pragma once
+
+#include "mprpcresolver.h"
+#include <memory>
+#include <string>
+
+/*
+客户端负载均衡策略：从某个方法的实例列表中为一次调用选出一个实例
+内置三种策略，通过配置项 lb_policy / lb_policy.<Service> 选择：
+round_robin      轮询（默认）
+p2c              随机取两个实例，选在途请求少的那个（power of two choices）
+consistent_hash  按controller上的路由键（如uid）做一致性哈希，实例增减时只迁移少量键；未设置路由键时退化为p2c
+也可以继承本类实现自己的策略，通过 MprpcChannel::SetLoadBalancer 设置到channel上
+*/
+class MprpcLoadBalancer
+{
+public:
+	virtual ~MprpcLoadBalancer() = default;
+
+	// list至少包含一个实例；hash_key为调用方设置的路由键，可能为空
+	// 会被多个线程同时调用，实现需要自己保证线程安全
+	virtual const MprpcEndpoint &Select(const MprpcEndpointList &list, const std::string &hash_key) = 0;
+
+	// 按名字创建内置策略，未知的名字返回nullptr
+	static std::shared_ptr<MprpcLoadBalancer> Create(const std::string &policy);
+};
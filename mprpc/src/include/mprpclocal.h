@@ -0,0 +1,55 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 本进程内发布的一个服务，由RpcProvider实现并注册到MprpcLocalRegistry
+class MprpcLocalTarget
+{
+public:
+	virtual ~MprpcLocalTarget() {}
+
+	// 直接执行method：request/response就是调用方的对象，不序列化；handler结束后执行done（不能为空）
+	// run_inline为true时在当前线程上执行handler（同步调用），否则和远程调用一样交给方法所属的业务线程池
+	// deadline为调用的截止时间，handler执行期间作为继承的截止时间
+	virtual void CallLocal(const google::protobuf::MethodDescriptor *method,
+						   google::protobuf::RpcController *controller,
+						   const google::protobuf::Message *request,
+						   google::protobuf::Message *response,
+						   google::protobuf::Closure *done,
+						   std::chrono::steady_clock::time_point deadline,
+						   bool run_inline) = 0;
+};
+
+/*
+进程内的服务注册表：RpcProvider::Run 把NotifyService过的服务登记在这里（配置项 rpc_local_shortcut，默认1），
+同一进程里的MprpcChannel调用这些服务时直接调用服务对象，不经过序列化、连接和zookeeper
+各服务拆成独立进程部署时注册表为空，调用照常走网络，服务和调用方的代码都不需要改
+*/
+class MprpcLocalRegistry
+{
+public:
+	static MprpcLocalRegistry &GetInstance();
+
+	void Register(const std::string &service, std::shared_ptr<MprpcLocalTarget> target);
+	// 只删除仍然指向target的登记，避免删掉后来者的登记
+	void Unregister(const std::string &service, const MprpcLocalTarget *target);
+	// 本进程内发布了service时返回它，否则返回nullptr；没有任何登记时不加锁
+	std::shared_ptr<MprpcLocalTarget> Find(const std::string &service) const;
+
+private:
+	MprpcLocalRegistry() = default;
+	MprpcLocalRegistry(const MprpcLocalRegistry &) = delete;
+	MprpcLocalRegistry &operator=(const MprpcLocalRegistry &) = delete;
+
+	mutable std::mutex m_mu;
+	std::unordered_map<std::string, std::shared_ptr<MprpcLocalTarget>> m_targets;
+	std::atomic<size_t> m_size{0};
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "zookeeperutil.h"
+#include "mprpccircuitbreaker.h"
+#include <netinet/in.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 一个服务提供者实例
+struct MprpcEndpoint
+{
+	std::string id;		// "ip:port"，同时作为连接池的key
+	sockaddr_in addr{};
+	std::string unixPath; // 同机实例公布的unix域socket路径，为空时只走TCP
+	// 客户端发往该实例的在途请求数，同一实例的所有方法共享，实例列表刷新后保持不变
+	std::shared_ptr<std::atomic<uint32_t>> outstanding;
+	// 该实例的熔断器，同样跨越实例列表的刷新
+	std::shared_ptr<MprpcCircuitBreaker> breaker;
+};
+
+// 某个方法当前的实例列表快照，创建后不再修改，可以被多个线程同时读取
+struct MprpcEndpointList
+{
+	std::vector<MprpcEndpoint> endpoints;
+
+	// 一致性哈希环 (hash, endpoints下标)，按hash升序，第一次按键路由时才构建
+	mutable std::once_flag ringOnce;
+	mutable std::vector<std::pair<uint64_t, uint32_t>> ring;
+};
+using MprpcEndpointListPtr = std::shared_ptr<const MprpcEndpointList>;
+
+/*
+客户端侧的服务发现缓存
+提供者在 /Service/Method 下注册 ip:port 临时子节点，这里维护每个方法路径的实例列表
+第一次解析某个方法路径时同步读zk并挂上子节点watch，之后的解析直接命中本地缓存，不再访问zk；
+实例上下线、方法节点被删除或被创建时，zk事件线程把对应的缓存项作废，下一次解析再重新读取并挂watch
+zk会话过期时所有watch随之失效：缓存的列表保留下来继续使用（标记为没有watch），后台线程重建会话后
+逐个重新读取并挂watch；重建完成之前，以及重新读取失败时，解析都返回最后一次成功读到的列表
+*/
+class MprpcResolver
+{
+public:
+	static MprpcResolver &GetInstance();
+
+	// 解析method_path("/Service/Method")当前的实例列表（至少一个实例），失败时返回nullptr并由err给出原因
+	MprpcEndpointListPtr Resolve(const std::string &method_path, std::string &err);
+
+private:
+	MprpcResolver();
+	MprpcResolver(const MprpcResolver &) = delete;
+	MprpcResolver &operator=(const MprpcResolver &) = delete;
+
+	// 由子节点名构造实例列表，非法的子节点跳过
+	MprpcEndpointListPtr BuildList(const std::string &method_path, const std::vector<std::string> &children);
+	// 作废一个路径的缓存（zk事件线程调用）
+	void Invalidate(const std::string &path);
+	// 会话过期（zk事件线程调用）：session是watch注册时的会话代数，同一个会话只处理一次
+	// 所有缓存项标记为没有watch但保留列表，然后起后台线程重建会话
+	void OnSessionExpired(uint64_t session);
+	// 后台线程：重新连接zk，再重新读取所有缓存的路径并挂watch
+	void Recover();
+
+private:
+	// 缓存项：没有实例也会缓存（同样有watch兜底），避免对不存在的服务反复访问zk
+	// watched为false表示watch随会话过期失效了，列表只作为读zk失败时的兜底，下一次解析会重新读取
+	struct Entry
+	{
+		MprpcEndpointListPtr list;
+		std::string err;
+		bool watched = true;
+	};
+
+	std::once_flag m_zkOnce; // zk客户端在第一次解析时才连接
+	ZkClient m_zk;
+	// 读zk时持共享锁；重建会话时持独占锁替换句柄，期间解析不等待，直接使用缓存的列表
+	std::shared_mutex m_zkMu;
+	uint64_t m_session; // 会话代数，每次会话过期递增（受m_mu保护）
+
+	std::mutex m_mu;
+	std::unordered_map<std::string, Entry> m_cache;
+	// 实例id -> 在途请求计数，让负载信息跨越实例列表的刷新
+	std::unordered_map<std::string, std::shared_ptr<std::atomic<uint32_t>>> m_outstanding;
+	// 实例id -> 熔断器，实例短暂下线再上线时熔断状态不丢
+	std::unordered_map<std::string, std::shared_ptr<MprpcCircuitBreaker>> m_breakers;
+	// 每次作废都递增；读zk前后不一致说明期间有事件到达，读到的结果可能已经过期，不写入缓存
+	uint64_t m_epoch;
+};
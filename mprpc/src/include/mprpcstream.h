@@ -0,0 +1,88 @@
+#pragma once
+
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class MprpcConnection;
+
+// 流式调用在客户端的接收队列：连接的读线程放入消息，调用方线程取出
+// 服务端按客户端给出的窗口发送，队列里最多只有一个窗口的消息
+struct MprpcStreamQueue
+{
+	std::mutex mu;
+	std::condition_variable cv;
+	std::deque<std::string> messages; // 还没有被读取的消息（序列化的body）
+	bool ended = false;
+	int errorCode = 0; // 流的结果，RpcErrorCode
+	std::string errorText;
+
+	void Push(const char *body, size_t size)
+	{
+		{
+			std::lock_guard<std::mutex> lk(mu);
+			messages.emplace_back(body, size);
+		}
+		cv.notify_one();
+	}
+
+	// 只有第一次生效
+	void End(int error_code, const std::string &error_text)
+	{
+		{
+			std::lock_guard<std::mutex> lk(mu);
+			if (ended) return;
+			ended = true;
+			errorCode = error_code;
+			errorText = error_text;
+		}
+		cv.notify_one();
+	}
+};
+
+/*
+服务端流式调用的读取端，由MprpcChannel::CallStream返回，只能在一个线程上使用
+每读完半个窗口的消息向服务端追加一次窗口，调用方读得慢时服务端的Write随之阻塞
+*/
+class MprpcStreamReader
+{
+public:
+	// 没有读到流结束就析构时取消该流
+	~MprpcStreamReader();
+
+	// 读取下一条消息（类型为方法的返回类型），阻塞直到消息到达；
+	// 流正常结束或出错时返回false，是否出错以及原因见CallStream传入的controller
+	bool Read(google::protobuf::Message *msg);
+
+	// 不再读取：通知服务端停止写出，之后Read直接返回false
+	void Cancel();
+
+private:
+	friend class MprpcChannel;
+	// 流结束（读到结束帧、出错或被取消）时回调一次，error_code为流的结果
+	using EndCallback = std::function<void(int error_code)>;
+
+	MprpcStreamReader(google::protobuf::RpcController *controller, std::shared_ptr<MprpcConnection> conn,
+					  uint64_t request_id, uint32_t window, std::shared_ptr<MprpcStreamQueue> queue,
+					  EndCallback on_end);
+	MprpcStreamReader(const MprpcStreamReader &) = delete;
+	MprpcStreamReader &operator=(const MprpcStreamReader &) = delete;
+
+	void End(int error_code);
+
+private:
+	google::protobuf::RpcController *m_controller;
+	std::shared_ptr<MprpcConnection> m_conn; // 请求没有发出去时为空
+	uint64_t m_requestId;
+	uint32_t m_window;
+	uint32_t m_consumed; // 上次追加窗口之后读取的消息数
+	std::shared_ptr<MprpcStreamQueue> m_queue;
+	EndCallback m_onEnd;
+	bool m_ended;
+};
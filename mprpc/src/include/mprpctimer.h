@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/*
+客户端的定时线程：每个实例一个线程，按到期时间从早到晚执行回调
+回调在定时线程上执行，不要做耗时操作，以免推迟后面的定时
+已经不需要的定时不从堆里删除，由回调自己在到期时发现并什么也不做
+*/
+class MprpcTimer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// 异步调用的超时检查共用的实例
+	static MprpcTimer &Instance()
+	{
+		static MprpcTimer timer;
+		return timer;
+	}
+
+	MprpcTimer()
+	{
+		std::thread([this]() { Loop(); }).detach();
+	}
+
+	void Add(Clock::time_point when, std::function<void()> fn)
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		bool earliest = m_heap.empty() || when < m_heap.top().when;
+		m_heap.push(Item{when, std::move(fn)});
+		if (earliest) m_cv.notify_one();
+	}
+
+private:
+	MprpcTimer(const MprpcTimer &) = delete;
+	MprpcTimer &operator=(const MprpcTimer &) = delete;
+
+	struct Item
+	{
+		Clock::time_point when;
+		std::function<void()> fn;
+		bool operator>(const Item &other) const { return when > other.when; }
+	};
+
+	void Loop()
+	{
+		std::unique_lock<std::mutex> lk(m_mu);
+		for (;;)
+		{
+			if (m_heap.empty())
+			{
+				m_cv.wait(lk);
+				continue;
+			}
+			Clock::time_point when = m_heap.top().when;
+			if (Clock::now() < when)
+			{
+				m_cv.wait_until(lk, when);
+				continue;
+			}
+			std::function<void()> fn = std::move(const_cast<Item &>(m_heap.top()).fn);
+			m_heap.pop();
+			lk.unlock();
+			fn();
+			lk.lock();
+		}
+	}
+
+	std::mutex m_mu;
+	std::condition_variable m_cv;
+	std::priority_queue<Item, std::vector<Item>, std::greater<Item>> m_heap;
+};
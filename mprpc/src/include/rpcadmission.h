@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+/*
+RpcProvider的自适应准入控制：限制同时在处理（排队+执行）的请求数，超出的请求立即以RPC_OVERLOADED拒绝
+并发上限按梯度法自适应调整，每个统计窗口结束时：
+  gradient = clamp(tolerance * 无负载延迟 / 窗口平均延迟, 0.5, 1.0)
+  new_limit = limit * gradient + sqrt(limit)      // sqrt(limit)是留给突发的余量，延迟正常时上限缓慢增长
+  limit = 0.8 * limit + 0.2 * new_limit            // 平滑，避免抖动
+延迟取请求从解析完成到handler调用done的时间（排队+执行）；无负载延迟取各窗口平均延迟的最小值，并每个窗口放大1%以跟随业务变化
+业务线程池的排队长度超过当前上限时，说明处理速度已经跟不上，本窗口直接按0.9倍收缩
+
+每个方法有一个优先级，过载时低优先级先被拒绝：
+  low    在途数达到上限的60%后拒绝（例如Login这类可以稍后重试的请求）
+  normal 达到上限的85%后拒绝
+  high   达到上限才拒绝（例如心跳，被拒绝会导致连接被判定失效）
+
+配置项（均为可选）：
+admission_control                 1表示开启，默认0（只统计在途数，不拒绝）
+admission_initial_limit           初始并发上限，默认64
+admission_min_limit / admission_max_limit    上限的取值范围，默认8 / 2048
+admission_tolerance_pct           可以容忍的延迟放大倍数(百分比)，默认150
+admission_window_ms               统计窗口，默认100
+admission_priority.<Service>.<Method> / admission_priority.<Service>   low/normal/high，默认normal
+*/
+class RpcAdmissionController
+{
+public:
+	enum Priority
+	{
+		kLow = 0,
+		kNormal = 1,
+		kHigh = 2,
+	};
+
+	RpcAdmissionController();
+
+	// 读取配置，queue_depth返回业务线程池当前的排队总数（每个窗口调用一次）
+	void Init(std::function<size_t()> queue_depth);
+
+	// 按 admission_priority.<Service>.<Method> > admission_priority.<Service> 读取方法的优先级
+	static Priority LoadPriority(const std::string &service, const std::string &method);
+
+	// 请求到达：返回false表示应当拒绝（此时不需要调用Release）
+	bool TryAcquire(Priority priority);
+	// 请求结束：executed为false表示handler没有执行（解析失败、排队期间过期等），不计入延迟统计
+	// latency_us为排队+执行耗时
+	void Release(bool executed, uint64_t latency_us = 0);
+
+	// 当前在途（已接收还没有回包）的请求数，RpcProvider优雅退出时等它归零
+	int64_t Inflight() const { return m_inflight.load(std::memory_order_relaxed); }
+
+	// 文本格式的当前状态，附在RpcProvider::DumpStats后面
+	std::string Dump() const;
+
+private:
+	// 一个窗口结束，按窗口内的平均延迟重新计算上限（只有一个线程进入）
+	void Update();
+
+private:
+	bool m_enabled;
+	double m_minLimit;
+	double m_maxLimit;
+	double m_tolerance;
+	int64_t m_windowUs;
+	std::function<size_t()> m_queueDepth;
+
+	std::atomic<int64_t> m_inflight;
+	std::atomic<int64_t> m_limit;	// 当前并发上限（取整后的值），热路径只读它
+	std::atomic<uint64_t> m_rejected;
+
+	// 当前窗口的延迟样本
+	std::atomic<uint64_t> m_windowSum;
+	std::atomic<uint64_t> m_windowCount;
+	std::atomic<int64_t> m_windowStartUs;
+
+	mutable std::mutex m_updateMu; // 只保护下面这些窗口之间的状态
+	double m_limitExact;
+	double m_noLoadUs;	// 无负载延迟的估计，0表示还没有样本
+	double m_lastAvgUs;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <memory>
+
+/*
+一次rpc调用使用的protobuf Arena
+request/response都在Arena上分配，调用结束后整体释放，不再逐个new/delete消息对象
+每个线程缓存若干用过的RpcArena：Reset只释放额外申请的内存块，保留初始块，下次调用直接复用
+*/
+class RpcArena
+{
+public:
+	// 从当前线程的缓存中取一个Arena，缓存为空时新建
+	static RpcArena *Acquire();
+	// Reset后归还到当前线程的缓存，缓存已满时直接释放
+	static void Release(RpcArena *arena);
+
+	google::protobuf::Arena *Get() { return &m_arena; }
+
+private:
+	RpcArena();
+
+	static google::protobuf::ArenaOptions MakeOptions(char *block, size_t size);
+
+	std::unique_ptr<char[]> m_initialBlock;
+	google::protobuf::Arena m_arena;
+};
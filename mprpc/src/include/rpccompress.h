@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+请求args/响应body的按帧压缩，客户端和服务端共用
+协商：双方在请求头/响应头的accept_compression里带上自己能解压的算法位图（bit n 对应 RpcCompression 的值 n），
+只有对方声明过能解压时才压缩，任何一方把 rpc_compression 置0就不再声明，也就不会收到压缩帧
+只压缩不小于 rpc_compress_threshold 字节的负载，压缩后没有变小时照常发原始数据
+算法在编译时可选：构建时找到lz4才支持LZ4，否则Accepted()为0，整个机制不生效
+*/
+class RpcCompress
+{
+public:
+	// 本进程能解压并且愿意接收的算法位图，用于填写accept_compression
+	static uint32_t Accepted();
+	// 按对端的accept_compression为size字节的负载选一个算法，不压缩时返回0（RPC_COMPRESS_NONE）
+	static uint32_t Choose(uint32_t peer_accepted, size_t size);
+
+	// 用codec压缩data，结果写入out；失败或者没有变小时返回false，调用方改发原始数据
+	static bool Compress(uint32_t codec, const char *data, size_t size, std::string *out);
+	// 解压出raw_size字节写入out，codec不支持、数据损坏或者长度不符时返回false
+	static bool Decompress(uint32_t codec, const char *data, size_t size, size_t raw_size, std::string *out);
+};
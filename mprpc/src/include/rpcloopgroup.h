@@ -0,0 +1,66 @@
+#pragma once
+
+#include <muduo/net/Callbacks.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/InetAddress.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+RpcProvider的多acceptor模式：每个IO loop一个线程，各自用一个带SO_REUSEPORT的TcpServer监听同一个端口，
+内核按连接的四元组把新连接分给各个监听socket，accept和之后的读写都在同一个线程里完成，没有单个acceptor的瓶颈
+loop线程可以绑定到指定的核上；线程上的内存（连接的Buffer、Arena缓存等）都在绑核之后才首次分配，
+按Linux默认的本地优先策略落在该核所在的NUMA节点上
+*/
+class RpcLoopGroup
+{
+public:
+	// 每个loop绑定的核，-1表示不绑核；返回空表示没有开启多acceptor模式
+	// 配置项（均为可选项）：
+	//   rpc_io_cores         loop绑定的核列表，格式同 /sys/devices/system/cpu/online，如 "0-7,16-23"
+	//   rpc_io_numa_node     没有配置核列表时，绑定到该NUMA节点上的全部核，默认-1
+	//   rpc_reuseport_loops  loop数量，默认等于核数；没有核列表时loop不绑核，超过核数时依次复用这些核
+	static std::vector<int> ConfiguredCores();
+
+	// loop数量等于cores.size()，name用作TcpServer的名字前缀
+	RpcLoopGroup(const muduo::net::InetAddress &addr, const std::string &name, const std::vector<int> &cores);
+	~RpcLoopGroup();
+
+	void setConnectionCallback(const muduo::net::ConnectionCallback &cb) { m_connectionCallback = cb; }
+	void setMessageCallback(const muduo::net::MessageCallback &cb) { m_messageCallback = cb; }
+
+	// 启动所有loop线程，全部开始监听后返回
+	void Start();
+	// 退出所有loop并等待线程结束，各loop上的连接随TcpServer在自己的线程里关闭
+	void Stop();
+	// 轮询取一个loop，供不经过TcpServer接受的连接（unix域socket）使用，只在主loop线程上调用
+	muduo::net::EventLoop *NextLoop();
+
+	// 解析 "0-3,8,10-11" 形式的核列表，格式错误的部分忽略
+	static std::vector<int> ParseCpuList(const std::string &list);
+	// core所在的NUMA节点，读不到时返回-1
+	static int CpuNode(int core);
+
+private:
+	RpcLoopGroup(const RpcLoopGroup &) = delete;
+	RpcLoopGroup &operator=(const RpcLoopGroup &) = delete;
+
+	void ThreadFunc(size_t index);
+
+private:
+	muduo::net::InetAddress m_addr;
+	std::string m_name;
+	std::vector<int> m_cores;
+	muduo::net::ConnectionCallback m_connectionCallback;
+	muduo::net::MessageCallback m_messageCallback;
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_mu;	// 保护m_loops/m_started
+	std::condition_variable m_cv;
+	std::vector<muduo::net::EventLoop *> m_loops; // loop线程退出后置为nullptr
+	size_t m_started = 0;
+	size_t m_next = 0;	// NextLoop的轮询位置，只在主loop线程上访问
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+RpcProvider内部的调用统计
+直方图按HDR的思路分桶：值(微秒)按2的幂分段，每段再线性分成8个子桶，相对误差不超过12.5%
+所有计数都是relaxed原子加，并且按线程分片（每个线程固定落在一个分片上），热路径上没有锁，也很少有缓存行争用
+读取时把各分片合并，得到近似的分位数
+*/
+class RpcLatencyHistogram
+{
+public:
+	static const int kSubBuckets = 8;
+	static const int kBuckets = 30 * kSubBuckets; // 覆盖到2^32微秒
+
+	RpcLatencyHistogram();
+
+	void Record(uint64_t us);
+	// 清空计数，用于按窗口统计；与Record并发时可能丢掉少量样本
+	void Reset();
+
+	// 多个分片合并后的快照
+	struct Snapshot
+	{
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+		std::vector<uint64_t> buckets;
+
+		void Merge(const RpcLatencyHistogram &h);
+		// 分位数(0~1)所在桶的上界，单位微秒
+		uint64_t Percentile(double q) const;
+	};
+
+	static int BucketIndex(uint64_t us);
+	static uint64_t BucketUpperBound(int index);
+
+private:
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sum;
+	std::atomic<uint64_t> m_max;
+	std::atomic<uint64_t> m_buckets[kBuckets];
+};
+
+// 一次调用在服务端各阶段的时间点，没有经过的阶段保持默认值（不计入对应的直方图）
+struct RpcCallTiming
+{
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point start;		 // 收到完整请求帧
+	Clock::time_point decoded;		 // 请求参数反序列化完成
+	Clock::time_point handlerStart; // 业务线程开始执行handler（与decoded之差即排队时间）
+	Clock::time_point handlerEnd;	 // handler调用done
+};
+
+// 单个rpc方法的统计
+class RpcMethodMetrics
+{
+public:
+	enum Phase
+	{
+		kDecode = 0,	// 反序列化请求
+		kQueue,			// 在业务线程池中排队
+		kHandler,		// 执行handler
+		kSerialize,		// 序列化并发送响应
+		kTotal,			// 从收到请求到发出响应
+		kPhaseCount
+	};
+
+	explicit RpcMethodMetrics(const std::string &name);
+
+	const std::string &Name() const { return m_name; }
+
+	// 开始处理一个请求
+	void OnStart();
+	// 请求处理结束（已经发出响应或错误），按timing中已经到达的时间点记录各阶段耗时
+	void OnFinish(bool ok, const RpcCallTiming &timing);
+
+	// 合并各分片后的快照
+	struct Snapshot
+	{
+		uint64_t requests = 0;
+		uint64_t errors = 0;
+		int64_t inflight = 0;
+		RpcLatencyHistogram::Snapshot phases[kPhaseCount];
+	};
+	Snapshot Collect() const;
+
+private:
+	// 按缓存行对齐，避免不同线程的分片伪共享
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> requests{0};
+		std::atomic<uint64_t> errors{0};
+		RpcLatencyHistogram phases[kPhaseCount];
+	};
+	static const int kShards = 8;
+	Shard &LocalShard();
+
+	std::string m_name;
+	std::unique_ptr<Shard[]> m_shards;
+	std::atomic<int64_t> m_inflight;
+};
+
+// 一个RpcProvider的全部统计，方法统计在注册服务时创建，之后不再增删
+class RpcMetrics
+{
+public:
+	RpcMetrics();
+
+	// 为 Service.Method 创建统计项，返回的指针在RpcMetrics的生命周期内有效
+	RpcMethodMetrics *Register(const std::string &full_name);
+	// 找不到service/method、请求头解析失败等无法归属到方法的错误
+	void OnUnroutedError() { m_unrouted.fetch_add(1, std::memory_order_relaxed); }
+
+	// 文本格式的统计：每个服务、每个方法的请求数/错误数/在途数/吞吐，以及各阶段耗时的分位数
+	// 吞吐按距离上一次Dump的间隔计算
+	std::string Dump();
+
+private:
+	std::vector<std::unique_ptr<RpcMethodMetrics>> m_methods;
+	std::atomic<uint64_t> m_unrouted;
+
+	std::mutex m_dumpMu; // 保护上一次Dump的基线
+	RpcCallTiming::Clock::time_point m_lastDump;
+	std::vector<uint64_t> m_lastRequests;
+};
@@ -6,10 +6,29 @@
 #include <muduo/net/EventLoop.h>
 #include <muduo/net/InetAddress.h>
 #include <muduo/net/TcpConnection.h>
+#include <muduo/net/Buffer.h>
+#include <chrono>
 #include <functional>
 #include <google/protobuf/descriptor.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include "rpcthreadpool.h"
+#include "rpcarena.h"
+#include "rpcmetrics.h"
+#include "rpctrace.h"
+#include "rpcadmission.h"
+#include "rpcstream.h"
+#include "rpcstaticservice.h"
+#include "mprpclocal.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace mprpc { class RpcHeader; class RpcResponseHeader; }
+class ZkClient;
+class RpcUnixAcceptor;
 
 class RpcProvider
 {
@@ -24,19 +43,61 @@ public:
 		NotifyService(service.release());
 	}
 
-	// 启动rpc服务节点，开始提供rpc远程网络调用服务
+	// 发布由 protoc-gen-mprpc 生成的静态分发服务（<Service>_Skeleton<Impl>），不拥有所有权
+	void NotifyService(RpcStaticService *service);
+
+	// 服务端流式方法的handler：在业务线程上执行，通过writer逐条写出响应（类型为方法的返回类型）
+	using StreamHandler = std::function<void(const google::protobuf::Message &request, RpcStreamWriter &writer)>;
+	// 把已经NotifyService过的service中的method_name注册为流式方法，需要在Run之前调用
+	// 流式方法只接受流式请求（MprpcChannel::CallStream），Write在窗口用完时会阻塞，所以总是在业务线程上执行
+	void NotifyStreamMethod(google::protobuf::Service *service, const std::string &method_name, StreamHandler handler);
+
+	// 启动rpc服务节点，开始提供rpc远程网络调用服务；Shutdown之后，下线流程走完时返回
 	void Run();
 
+	// 只在本进程内发布服务：创建业务线程池、初始化准入控制并登记到MprpcLocalRegistry，不监听端口也不注册zk
+	// 用于单元测试，或者服务只有同一进程内的调用方的场景；不能与Run同时使用，StopLocal注销服务并等线程池执行完剩余任务
+	void StartLocal();
+	void StopLocal();
+
+	/*
+	优雅下线，可以在任意线程调用；配置 rpc_drain_on_signal=1 时（默认0，不接管信号）收到SIGTERM/SIGINT也会触发
+	  1. 删除本实例在zk上的临时节点，调用方通过watch把本实例从列表中摘掉，不用等会话超时
+	  2. 宽限期 rpc_drain_grace_ms（默认2000）内照常接受连接和请求，给调用方刷新实例列表
+	  3. 宽限期过后拒绝新连接，已有连接上的请求照常处理；等在途调用全部回包后让Run返回，最多等 rpc_drain_timeout_ms（默认30000）
+	*/
+	void Shutdown();
+
+	// Run完成启动（开始监听、注册到zk、本进程内的服务已经登记）后，在主loop线程上执行一次cb，需要在Run之前设置
+	// 例如单进程部署时在这里启动同一进程里的网关
+	void SetReadyCallback(std::function<void()> cb) { m_readyCallback = std::move(cb); }
+
+	// 文本格式的统计：调用统计（见RpcMetrics::Dump）、准入状态和客户端连接池计数，配置了 stats_port 时也可以直接用 curl/nc 访问该端口获取
+	std::string DumpStats();
+
 private:
 	// 组合了EventLoop
 	muduo::net::EventLoop m_eventLoop;
 
+	// 单个rpc方法的信息
+	struct MethodInfo
+	{
+		google::protobuf::Service *m_service = nullptr;
+		RpcStaticService *m_static = nullptr;	// 非空表示静态分发的服务，此时m_service为nullptr
+		const google::protobuf::MethodDescriptor *m_method = nullptr;
+		uint32_t m_methodId = 0;	// 紧凑模式下的方法id，即m_methodTable中的下标
+		RpcThreadPool *m_executor = nullptr;	// 执行该方法的业务线程池，nullptr表示直接在IO线程上执行
+		RpcMethodMetrics *m_metrics = nullptr;	// 该方法的调用统计
+		RpcAdmissionController::Priority m_priority = RpcAdmissionController::kNormal; // 过载时的拒绝优先级
+		StreamHandler m_streamHandler;	// 非空表示这是一个流式方法
+	};
+
 	// service服务类型信息
 	struct ServiceInfo
 	{
 		google::protobuf::Service *m_service;	// 保存服务对象
 		std::unique_ptr<google::protobuf::Service> m_service_owner; // 拥有服务对象的所有权
-		std::unordered_map<std::string, const google::protobuf::MethodDescriptor *> m_methodMap; // 保存服务方法
+		std::unordered_map<std::string, MethodInfo> m_methodMap; // 保存服务方法
 		
 		// 默认构造函数
 		ServiceInfo() : m_service(nullptr) {}
@@ -68,11 +129,137 @@ private:
 	};
 	// 存储注册成功的服务对象和其服务方法的所有信息
 	std::unordered_map<std::string, ServiceInfo> m_serviceMap;
+	std::function<void()> m_readyCallback;
+
+	// 同一进程内的调用方直接调用本节点的服务（见MprpcLocalRegistry），Run（或StartLocal）期间登记，Run返回前（或StopLocal）注销
+	class LocalTarget : public MprpcLocalTarget
+	{
+	public:
+		LocalTarget(RpcProvider *provider, const ServiceInfo *service) : m_provider(provider), m_service(service) {}
+		void CallLocal(const google::protobuf::MethodDescriptor *method, google::protobuf::RpcController *controller,
+					   const google::protobuf::Message *request, google::protobuf::Message *response,
+					   google::protobuf::Closure *done, std::chrono::steady_clock::time_point deadline,
+					   bool run_inline) override
+		{
+			m_provider->CallLocal(m_service, method, controller, request, response, done, deadline, run_inline);
+		}
+
+	private:
+		RpcProvider *m_provider;
+		const ServiceInfo *m_service;
+	};
+	std::vector<std::pair<std::string, std::shared_ptr<LocalTarget>>> m_localTargets;
+	void RegisterLocalTargets();
+	void UnregisterLocalTargets();
+	// 本地调用：和远程调用一样经过准入控制、按方法的线程池执行、继承截止时间、计入调用统计，只是省掉了编解码和网络
+	// 与远程调用的handler一样，传给handler的controller为nullptr，框架错误写入调用方的controller
+	void CallLocal(const ServiceInfo *service, const google::protobuf::MethodDescriptor *method,
+				   google::protobuf::RpcController *controller, const google::protobuf::Message *request,
+				   google::protobuf::Message *response, google::protobuf::Closure *done,
+				   std::chrono::steady_clock::time_point deadline, bool run_inline);
+	// 两种服务共用的注册逻辑，service和static_service只有一个非空
+	void RegisterService(const google::protobuf::ServiceDescriptor *desc, google::protobuf::Service *service,
+						 RpcStaticService *static_service);
+
+	// 方法id -> 方法信息，下标0保留，元素指向m_serviceMap中的MethodInfo（unordered_map节点地址稳定）
+	std::vector<const MethodInfo *> m_methodTable{nullptr};
+
+	// 业务线程池，按配置为每个方法分配（默认池/服务独占池/方法独占池）
+	std::vector<std::unique_ptr<RpcThreadPool>> m_executors;
+	// 根据配置文件创建线程池并绑定到各个方法上
+	void SetupExecutors();
+
+	// 各服务、各方法的请求数/错误数/在途数和分阶段耗时
+	RpcMetrics m_metrics;
+	// 自适应并发上限，过载时按方法优先级拒绝请求
+	RpcAdmissionController m_admission;
+	// 读取各方法的优先级并初始化准入控制
+	void SetupAdmission();
+	// 统计端口上收到任意请求都回一份文本统计后关闭连接
+	void OnStatsMessage(const muduo::net::TcpConnectionPtr &, muduo::net::Buffer *, muduo::Timestamp);
+
+	// 下线流程：由主loop上的定时器驱动，检查是否收到下线请求以及在途调用是否已经结束
+	void OnDrainTick(ZkClient &zk, const std::vector<std::string> &instance_paths, RpcUnixAcceptor *unix_acceptor);
+	// 在主loop上注册下线检查的定时器，只注册一次；m_drainTick在Run中绑定好本次运行的zk会话和实例路径
+	void StartDrainTimer();
+	std::function<void()> m_drainTick;
+	bool m_drainTimerStarted = false;
+	std::atomic<bool> m_shutdownRequested{false};
+	std::atomic<bool> m_draining{false};	// 下线中（已从zk摘除）
+	std::atomic<bool> m_refuseConnections{false};	// 下线宽限期已过，IO线程据此拒绝新连接
+	std::chrono::steady_clock::time_point m_drainStart;
+	bool m_drainQuit = false;	// 在途调用已经结束，下一次检查时退出loop（给最后的响应留出发送时间）
 
 	// 新的socket连接回调
 	void OnConnection(const muduo::net::TcpConnectionPtr &); // 使用完整的类型定义
 	// 已建立连接用户的读写事件回调
 	void OnMessage(const muduo::net::TcpConnectionPtr &, muduo::net::Buffer *, muduo::Timestamp); // 修正类型定义
-	// Closure的回调操作,用于序列化rpc的响应和网络发送
-	void SendRpcResponse(const muduo::net::TcpConnectionPtr &, google::protobuf::Message *);
+	// 批量请求的响应汇总：各子调用的响应帧依次追加到m_body，最后一个子调用结束时作为一个响应帧整体发出
+	// 只在连接所属的IO线程上访问（子调用的响应总是切回IO线程发送）
+	struct RpcBatch
+	{
+		uint64_t m_requestId = 0;
+		uint32_t m_count = 0;
+		uint32_t m_remaining = 0;
+		muduo::net::Buffer m_body;
+	};
+	// 分发一个完整的请求帧，args直接指向接收Buffer，不做拷贝；batch非空时是批量请求中的一个子调用
+	void HandleRequest(const muduo::net::TcpConnectionPtr &, const mprpc::RpcHeader &, const char *args, size_t args_size,
+					   RpcBatch *batch = nullptr);
+	// 批量请求：拆出各个子请求帧分别分发（各自排队到所属的业务线程池，可以并行执行），响应汇总后一次发出
+	void HandleBatch(const muduo::net::TcpConnectionPtr &, const mprpc::RpcHeader &, const char *args, size_t args_size);
+	// 一次rpc调用在服务端的上下文：从解析出请求到发出响应
+	// 上下文本身以及request/response都分配在同一个Arena上，发出响应后随Arena一起释放
+	struct CallContext
+	{
+		muduo::net::TcpConnectionPtr m_conn;
+		uint64_t m_requestId = 0;
+		uint32_t m_methodId = 0;	// 非0时在响应头里告知客户端该方法的id
+		RpcArena *m_arena = nullptr;
+		google::protobuf::Message *m_request = nullptr;
+		google::protobuf::Message *m_response = nullptr;
+		// 由请求头里的剩余预算换算出的截止时间，max()表示调用方没有限制
+		std::chrono::steady_clock::time_point m_deadline = std::chrono::steady_clock::time_point::max();
+		RpcMethodMetrics *m_metrics = nullptr;
+		RpcCallTiming m_timing;
+		RpcTraceContext m_trace;	// 服务端span，handler执行期间是当前线程的追踪上下文
+		uint64_t m_parentSpanId = 0;
+		bool m_stream = false;	// 流式调用，响应由RpcStreamWriter逐条发出，m_response不使用
+		RpcBatch *m_batch = nullptr;	// 批量请求中的子调用，响应追加到批量响应里
+		uint32_t m_acceptCompression = 0;	// 调用方能解压的算法位图，大响应据此压缩
+	};
+	// 执行rpc方法：排队期间已经过了截止时间的请求不再执行，直接回RPC_DEADLINE_EXCEEDED
+	// 执行期间把截止时间设为本线程的继承截止时间，handler里发起的下游调用自动带上剩余预算
+	void Invoke(const MethodInfo *minfo, CallContext *ctx, google::protobuf::Closure *done);
+	// 一次调用结束（响应或错误已经发出）：记录统计和服务端span，error_code为RpcErrorCode
+	void FinishCall(CallContext *ctx, int error_code);
+	// 执行流式方法：handler返回后如果没有Finish，以RPC_OK（已过截止时间则为RPC_DEADLINE_EXCEEDED）结束流
+	void InvokeStream(const MethodInfo *minfo, CallContext *ctx, const std::shared_ptr<RpcStreamWriter> &writer);
+	// 流结束（IO线程）：发出流的最后一帧，注销流并结束调用
+	void FinishStream(CallContext *ctx, int error_code, const std::string &error_text);
+	// 客户端发来的流控帧：追加发送窗口或取消
+	void OnStreamControl(const muduo::net::TcpConnectionPtr &, const mprpc::RpcHeader &);
+	// 进行中的流，按(连接, request_id)索引，用于接收流控帧；连接断开时取消该连接上的所有流
+	using StreamKey = std::pair<const muduo::net::TcpConnection *, uint64_t>;
+	std::mutex m_streamMu;
+	std::map<StreamKey, std::shared_ptr<RpcStreamWriter>> m_streams;
+
+	// Closure的回调操作,用于序列化rpc的响应和网络发送，响应帧带回请求的request_id，允许乱序返回
+	void SendRpcResponse(CallContext *ctx);
+	// 框架层错误（service/method不存在、参数解析失败等）直接回一个带错误码的空响应，避免调用方一直等待
+	void SendRpcError(const muduo::net::TcpConnectionPtr &, uint64_t request_id, int error_code, const std::string &error_text,
+					  RpcBatch *batch = nullptr);
+	// 按 header_size + RpcResponseHeader + body 的格式编码进一个Buffer并一次发送，body为nullptr表示空body
+	// header由调用方填好request_id/错误码等，body_size在这里补上
+	// batch非空时追加到批量响应里，批内最后一个子调用的响应到齐后整体发出
+	// peer_accepted为调用方声明的accept_compression：非0时响应头带上本端的accept_compression，body够大时压缩
+	bool SendResponseFrame(const muduo::net::TcpConnectionPtr &, mprpc::RpcResponseHeader &header,
+						   const google::protobuf::Message *body, RpcBatch *batch = nullptr,
+						   uint32_t peer_accepted = 0);
+	// 批内一个子调用的响应已经追加（或者分发阶段结束）：全部到齐时发出批量响应并释放batch
+	void ReleaseBatchSlot(const muduo::net::TcpConnectionPtr &, RpcBatch *batch);
+	// 发出一个编码好的帧；开启写合并时，IO线程上同一轮loop里发往同一连接的帧先攒在一起，
+	// 本轮的回调都处理完后每个连接只send一次（由配置项 rpc_write_coalesce 开启，默认关闭）
+	void WriteFrame(const muduo::net::TcpConnectionPtr &, muduo::net::Buffer *frame);
+	bool m_coalesceReplies = false;
 };
\ No newline at end of file
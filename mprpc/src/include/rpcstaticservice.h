@@ -0,0 +1,30 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+
+/*
+由 protoc-gen-mprpc 生成的服务端骨架（<Service>_Skeleton<Impl>）的公共基类，通过 RpcProvider::NotifyService 注册
+和 google::protobuf::Service 相比，热路径上不再经过反射：
+  请求/响应对象按方法下标 switch 直接在Arena上创建具体类型，不查 GetRequestPrototype
+  调用按方法下标 switch 后 static_cast 到业务实现类的非虚函数，不经过 CallMethod 和方法描述符
+描述符只在注册时用来取服务名和方法名，方法下标与描述符中的下标一致
+*/
+class RpcStaticService
+{
+public:
+	virtual ~RpcStaticService() {}
+
+	virtual const google::protobuf::ServiceDescriptor *GetDescriptor() = 0;
+
+	// 在arena上创建方法method_index的请求/响应对象
+	virtual google::protobuf::Message *NewRequest(int method_index, google::protobuf::Arena *arena) const = 0;
+	virtual google::protobuf::Message *NewResponse(int method_index, google::protobuf::Arena *arena) const = 0;
+
+	// 执行方法method_index，request/response必须是NewRequest/NewResponse创建的对象
+	virtual void Dispatch(int method_index, google::protobuf::RpcController *controller,
+						  const google::protobuf::Message *request, google::protobuf::Message *response,
+						  google::protobuf::Closure *done) = 0;
+};
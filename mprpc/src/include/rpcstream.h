@@ -0,0 +1,57 @@
+#pragma once
+
+#include <google/protobuf/message.h>
+#include <muduo/net/TcpConnection.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+/*
+服务端流式方法的输出端：handler在业务线程上逐条Write响应消息，写完后返回（或显式Finish）
+流控按消息条数计：客户端在请求里给出初始窗口，每消费一批再追加，窗口用完时Write阻塞，
+因此不论结果集多大，服务端的发送缓冲和客户端的接收队列都只有一个窗口的消息
+一个流只能由一个线程写
+*/
+class RpcStreamWriter
+{
+public:
+	// 写出一条消息（类型为方法的返回类型）。窗口用完时阻塞等待客户端追加；
+	// 调用方取消、连接断开或超过截止时间时返回false，handler应当停止生成后续消息
+	bool Write(const google::protobuf::Message &msg);
+
+	// 结束流，error_code为RpcErrorCode；handler返回时没有调用过Finish则以RPC_OK结束
+	void Finish(int error_code = 0, const std::string &error_text = "");
+
+	// 调用方是否已经取消（或者连接已经断开）
+	bool Cancelled() const;
+
+private:
+	friend class RpcProvider;
+	using Clock = std::chrono::steady_clock;
+	using FinishCallback = std::function<void(int error_code, const std::string &error_text)>;
+
+	RpcStreamWriter(const muduo::net::TcpConnectionPtr &conn, uint64_t request_id, uint32_t method_id,
+					uint32_t window, Clock::time_point deadline, FinishCallback on_finish);
+	RpcStreamWriter(const RpcStreamWriter &) = delete;
+	RpcStreamWriter &operator=(const RpcStreamWriter &) = delete;
+
+	// 收到客户端的流控帧（IO线程调用）
+	void AddCredit(uint32_t credit);
+	void Cancel();
+
+private:
+	muduo::net::TcpConnectionPtr m_conn;
+	uint64_t m_requestId;
+	uint32_t m_methodId;
+	Clock::time_point m_deadline;
+	FinishCallback m_onFinish;
+
+	mutable std::mutex m_mu;
+	std::condition_variable m_cv;
+	uint64_t m_credit;	// 还可以写出的消息条数
+	bool m_cancelled;
+	bool m_finished;
+};
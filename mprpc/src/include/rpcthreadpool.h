@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+RpcProvider的业务线程池：rpc方法在这里执行，不占用muduo的IO线程
+任务队列有界，队列满时Submit直接失败，由调用方立即给客户端回错误，而不是无限堆积请求
+*/
+class RpcThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	RpcThreadPool(const std::string &name, int thread_num, size_t queue_capacity);
+	~RpcThreadPool();
+
+	RpcThreadPool(const RpcThreadPool &) = delete;
+	RpcThreadPool &operator=(const RpcThreadPool &) = delete;
+
+	// 启动工作线程
+	void Start();
+	// 停止接收新任务，执行完队列中剩余的任务后退出所有工作线程
+	void Stop();
+
+	// 提交任务，队列已满或线程池已停止时返回false
+	bool Submit(Task task);
+
+	const std::string &Name() const { return m_name; }
+	size_t QueueSize() const;
+
+	// 当前线程所属的线程池，不是线程池的工作线程时返回nullptr（协程据此回到原来的线程池恢复）
+	static RpcThreadPool *Current();
+
+private:
+	void WorkerLoop();
+
+private:
+	std::string m_name;
+	int m_threadNum;
+	size_t m_capacity;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Task> m_queue;
+	bool m_stopped;
+	std::vector<std::thread> m_threads;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// 一个span的追踪上下文：trace_id标识一次端到端请求，span_id标识其中的一跳
+struct RpcTraceContext
+{
+	uint64_t traceId = 0;
+	uint64_t spanId = 0;
+	bool sampled = false;
+
+	bool Valid() const { return traceId != 0; }
+};
+
+/*
+分布式追踪：trace_id/span_id/采样标志随RpcHeader在进程之间传递
+MprpcChannel发起调用时以当前线程的上下文为父span开一个客户端span，RpcProvider执行handler期间把服务端span设为当前上下文，
+因此handler里发起的下游调用自动串到同一条trace上；异步回调运行在别的线程上，需要用RpcTraceScope把上下文带过去
+
+被采样的span写入一个无锁环形缓冲区（写入方只做一次原子加和一次拷贝），后台线程定期追加到本地文件，每行一个JSON
+进程退出时（单例析构）停止后台线程并把剩余的span写完；RpcProvider::Run返回前也会刷一次
+缓冲区被写满时最旧的span被覆盖并计入丢弃数；多个进程的文件用 benchmarks/trace_join 按trace_id拼成时间线
+
+配置项（均为可选）：
+trace_sample_rate          新开的trace的采样率(0~1)，默认0；上游传来的trace沿用上游的采样决定
+trace_file                 span输出文件，默认 mprpc_trace.<pid>.log
+trace_buffer_size          环形缓冲区的span数，向上取2的幂，默认16384
+trace_flush_interval_ms    刷盘周期，默认200
+*/
+class RpcTracer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum SpanKind
+	{
+		kClient = 'C',	 // 调用方视角的一次rpc
+		kServer = 'S',	 // 服务端处理一次rpc
+		kInternal = 'I', // 进程内的其他环节（例如网关收到消息后推送给客户端）
+	};
+
+	static RpcTracer &GetInstance();
+
+	// 当前线程的追踪上下文，没有时Valid()为false
+	static const RpcTraceContext &Current();
+	static void SetCurrent(const RpcTraceContext &ctx);
+
+	// 开一个新span：parent有效时沿用它的trace_id和采样标志，否则新开一条trace并按trace_sample_rate决定是否采样
+	RpcTraceContext StartSpan(const RpcTraceContext &parent);
+
+	// 记录一个已经结束的span，未采样的直接忽略；status为RpcErrorCode或业务自定义的错误码，0表示成功
+	void Record(const RpcTraceContext &span, uint64_t parent_span_id, SpanKind kind, const std::string &name,
+				Clock::time_point start, Clock::time_point end, int status = 0);
+
+	// 被覆盖而没有写入文件的span数
+	uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	// 把已经记录的span立即写入文件，不等下一个刷盘周期；还没有采样过span（刷盘线程没有启动）时什么也不做
+	void FlushNow();
+
+private:
+	RpcTracer();
+	~RpcTracer();
+	RpcTracer(const RpcTracer &) = delete;
+	RpcTracer &operator=(const RpcTracer &) = delete;
+
+	// 环形缓冲区中的一个span，定长，可以直接拷贝
+	struct SpanRecord
+	{
+		uint64_t traceId;
+		uint64_t spanId;
+		uint64_t parentSpanId;
+		int64_t startUs; // 墙上时间，便于跨进程对齐
+		int64_t durationUs;
+		int32_t status;
+		char kind;
+		char name[83];
+	};
+	// seq为 2*pos+1 表示正在写第pos个span，2*pos+2 表示写完
+	struct Slot
+	{
+		std::atomic<uint64_t> seq{0};
+		SpanRecord record;
+	};
+
+	// 后台线程：把已经写完的span追加到文件，停止时再刷一次
+	void FlushLoop();
+	void Flush(FILE *fp);
+
+private:
+	double m_sampleRate;
+	std::string m_file;
+	std::string m_process;
+	int m_flushIntervalMs;
+
+	size_t m_mask;
+	std::unique_ptr<Slot[]> m_ring;
+	std::atomic<uint64_t> m_head; // 下一个写入位置
+	uint64_t m_tail;			  // 下一个待刷盘的位置，由m_flushMu保护
+	std::atomic<uint64_t> m_dropped;
+
+	std::mutex m_flushMu; // 刷盘线程和FlushNow互斥
+	FILE *m_fp;			  // 刷盘线程打开的文件，打开失败时为nullptr
+
+	std::once_flag m_flusherOnce; // 第一次记录采样span时才启动刷盘线程
+	std::thread m_flusher;
+	std::mutex m_stopMu;
+	std::condition_variable m_stopCv;
+	bool m_stop;
+};
+
+// 在作用域内替换当前线程的追踪上下文，退出时恢复
+class RpcTraceScope
+{
+public:
+	explicit RpcTraceScope(const RpcTraceContext &ctx)
+		: m_saved(RpcTracer::Current())
+	{
+		RpcTracer::SetCurrent(ctx);
+	}
+	~RpcTraceScope() { RpcTracer::SetCurrent(m_saved); }
+
+	RpcTraceScope(const RpcTraceScope &) = delete;
+	RpcTraceScope &operator=(const RpcTraceScope &) = delete;
+
+private:
+	RpcTraceContext m_saved;
+};
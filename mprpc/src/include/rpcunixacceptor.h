@@ -0,0 +1,55 @@
+#pragma once
+
+#include <muduo/net/Callbacks.h>
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/*
+RpcProvider在unix域socket上的监听：muduo的TcpServer只能监听IP地址，这里自己accept，
+接受的连接包装成muduo::net::TcpConnection并分给TCP连接所用的IO线程，之后的读写、回调与TCP连接完全一样
+同机的调用方走这条路径可以省掉loopback TCP的协议栈开销（校验和、拥塞控制、ACK等）
+*/
+class RpcUnixAcceptor
+{
+public:
+	// loop为主loop，next_loop在主loop上调用，每次返回新连接要交给的IO loop（TcpServer的IO线程池或多acceptor的loop组）
+	RpcUnixAcceptor(muduo::net::EventLoop *loop, const std::string &path,
+					std::function<muduo::net::EventLoop *()> next_loop);
+	// 与TcpServer的析构相同，还连着的连接交给各自的IO线程销毁；IO线程必须还在运行，并且在主loop线程上调用
+	~RpcUnixAcceptor();
+
+	void setConnectionCallback(const muduo::net::ConnectionCallback &cb) { m_connectionCallback = cb; }
+	void setMessageCallback(const muduo::net::MessageCallback &cb) { m_messageCallback = cb; }
+
+	// 删除上一个进程残留的socket文件后bind+listen，失败返回false（调用方退回只用TCP）
+	bool Listen();
+	// 停止监听并删除socket文件，已经建立的连接不受影响（下线时调用，在主loop线程上执行）
+	void StopListening();
+
+	const std::string &Path() const { return m_path; }
+
+private:
+	RpcUnixAcceptor(const RpcUnixAcceptor &) = delete;
+	RpcUnixAcceptor &operator=(const RpcUnixAcceptor &) = delete;
+
+	// 监听fd可读：一次取完所有等待中的连接
+	void HandleAccept();
+	// 连接关闭（在连接所属的IO线程上回调），转回主loop从连接表中删除
+	void RemoveConnection(const muduo::net::TcpConnectionPtr &conn);
+
+private:
+	muduo::net::EventLoop *m_loop;
+	std::string m_path;
+	std::function<muduo::net::EventLoop *()> m_nextLoop;
+	int m_listenFd;
+	std::unique_ptr<muduo::net::Channel> m_channel;
+	muduo::net::ConnectionCallback m_connectionCallback;
+	muduo::net::MessageCallback m_messageCallback;
+	// 只在主loop上访问
+	std::unordered_map<std::string, muduo::net::TcpConnectionPtr> m_connections;
+	uint64_t m_nextConnId;
+};
@@ -3,20 +3,57 @@
 #include <semaphore.h>
 #include <zookeeper/zookeeper.h>
 #include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
 
 // 封装的zk客户端类
 class ZkClient
 {
 public:
+	// watch回调：type为ZOO_CHANGED_EVENT/ZOO_DELETED_EVENT/ZOO_CREATED_EVENT/ZOO_CHILD_EVENT，
+	// 会话过期时以ZOO_SESSION_EVENT回调一次。zk的watch是一次性的，触发后需要重新Watch才能继续收到通知
+	// 回调运行在zk的事件线程上，不能在里面调用同步的zk接口（会死锁），一般只做缓存失效
+	using WatchCallback = std::function<void(int type, const std::string &path)>;
+
 	ZkClient();
 	~ZkClient();
 	// zkclient启动连接zkserver
 	void Start();
+	// 会话过期后重新建立会话：关闭旧句柄并重新连接，阻塞到连上为止
+	// 旧会话上的watch和临时节点都已经失效（还没触发的watch不会再回调），需要调用方重新注册；不能在watch回调里调用
+	void Reconnect();
 	// 在zkserver上根据指定的path创建znode节点
 	void Create(const char* path, const char* data, int datalen, int state = 0);
+	// 删除指定path的znode节点（不存在时视为成功）
+	void Delete(const char* path);
 	// 根据参数指定的znode节点路径，或者znode节点的值
 	std::string GetData(const char* path);
+	// 读取节点数据并注册watch；节点不存在时返回ZNONODE，同时注册存在性watch，节点被创建时也会回调
+	int WatchData(const char* path, std::string &data, WatchCallback cb);
+	// 读取子节点列表并注册子节点watch；节点不存在时返回ZNONODE（同样会在创建时回调）
+	// 每次调用最多回调一次cb，之后需要重新WatchChildren
+	int WatchChildren(const char* path, std::vector<std::string> &children, WatchCallback cb);
 private:
 	// zk的客户端句柄
 	zhandle_t* m_zhandle;
+
+	// 一次Watch调用交给zk的上下文：可能同时挂在两个zk watch上（子节点watch和存在性watch），
+	// cb只执行一次，两个watch都触发后释放；关闭句柄时还没触发的由ReleaseWatches统一释放
+	struct WatchContext
+	{
+		ZkClient *client;
+		WatchCallback cb;
+		int refs;	// 挂着这个上下文的zk watch数，由m_watchMu保护
+		bool fired;
+	};
+	static void OnWatch(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx);
+	WatchContext *NewWatch(WatchCallback cb);
+	void AddWatchRef(WatchContext *ctx);
+	// 注册失败时撤销一个引用，zk不会再用它回调
+	void DropWatch(WatchContext *ctx);
+	void ReleaseWatches();
+	std::mutex m_watchMu;
+	std::unordered_set<WatchContext *> m_watches;
 };
\ No newline at end of file
@@ -1,283 +1,901 @@
 #include "mprpcchannel.h"
+#include "mprpcconnection.h"
+#include "mprpcconnectionpool.h"
+#include "mprpcclosure.h"
 #include "rpcheader.pb.h"
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <arpa/inet.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
 #include "mprpcapplication.h"
 #include "mprpccontroller.h"
-#include "zookeeperutil.h"
-// 可选：TCP_NODELAY（仅在支持的平台使用）
-#ifdef TCP_NODELAY
-#include <netinet/tcp.h>
-#endif
+#include "mprpcresolver.h"
+#include "mprpcloadbalancer.h"
+#include "mprpccircuitbreaker.h"
+#include "mprpchedge.h"
+#include "mprpclocal.h"
+#include "mprpctimer.h"
+#include "mprpcstream.h"
+#include "rpccompress.h"
+#include "rpctrace.h"
+#include "logger/logger.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
 #include <unordered_map>
-#include <chrono>
 #include <vector>
+#include <chrono>
 
-// 统一的连接池（文件作用域共享给 getConnection/returnConnection）
 namespace {
-static std::mutex s_pool_mu;
-static std::unordered_map<std::string, std::vector<int>> s_conn_pool;
-static const size_t kMaxPoolPerKey = 64;
+// 进程内全局递增的请求id，保证同一连接上的id不重复
+static std::atomic<uint64_t> s_next_request_id{1};
+
+// 是否在学到方法id后改用紧凑header，配置项 rpc_compact_method_id（默认开启，置0时始终按名字调用）
+bool compactMethodId()
+{
+    static const bool on = MprpcApplication::GetConfig().LoadInt("rpc_compact_method_id", 1) != 0;
+    return on;
+}
+
+// 调用方和上游都没有给截止时间时使用的默认超时，配置项 rpc_timeout_ms（默认0，不限制）
+int defaultTimeoutMs()
+{
+    static const int ms = MprpcApplication::GetConfig().LoadInt("rpc_timeout_ms", 0);
+    return ms;
+}
+
+// 流式调用的接收窗口（消息条数），配置项 rpc_stream_window（默认64）
+uint32_t streamWindow()
+{
+    static const uint32_t window = (uint32_t)std::max(1, MprpcApplication::GetConfig().LoadInt("rpc_stream_window", 64));
+    return window;
+}
+
+// 调用的截止时间：controller上设置的 > 从上游请求继承的 > 配置的默认超时，max()表示不限制
+MprpcController::Clock::time_point callDeadline(MprpcController *controller)
+{
+    using Clock = MprpcController::Clock;
+    Clock::time_point deadline = controller && controller->HasDeadline() ? controller->Deadline()
+                                                                         : MprpcController::InheritedDeadline();
+    if (deadline == Clock::time_point::max() && defaultTimeoutMs() > 0)
+    {
+        deadline = Clock::now() + std::chrono::milliseconds(defaultTimeoutMs());
+    }
+    return deadline;
+}
+
+// 随请求发出的剩余预算，向上取整到毫秒：0表示不限制，-1表示已经过期
+int remainingMs(MprpcController::Clock::time_point deadline)
+{
+    if (deadline == MprpcController::Clock::time_point::max()) return 0;
+    auto remain = std::chrono::duration_cast<std::chrono::microseconds>(deadline - MprpcController::Clock::now()).count();
+    return remain > 0 ? (int)((remain + 999) / 1000) : -1;
+}
+
+// 按服务取配置的负载均衡策略：lb_policy.<Service> 优先，其次 lb_policy，默认 round_robin
+// 每个服务一个策略实例，轮询计数等状态不在服务之间互相干扰
+MprpcLoadBalancer *balancerFor(const std::string &service)
+{
+    static std::mutex s_lb_mu;
+    static std::unordered_map<std::string, std::shared_ptr<MprpcLoadBalancer>> s_balancers;
+    std::lock_guard<std::mutex> lk(s_lb_mu);
+    auto &lb = s_balancers[service];
+    if (!lb)
+    {
+        MprpcConfig &config = MprpcApplication::GetConfig();
+        std::string policy = config.Load("lb_policy." + service);
+        if (policy.empty()) policy = config.Load("lb_policy");
+        if (policy.empty()) policy = "round_robin";
+        lb = MprpcLoadBalancer::Create(policy);
+        if (!lb)
+        {
+            LOG_WARN << "unknown lb_policy " << policy << " for " << service << ", use round_robin";
+            lb = MprpcLoadBalancer::Create("round_robin");
+        }
+    }
+    return lb.get();
+}
+
+// 负载均衡选出的实例处于熔断状态时，顺着列表找下一个放行的实例，熔断器的放行凭证写入ticket
+// 全部熔断时仍然用选出的实例：与其直接失败，不如让请求去试一下（不是探测请求，结果不改变half_open状态）
+const MprpcEndpoint &skipEjected(const MprpcEndpointList &list, const MprpcEndpoint &picked,
+                                 MprpcCircuitBreaker::Ticket *ticket)
+{
+    if (picked.breaker->Allow(ticket)) return picked;
+    const size_t n = list.endpoints.size();
+    const MprpcEndpoint *first = list.endpoints.data();
+    const size_t start = (&picked >= first && &picked < first + n) ? (size_t)(&picked - first) : 0;
+    for (size_t i = 1; i < n; ++i)
+    {
+        const MprpcEndpoint &ep = list.endpoints[(start + i) % n];
+        if (ep.breaker->Allow(ticket)) return ep;
+    }
+    *ticket = MprpcCircuitBreaker::kNoTicket;
+    return picked;
+}
+
+// 延迟离群检测：该实例的平均延迟明显高于其他实例的中位数时摘除
+// 至少3个实例才有可比性；已摘除的实例达到一半时不再摘除
+void checkOutlier(const MprpcEndpointList &list, const MprpcEndpoint &endpoint)
+{
+    const size_t n = list.endpoints.size();
+    const double factor = MprpcCircuitBreaker::OutlierFactor();
+    const uint64_t latency = endpoint.breaker->LatencyUs();
+    if (n < 3 || factor <= 0 || latency < MprpcCircuitBreaker::OutlierMinUs()) return;
+
+    std::vector<uint64_t> peers;
+    peers.reserve(n);
+    size_t ejected = 0;
+    for (const MprpcEndpoint &ep : list.endpoints)
+    {
+        if (ep.breaker->Ejected()) ++ejected;
+        else if (&ep != &endpoint && ep.breaker->LatencyUs() > 0) peers.push_back(ep.breaker->LatencyUs());
+    }
+    if (peers.empty() || (ejected + 1) * 2 > n) return;
+    std::nth_element(peers.begin(), peers.begin() + peers.size() / 2, peers.end());
+    const uint64_t median = peers[peers.size() / 2];
+    if ((double)latency > factor * (double)median)
+    {
+        LOG_WARN << "eject outlier " << endpoint.id << ", avg latency " << latency << "us, peers median " << median << "us";
+        endpoint.breaker->Eject();
+    }
+}
+
+// 调用结束时把结果报告给实例的熔断器，只有说明实例本身有问题的错误码才计为失败
+// 开启了对冲的方法同时把成功请求的延迟交给对冲策略
+void reportHealth(const MprpcEndpointList &list, const MprpcEndpoint &endpoint, MprpcCircuitBreaker::Ticket ticket,
+                  google::protobuf::RpcController *controller, MprpcController::Clock::time_point start,
+                  MprpcHedgePolicy *hedge)
+{
+    MprpcController *mc = dynamic_cast<MprpcController *>(controller);
+    const bool call_failed = controller != nullptr && controller->Failed();
+    const bool failed = call_failed && mc && MprpcCircuitBreaker::IsFailure(mc->ErrorCode());
+    const uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                    MprpcController::Clock::now() - start).count();
+    endpoint.breaker->Report(ticket, failed, latency_us);
+    if (hedge && !call_failed) hedge->Record(latency_us);
+    if (!failed && endpoint.breaker->ShouldCheckOutlier())
+    {
+        checkOutlier(list, endpoint);
+    }
+}
+
+// 本进程内的调用：异步时由服务所在的线程池执行handler；同步时在当前线程执行，handler异步回包时等它执行done
+// handler可能还持有response，所以同步调用不能在截止时间到达时提前返回，截止时间作为继承的截止时间交给handler
+void callLocal(MprpcLocalTarget &target, const google::protobuf::MethodDescriptor *method,
+               google::protobuf::RpcController *controller, const google::protobuf::Message *request,
+               google::protobuf::Message *response, google::protobuf::Closure *done,
+               MprpcController::Clock::time_point deadline)
+{
+    if (done)
+    {
+        target.CallLocal(method, controller, request, response, done, deadline, false);
+        return;
+    }
+    struct Completion
+    {
+        std::mutex mu;
+        std::condition_variable cv;
+        bool finished = false;
+    };
+    auto completion = std::make_shared<Completion>();
+    target.CallLocal(method, controller, request, response, NewMprpcClosure([completion]() {
+        std::lock_guard<std::mutex> lk(completion->mu);
+        completion->finished = true;
+        completion->cv.notify_one();
+    }), deadline, true);
+    std::unique_lock<std::mutex> lk(completion->mu);
+    completion->cv.wait(lk, [&completion]() { return completion->finished; });
+}
+
+// 对冲请求的目标：主请求之后第一个熔断器放行的其他实例，没有时不对冲
+const MprpcEndpoint *pickHedgeTarget(const MprpcEndpointList &list, const MprpcEndpoint &primary,
+                                     MprpcCircuitBreaker::Ticket *ticket)
+{
+    const size_t n = list.endpoints.size();
+    const MprpcEndpoint *first = list.endpoints.data();
+    const size_t start = (&primary >= first && &primary < first + n) ? (size_t)(&primary - first) : 0;
+    for (size_t i = 1; i < n; ++i)
+    {
+        const MprpcEndpoint &ep = list.endpoints[(start + i) % n];
+        if (&ep != &primary && ep.breaker->Allow(ticket)) return &ep;
+    }
+    return nullptr;
+}
+
+// 异步对冲请求由独立的定时线程发出：发请求可能要建连，不能拖住异步调用共用的超时检查
+MprpcTimer &hedgeTimer()
+{
+    static MprpcTimer timer;
+    return timer;
+}
 }
 
+// 主请求和对冲请求各自使用独立的response/controller，先成功的结果交给调用方，后到的丢弃
+struct MprpcChannel::HedgedCall
+{
+    struct Attempt
+    {
+        std::unique_ptr<google::protobuf::Message> response;
+        MprpcController controller;
+    };
+
+    std::mutex mu;
+    std::condition_variable cv; // 同步调用等待结束
+    bool finished = false;
+    int launched = 0;  // 已经发出的请求数
+    int completed = 0; // 已经结束的请求数
+    Attempt attempts[2];
+    std::unique_ptr<google::protobuf::Message> hedgeRequest; // 对冲请求用的request副本
+
+    // 调用方的参数，只在finished置位之前访问
+    const google::protobuf::Message *request = nullptr;
+    google::protobuf::Message *response = nullptr;
+    google::protobuf::RpcController *controller = nullptr;
+    google::protobuf::Closure *done = nullptr; // 为nullptr时是同步调用
+};
+
 /*
-header_size + service_name method_name args_size + args
+header_size + service_name method_name args_size request_id + args
 */
 // 所有通过stub代理对象调用的rpc方法，都走到了这里了，统一做rpc方法调用的数据序列化和网络发送
+// done为nullptr时同步阻塞；否则立即返回，调用结束（成功或失败）后执行done
 void MprpcChannel::CallMethod(const google::protobuf::MethodDescriptor *method,
                               google::protobuf::RpcController *controller,
                               const google::protobuf::Message *request,
                               google::protobuf::Message *response,
                               google::protobuf::Closure *done)
 {
+    // 调用方没有传controller（例如 stub.Login(nullptr, ...)）：换成内部的controller，后面的路径都可以直接使用它
+    if (controller == nullptr)
+    {
+        if (!done)
+        {
+            MprpcController local;
+            CallMethod(method, &local, request, response, nullptr);
+            return;
+        }
+        MprpcController *owned = new MprpcController();
+        CallMethod(method, owned, request, response, NewMprpcClosure([owned, done]() {
+            delete owned;
+            done->Run();
+        }));
+        return;
+    }
+
     const google::protobuf::ServiceDescriptor *sd = method->service();
     const std::string service_name = sd->name();
     const std::string method_name = method->name();
 
-    // 1) 构造请求帧（长度前缀 + header + args）
-    std::string frame;
-    if (!buildRequestFrame(method, request, frame, controller))
+    // 0) 确定截止时间，已经用完预算的调用不再发出
+    using Clock = MprpcController::Clock;
+    MprpcController *mprpc_controller = dynamic_cast<MprpcController *>(controller);
+    const Clock::time_point deadline = callDeadline(mprpc_controller);
+    const int timeout_ms = remainingMs(deadline);
+    if (timeout_ms < 0)
+    {
+        MprpcController::Fail(controller, mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded");
+        if (done) done->Run();
         return;
+    }
 
-    // 2) 解析服务地址（带本地 TTL 缓存）
-    sockaddr_in server_addr{};
-    if (!resolveEndpoint(service_name, method_name, server_addr, controller))
+    // 目标服务就在本进程内（单进程部署）：直接调用服务对象，不序列化、不走网络
+    if (std::shared_ptr<MprpcLocalTarget> local = MprpcLocalRegistry::GetInstance().Find(service_name))
+    {
+        callLocal(*local, method, controller, request, response, done, deadline);
+        return;
+    }
+
+    // 追踪：以当前线程的上下文（handler所处理的请求，或者业务自己设置的）为父span开一个客户端span
+    // 调用结束（无论成败）时记录，未采样时Record直接返回
+    const RpcTraceContext parent = RpcTracer::Current();
+    const RpcTraceContext span = RpcTracer::GetInstance().StartSpan(parent);
+    const RpcTracer::Clock::time_point span_start = RpcTracer::Clock::now();
+    auto record_span = [parent, span, span_start, method, controller]() {
+        if (!span.sampled) return;
+        MprpcController *mc = dynamic_cast<MprpcController *>(controller);
+        int status = (controller == nullptr || !controller->Failed()) ? 0 : (mc ? mc->ErrorCode() : mprpc::RPC_INTERNAL);
+        RpcTracer::GetInstance().Record(span, parent.spanId, RpcTracer::kClient,
+                                        method->service()->name() + "." + method->name(), span_start,
+                                        RpcTracer::Clock::now(), status);
+    };
+
+    // 1) 解析实例列表（watch驱动的本地缓存），按负载均衡策略选出一个实例，跳过熔断中的实例
+    MprpcEndpointListPtr endpoints = resolveEndpoints(service_name, method_name, controller);
+    if (!endpoints)
+    {
+        record_span();
+        if (done) done->Run();
         return;
+    }
+    static const std::string kNoHashKey;
+    const std::string &hash_key = mprpc_controller ? mprpc_controller->HashKey() : kNoHashKey;
+    MprpcLoadBalancer *balancer = m_balancer ? m_balancer.get() : balancerFor(service_name);
+    MprpcCircuitBreaker::Ticket ticket = MprpcCircuitBreaker::kNoTicket;
+    const MprpcEndpoint &endpoint = skipEjected(*endpoints, balancer->Select(*endpoints, hash_key), &ticket);
+
+    // 开启了对冲的读方法：有其他实例可选，并且已经统计出对冲延迟时走对冲调用
+    MprpcHedgePolicy *hedge = endpoints->endpoints.size() > 1 ? MprpcHedgePolicy::For(method) : nullptr;
+    const uint64_t hedge_delay_us = hedge ? hedge->OnCall() : 0;
 
-    // 3) 连接池获取连接
-    const std::string key = "/" + service_name + "/" + method_name;
-    int clientfd = getConnection(key, server_addr);
-    if (clientfd == -1)
+    // 2) 发出请求（异步时调用结束后先记录span再执行done）
+    if (done)
+    {
+        done = NewMprpcClosure([record_span, done]() {
+            record_span();
+            done->Run();
+        });
+    }
+    if (hedge_delay_us > 0)
+    {
+        hedgedCall(endpoints, endpoint, ticket, method, request, response, controller, done, deadline, span, hedge,
+                   hedge_delay_us);
+    }
+    else
+    {
+        sendTo(endpoints, endpoint, ticket, method, request, response, controller, done, deadline, timeout_ms, span, hedge);
+    }
+    if (!done) record_span();
+}
+
+// 向选定的实例发出一次请求：取连接、构造请求帧、发送并等待同一request_id的响应
+void MprpcChannel::sendTo(const MprpcEndpointListPtr &endpoints,
+                          const MprpcEndpoint &endpoint,
+                          uint64_t ticket,
+                          const google::protobuf::MethodDescriptor *method,
+                          const google::protobuf::Message *request,
+                          google::protobuf::Message *response,
+                          google::protobuf::RpcController *controller,
+                          google::protobuf::Closure *done,
+                          MprpcController::Clock::time_point deadline,
+                          int timeout_ms,
+                          const RpcTraceContext &trace,
+                          MprpcHedgePolicy *hedge)
+{
+    using Clock = MprpcController::Clock;
+
+    // 1) 连接池获取一条到该实例的共享连接，建连时间也计入截止时间
+    std::shared_ptr<MprpcConnection> conn = MprpcConnectionPool::GetInstance().Acquire(endpoint, timeout_ms);
+    if (!conn)
     {
         char errtext[256] = {0};
         sprintf(errtext, "connect error! errno:  %d", errno);
-        controller->SetFailed(errtext);
+        MprpcController::Fail(controller, mprpc::RPC_UNAVAILABLE, errtext);
+        endpoint.breaker->Report(ticket, true, 0);
+        if (done) done->Run();
         return;
     }
 
-    // 4) 发送与接收
-    if (!sendAll(clientfd, frame.data(), frame.size(), controller))
+    // 2) 构造请求帧（长度前缀 + header + args），这条连接上已知方法id时只带id
+    const uint64_t request_id = s_next_request_id.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t method_id = compactMethodId() ? conn->MethodId(method) : 0;
+    std::string frame;
+    if (!buildRequestFrame(method, request, request_id, method_id, (uint32_t)timeout_ms, 0, trace,
+                           conn->PeerAcceptedCompression(), frame, controller))
     {
-        close(clientfd);
+        endpoint.breaker->Release(ticket);
+        if (done) done->Run();
         return;
     }
-    if (!recvResponse(clientfd, response, controller))
+
+    // 3) 发送并等待同一 request_id 的响应（异步时由读线程执行done）；出错的连接会被标记失效，下次取连接时剔除
+    // 在途计数供p2c策略比较实例负载，调用结束（无论成败）时减回，同时把结果报告给熔断器
+    std::shared_ptr<std::atomic<uint32_t>> outstanding = endpoint.outstanding;
+    outstanding->fetch_add(1, std::memory_order_relaxed);
+    const Clock::time_point call_start = Clock::now();
+    if (done)
     {
-        close(clientfd);
+        // 闭包持有实例列表，保证endpoint在调用结束前有效
+        const MprpcEndpoint *ep = &endpoint;
+        conn->Call(request_id, method, frame, response, controller,
+                   NewMprpcClosure([outstanding, endpoints, ep, ticket, controller, call_start, hedge, done]() {
+            outstanding->fetch_sub(1, std::memory_order_relaxed);
+            reportHealth(*endpoints, *ep, ticket, controller, call_start, hedge);
+            done->Run();
+        }), deadline);
         return;
     }
-
-    // 6) 归还连接
-    returnConnection(key, clientfd);
+    conn->Call(request_id, method, frame, response, controller, nullptr, deadline);
+    outstanding->fetch_sub(1, std::memory_order_relaxed);
+    reportHealth(*endpoints, endpoint, ticket, controller, call_start, hedge);
 }
 
-// ---- helpers ----
-// 构建一个RPC请求的序列化数据帧
-bool MprpcChannel::buildRequestFrame(const google::protobuf::MethodDescriptor* method,
-                                     const google::protobuf::Message* request,
-                                     std::string& out,
-                                     google::protobuf::RpcController* controller)
+// 对冲调用：先向primary发主请求，hedge_delay_us内没有结束时再向另一个实例发一份，先成功的结果交给调用方
+// 异步调用由定时线程发出对冲请求；同步调用由调用线程自己等待并发出
+void MprpcChannel::hedgedCall(const MprpcEndpointListPtr &endpoints,
+                              const MprpcEndpoint &primary,
+                              uint64_t primary_ticket,
+                              const google::protobuf::MethodDescriptor *method,
+                              const google::protobuf::Message *request,
+                              google::protobuf::Message *response,
+                              google::protobuf::RpcController *controller,
+                              google::protobuf::Closure *done,
+                              MprpcController::Clock::time_point deadline,
+                              const RpcTraceContext &trace,
+                              MprpcHedgePolicy *hedge,
+                              uint64_t hedge_delay_us)
 {
-	// 从MethodDescriptor中提取服务名和方法名
-    const google::protobuf::ServiceDescriptor *sd = method->service();
-    std::string service_name = sd->name();
-    std::string method_name = method->name();
+    using Clock = MprpcController::Clock;
+    auto call = std::make_shared<HedgedCall>();
+    call->request = request;
+    call->response = response;
+    call->controller = controller;
+    call->done = done;
+    for (HedgedCall::Attempt &a : call->attempts)
+    {
+        a.response.reset(response->New());
+    }
+    call->launched = 1;
+    launchAttempt(call, 0, endpoints, primary, primary_ticket, request, method, deadline, trace, hedge);
 
-	// 序列化请求参数
-    std::string args_str;
-    if (!request->SerializeToString(&args_str))
+    // 对冲延迟到期时已经过了截止时间，就不必再发对冲请求
+    const Clock::time_point hedge_at = Clock::now() + std::chrono::microseconds(hedge_delay_us);
+    const bool can_hedge = hedge_at < deadline;
+    if (done)
     {
-        controller->SetFailed("serialize request error!");
-        return false;
+        if (can_hedge)
+        {
+            const MprpcEndpoint *first = &primary;
+            hedgeTimer().Add(hedge_at, [call, endpoints, first, method, deadline, trace, hedge]() {
+                launchHedge(call, endpoints, *first, method, deadline, trace, hedge);
+            });
+        }
+        return;
     }
 
-	// 构造RPC请求头
-    mprpc::RpcHeader header;
-    header.set_service_name(service_name);
-    header.set_method_name(method_name);
-    header.set_args_size((uint32_t)args_str.size());
+    std::unique_lock<std::mutex> lk(call->mu);
+    if (can_hedge && !call->cv.wait_until(lk, hedge_at, [&call]() { return call->finished; }))
+    {
+        lk.unlock();
+        launchHedge(call, endpoints, primary, method, deadline, trace, hedge);
+        lk.lock();
+    }
+    call->cv.wait(lk, [&call]() { return call->finished; });
+}
 
-    std::string header_str;
-    if (!header.SerializeToString(&header_str))
+// 对冲延迟到期：调用还没结束、预算充足并且有其他可用实例时发出对冲请求
+void MprpcChannel::launchHedge(const std::shared_ptr<HedgedCall> &call,
+                               const MprpcEndpointListPtr &endpoints,
+                               const MprpcEndpoint &primary,
+                               const google::protobuf::MethodDescriptor *method,
+                               MprpcController::Clock::time_point deadline,
+                               const RpcTraceContext &trace,
+                               MprpcHedgePolicy *hedge)
+{
+    const MprpcEndpoint *target = nullptr;
+    MprpcCircuitBreaker::Ticket ticket = MprpcCircuitBreaker::kNoTicket;
     {
-        controller->SetFailed("serialize rpc header error!");
-        return false;
+        std::lock_guard<std::mutex> lk(call->mu);
+        if (call->finished || call->launched > 1 || MprpcController::Clock::now() >= deadline) return;
+        if (!hedge->TryHedge()) return;
+        // Allow()放行后必须真的发出请求（half_open的探测名额），所以先申请预算再选实例
+        target = pickHedgeTarget(*endpoints, primary, &ticket);
+        if (!target)
+        {
+            // 其他实例都在熔断中：没有发出对冲请求，退回预算，否则实例整体异常时预算会被白白耗光
+            hedge->RefundHedge();
+            return;
+        }
+        // 调用方的request只保证在调用结束前有效，对冲请求发出时调用可能刚好结束，这里在锁内拷贝一份
+        call->hedgeRequest.reset(call->request->New());
+        call->hedgeRequest->CopyFrom(*call->request);
+        call->launched = 2;
     }
+    launchAttempt(call, 1, endpoints, *target, ticket, call->hedgeRequest.get(), method, deadline, trace, hedge);
+}
 
-	//构造完整的请求帧
-    uint32_t header_size = (uint32_t)header_str.size();
-    out.clear();
-    out.reserve(4 + header_str.size() + args_str.size());
-    out.append(std::string((char*)&header_size, 4));
-    out.append(header_str);
-    out.append(args_str);
-    return true;
+void MprpcChannel::launchAttempt(const std::shared_ptr<HedgedCall> &call,
+                                 int index,
+                                 const MprpcEndpointListPtr &endpoints,
+                                 const MprpcEndpoint &endpoint,
+                                 uint64_t ticket,
+                                 const google::protobuf::Message *request,
+                                 const google::protobuf::MethodDescriptor *method,
+                                 MprpcController::Clock::time_point deadline,
+                                 const RpcTraceContext &trace,
+                                 MprpcHedgePolicy *hedge)
+{
+    // 对冲请求发出时预算已经用完，就只带1ms，由超时检查结束它
+    const int timeout_ms = std::max(remainingMs(deadline), deadline == MprpcController::Clock::time_point::max() ? 0 : 1);
+    HedgedCall::Attempt &a = call->attempts[index];
+    sendTo(endpoints, endpoint, ticket, method, request, a.response.get(), &a.controller,
+           NewMprpcClosure([call, index]() { onAttemptDone(call, index); }), deadline, timeout_ms, trace, hedge);
 }
 
-// 解析RPC服务的网络地址，并将结果存储到sockaddr_in结构中。他通过检查本地缓存或从zookeeper获取服务地址，确保高效且准确地服务端点
-bool MprpcChannel::resolveEndpoint(const std::string& service,
-                                   const std::string& method,
-                                   struct sockaddr_in& out,
-                                   google::protobuf::RpcController* controller)
+void MprpcChannel::onAttemptDone(const std::shared_ptr<HedgedCall> &call, int index)
 {
-    using namespace std::chrono;
-    struct CacheEntry { sockaddr_in addr; steady_clock::time_point expire; };
-    static std::once_flag s_zk_once;	//确保zookeeper客户端只初始化一次
-    static ZkClient s_zk;			// zookeeper客户端，用于从zookeeper获取服务地址
-    static std::mutex s_cache_mu;	//互斥锁，保护地址缓存的线程安全
-    static std::unordered_map<std::string, CacheEntry> s_addr_cache;//地址缓存，存储服务方法对应的网络地址及其过期时间
-
-// 这什么用法
-// 函数定义与mutex, call_once保证可调用对象只被执行一次,防止多次初始化zk客户端
-// s_zk_once:标志对象,用于指示_Fx是否已被调用过
-// 如果在调用call_once时,标志对象已设置,则不会调用可调用对象
-// 如果在调用call_once时,标志对象未设置,则调用可调用对象,并设置标志对象
-// 这样可以确保zk客户端只初始化一次,防止多次初始化zk客户端带来的性能开销
-// 如果需要多次初始化zk客户端,可以多次调用call_once,每次调用时,标志对象都会被设置,但可调用对象只会被执行一次
-    std::call_once(s_zk_once, [](){ s_zk.Start(); });
-
-	//构造方法路径
-    const std::string method_path = "/" + service + "/" + method;
-    const auto now_tp = steady_clock::now();
-    const auto ttl = milliseconds(1000);
-
-	// 检查缓存中是否存在对应的服务地址
-	// 如果缓存未过期，直接返回缓存的地址
-	// 这里直接通过 时间来进行缓存过期判断
-    {
-        std::lock_guard<std::mutex> lk(s_cache_mu);
-        auto it = s_addr_cache.find(method_path);
-        if (it != s_addr_cache.end() && now_tp < it->second.expire)
+    google::protobuf::Closure *done = nullptr;
+    {
+        std::lock_guard<std::mutex> lk(call->mu);
+        ++call->completed;
+        HedgedCall::Attempt &a = call->attempts[index];
+        const bool ok = !a.controller.Failed();
+        // 已经有结果，或者失败了但另一个请求还在途，都不结束调用
+        if (call->finished || (!ok && call->completed < call->launched)) return;
+        call->finished = true;
+        if (ok)
         {
-            out = it->second.addr;
-            return true;
+            call->response->GetReflection()->Swap(call->response, a.response.get());
         }
+        else
+        {
+            MprpcController::Fail(call->controller, a.controller.ErrorCode(), a.controller.ErrorText());
+        }
+        done = call->done;
+        call->cv.notify_all();
     }
+    if (done) done->Run();
+}
 
-// 从zookeeper获取服务地址
-    std::string host_data = s_zk.GetData(method_path.c_str());
-    if (host_data.empty())
+std::future<bool> MprpcChannel::CallMethodAsync(const google::protobuf::MethodDescriptor *method,
+                                                google::protobuf::RpcController *controller,
+                                                const google::protobuf::Message *request,
+                                                google::protobuf::Message *response)
+{
+    auto prom = std::make_shared<std::promise<bool>>();
+    std::future<bool> fut = prom->get_future();
+    // 没有传controller时用一个随闭包释放的controller，future仍然能反映调用是否成功
+    std::shared_ptr<MprpcController> owned;
+    if (controller == nullptr)
     {
-        controller->SetFailed(method_path + " is not exist!");
-        return false;
+        owned = std::make_shared<MprpcController>();
+        controller = owned.get();
     }
-// 解析服务地址
-    int idx = host_data.find(":");
-    if (idx == -1)
+    CallMethod(method, controller, request, response, NewMprpcClosure([prom, controller, owned]() {
+        prom->set_value(!controller->Failed());
+    }));
+    return fut;
+}
+
+std::unique_ptr<MprpcStreamReader> MprpcChannel::CallStream(const google::protobuf::MethodDescriptor *method,
+                                                         google::protobuf::RpcController *controller,
+                                                         const google::protobuf::Message *request)
+{
+    using Clock = MprpcController::Clock;
+    // 调用方没有传controller时，解析实例列表和构造请求的错误由内部的controller接住，流的错误直接丢弃
+    MprpcController local_controller;
+    google::protobuf::RpcController *err_controller = controller ? controller : &local_controller;
+    auto queue = std::make_shared<MprpcStreamQueue>();
+    // 请求没能发出时返回一个已经结束的流，第一次Read即返回false
+    auto failed = [&queue, controller](int error_code, const std::string &reason) {
+        queue->End(error_code, reason);
+        return std::unique_ptr<MprpcStreamReader>(
+            new MprpcStreamReader(controller, nullptr, 0, 0, queue, nullptr));
+    };
+
+    // 截止时间限制的是整个流（从发出请求到读到最后一条消息）
+    MprpcController *mprpc_controller = dynamic_cast<MprpcController *>(controller);
+    const Clock::time_point deadline = callDeadline(mprpc_controller);
+    const int timeout_ms = remainingMs(deadline);
+    if (timeout_ms < 0)
     {
-        controller->SetFailed(method_path + " address is invalid!");
-        return false;
+        return failed(mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded");
     }
-    std::string ip = host_data.substr(0, (size_t)idx);
-    uint16_t port = (uint16_t)atoi(host_data.substr((size_t)idx + 1).c_str());
-// 填充sockaddr_in结构
-    out.sin_family = AF_INET;
-    out.sin_port = htons(port);
-    out.sin_addr.s_addr = inet_addr(ip.c_str());
-// 更新地址缓存
+
+    const RpcTraceContext parent = RpcTracer::Current();
+    const RpcTraceContext span = RpcTracer::GetInstance().StartSpan(parent);
+    const RpcTracer::Clock::time_point span_start = RpcTracer::Clock::now();
+
+    const std::string service_name = method->service()->name();
+    MprpcEndpointListPtr endpoints = resolveEndpoints(service_name, method->name(), err_controller);
+    if (!endpoints)
     {
-        std::lock_guard<std::mutex> lk(s_cache_mu);
-        s_addr_cache[method_path] = CacheEntry{out, now_tp + ttl};
+        return failed(mprpc::RPC_UNAVAILABLE, err_controller->ErrorText());
     }
-    return true;
-}
+    static const std::string kNoHashKey;
+    const std::string &hash_key = mprpc_controller ? mprpc_controller->HashKey() : kNoHashKey;
+    MprpcLoadBalancer *balancer = m_balancer ? m_balancer.get() : balancerFor(service_name);
+    MprpcCircuitBreaker::Ticket ticket = MprpcCircuitBreaker::kNoTicket;
+    const MprpcEndpoint &endpoint = skipEjected(*endpoints, balancer->Select(*endpoints, hash_key), &ticket);
 
-// 获取一个TCP连接的文件描述符，实现了一个简单的连接池机制，用于复用已有的连接，避免频繁创建和销毁连接带来的性能开销
-int MprpcChannel::getConnection(const std::string& key, const struct sockaddr_in& addr)
-{
-    // 从连接池中获取连接
+    std::shared_ptr<MprpcConnection> conn = MprpcConnectionPool::GetInstance().Acquire(endpoint, timeout_ms);
+    if (!conn)
     {
-        std::lock_guard<std::mutex> lk(s_pool_mu);
-        auto &vec = s_conn_pool[key];
-        if (!vec.empty()) { int fd = vec.back(); vec.pop_back(); return fd; }
+        char errtext[256] = {0};
+        sprintf(errtext, "connect error! errno:  %d", errno);
+        endpoint.breaker->Report(ticket, true, 0);
+        return failed(mprpc::RPC_UNAVAILABLE, errtext);
     }
-    // 如果连接池中没有可用连接，则创建一个新的连接
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd == -1) return -1;
-#ifdef TCP_NODELAY
-    int one = 1; setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
-#endif
-    int yes = 1; setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
-    if (-1 == connect(fd, (const struct sockaddr *)&addr, sizeof(addr)))
+
+    const uint64_t request_id = s_next_request_id.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t method_id = compactMethodId() ? conn->MethodId(method) : 0;
+    const uint32_t window = streamWindow();
+    std::string frame;
+    if (!buildRequestFrame(method, request, request_id, method_id, (uint32_t)timeout_ms, window, span,
+                           conn->PeerAcceptedCompression(), frame, err_controller))
     {
-        close(fd);
-        return -1;
+        endpoint.breaker->Release(ticket);
+        return failed(mprpc::RPC_INTERNAL, "serialize request error!");
     }
-    return fd;
-}
 
-void MprpcChannel::returnConnection(const std::string& key, int fd)
-{
-    std::lock_guard<std::mutex> lk(s_pool_mu);
-    auto &vec = s_conn_pool[key];
-    if (vec.size() < kMaxPoolPerKey) vec.push_back(fd); else close(fd);
+    // 流的耗时取决于结果集大小和读取速度，结果报告给熔断器但不计入平均延迟
+    std::shared_ptr<std::atomic<uint32_t>> outstanding = endpoint.outstanding;
+    std::shared_ptr<MprpcCircuitBreaker> breaker = endpoint.breaker;
+    outstanding->fetch_add(1, std::memory_order_relaxed);
+    auto on_end = [outstanding, breaker, ticket, parent, span, span_start, method](int error_code) {
+        outstanding->fetch_sub(1, std::memory_order_relaxed);
+        // 无论成败都要报告：这次调用可能占着half_open的探测名额（Cancel和析构也以RPC_OK结束）
+        breaker->Report(ticket, MprpcCircuitBreaker::IsFailure(error_code), 0);
+        RpcTracer::GetInstance().Record(span, parent.spanId, RpcTracer::kClient,
+                                        method->service()->name() + "." + method->name(), span_start,
+                                        RpcTracer::Clock::now(), error_code);
+    };
+    conn->CallStream(request_id, method, frame, queue, deadline);
+    return std::unique_ptr<MprpcStreamReader>(
+        new MprpcStreamReader(controller, conn, request_id, window, queue, on_end));
 }
 
-bool MprpcChannel::sendAll(int fd, const char* data, size_t len, google::protobuf::RpcController* controller)
+// 批量调用：各项的子请求帧（request_id为下标）拼成外层请求帧的args，外层header只带request_id和batch_count
+void MprpcChannel::CallBatch(std::vector<MprpcBatchCall> &calls,
+                             google::protobuf::RpcController *controller,
+                             google::protobuf::Closure *done)
 {
-    const char* p = data;
-    size_t left = len;
-    // 只要还要数据未发送，就继续发送
-    while (left > 0)
-    {
-        ssize_t n = ::send(fd, p, left, 0);
-        if (n > 0) { p += n; left -= (size_t)n; continue; }
-        if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
-            continue;
+    using Clock = MprpcController::Clock;
+    // 没有传整体的controller时换成内部的controller，同CallMethod；各项的controller可以为nullptr
+    if (controller == nullptr)
+    {
+        if (!done)
+        {
+            MprpcController local;
+            CallBatch(calls, &local, nullptr);
+            return;
         }
-        char errtext[512] = {0};
-        sprintf(errtext, "send error! errno:   %d", errno);
-        controller->SetFailed(errtext);
-        return false;
+        MprpcController *owned = new MprpcController();
+        CallBatch(calls, owned, NewMprpcClosure([owned, done]() {
+            delete owned;
+            done->Run();
+        }));
+        return;
     }
-    return true;
+    // 整体失败时controller和每一项都以同样的错误结束
+    auto fail_all = [&calls, controller](int error_code, const std::string &reason) {
+        MprpcController::Fail(controller, error_code, reason);
+        for (MprpcBatchCall &item : calls)
+        {
+            MprpcController::Fail(item.controller, error_code, reason);
+        }
+    };
+    if (calls.empty())
+    {
+        if (done) done->Run();
+        return;
+    }
+    const google::protobuf::MethodDescriptor *first = calls[0].method;
+    for (const MprpcBatchCall &item : calls)
+    {
+        if (item.method->service() != first->service())
+        {
+            fail_all(mprpc::RPC_BAD_REQUEST, "batch calls must belong to the same service");
+            if (done) done->Run();
+            return;
+        }
+    }
+
+    MprpcController *mprpc_controller = dynamic_cast<MprpcController *>(controller);
+    const Clock::time_point deadline = callDeadline(mprpc_controller);
+    const int timeout_ms = remainingMs(deadline);
+    if (timeout_ms < 0)
+    {
+        fail_all(mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded");
+        if (done) done->Run();
+        return;
+    }
+
+    // 本进程内的服务：逐项直接调用，异步时各项并行执行，全部结束后执行done
+    if (std::shared_ptr<MprpcLocalTarget> local = MprpcLocalRegistry::GetInstance().Find(first->service()->name()))
+    {
+        if (!done)
+        {
+            for (MprpcBatchCall &item : calls)
+            {
+                callLocal(*local, item.method, item.controller, item.request, item.response, nullptr, deadline);
+            }
+            return;
+        }
+        auto remaining = std::make_shared<std::atomic<size_t>>(calls.size());
+        for (MprpcBatchCall &item : calls)
+        {
+            callLocal(*local, item.method, item.controller, item.request, item.response,
+                      NewMprpcClosure([remaining, done]() {
+                if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) done->Run();
+            }), deadline);
+        }
+        return;
+    }
+
+    // 整个批量调用记一个客户端span，子调用在服务端都挂在这个span下面
+    const RpcTraceContext parent = RpcTracer::Current();
+    const RpcTraceContext span = RpcTracer::GetInstance().StartSpan(parent);
+    const RpcTracer::Clock::time_point span_start = RpcTracer::Clock::now();
+    const std::string span_name = first->service()->name() + ".batch";
+    auto record_span = [parent, span, span_start, span_name, controller]() {
+        if (!span.sampled) return;
+        MprpcController *mc = dynamic_cast<MprpcController *>(controller);
+        int status = (controller == nullptr || !controller->Failed()) ? 0 : (mc ? mc->ErrorCode() : mprpc::RPC_INTERNAL);
+        RpcTracer::GetInstance().Record(span, parent.spanId, RpcTracer::kClient, span_name, span_start,
+                                        RpcTracer::Clock::now(), status);
+    };
+
+    const std::string service_name = first->service()->name();
+    MprpcEndpointListPtr endpoints = resolveEndpoints(service_name, first->name(), controller);
+    if (!endpoints)
+    {
+        fail_all(mprpc::RPC_UNAVAILABLE, controller->ErrorText());
+        record_span();
+        if (done) done->Run();
+        return;
+    }
+    static const std::string kNoHashKey;
+    const std::string &hash_key = mprpc_controller ? mprpc_controller->HashKey() : kNoHashKey;
+    MprpcLoadBalancer *balancer = m_balancer ? m_balancer.get() : balancerFor(service_name);
+    MprpcCircuitBreaker::Ticket ticket = MprpcCircuitBreaker::kNoTicket;
+    const MprpcEndpoint &endpoint = skipEjected(*endpoints, balancer->Select(*endpoints, hash_key), &ticket);
+
+    std::shared_ptr<MprpcConnection> conn = MprpcConnectionPool::GetInstance().Acquire(endpoint, timeout_ms);
+    if (!conn)
+    {
+        char errtext[256] = {0};
+        sprintf(errtext, "connect error! errno:  %d", errno);
+        endpoint.breaker->Report(ticket, true, 0);
+        fail_all(mprpc::RPC_UNAVAILABLE, errtext);
+        record_span();
+        if (done) done->Run();
+        return;
+    }
+
+    // 子请求帧依次追加在外层header之后，每个子请求各自带上剩余预算，服务端按它过期丢弃
+    std::string body;
+    std::string sub;
+    for (size_t i = 0; i < calls.size(); ++i)
+    {
+        const uint32_t method_id = compactMethodId() ? conn->MethodId(calls[i].method) : 0;
+        if (!buildRequestFrame(calls[i].method, calls[i].request, i, method_id, (uint32_t)timeout_ms, 0, span,
+                               conn->PeerAcceptedCompression(), sub, calls[i].controller))
+        {
+            endpoint.breaker->Release(ticket);
+            fail_all(mprpc::RPC_INTERNAL, "serialize request error!");
+            record_span();
+            if (done) done->Run();
+            return;
+        }
+        body.append(sub);
+    }
+    const uint64_t request_id = s_next_request_id.fetch_add(1, std::memory_order_relaxed);
+    mprpc::RpcHeader header;
+    header.set_request_id(request_id);
+    header.set_batch_count((uint32_t)calls.size());
+    header.set_args_size((uint32_t)body.size());
+    header.set_timeout_ms((uint32_t)timeout_ms);
+    header.set_trace_id(span.traceId);
+    header.set_span_id(span.spanId);
+    header.set_trace_flags(span.sampled ? 1 : 0);
+    const std::string header_str = header.SerializeAsString();
+    std::string frame;
+    frame.reserve(4 + header_str.size() + body.size());
+    uint32_t header_len = (uint32_t)header_str.size();
+    frame.append(reinterpret_cast<const char *>(&header_len), 4);
+    frame.append(header_str);
+    frame.append(body);
+
+    // 在途计数和熔断统计按一次调用计，与sendTo相同
+    std::shared_ptr<std::atomic<uint32_t>> outstanding = endpoint.outstanding;
+    outstanding->fetch_add(1, std::memory_order_relaxed);
+    const Clock::time_point call_start = Clock::now();
+    if (done)
+    {
+        const MprpcEndpoint *ep = &endpoint;
+        conn->CallBatch(request_id, frame, &calls, controller,
+                        NewMprpcClosure([outstanding, endpoints, ep, ticket, controller, call_start, record_span, done]() {
+            outstanding->fetch_sub(1, std::memory_order_relaxed);
+            reportHealth(*endpoints, *ep, ticket, controller, call_start, nullptr);
+            record_span();
+            done->Run();
+        }), deadline);
+        return;
+    }
+    conn->CallBatch(request_id, frame, &calls, controller, nullptr, deadline);
+    outstanding->fetch_sub(1, std::memory_order_relaxed);
+    reportHealth(*endpoints, endpoint, ticket, controller, call_start, nullptr);
+    record_span();
 }
 
-// 从指定的文件描述符中接收一个完整的响应消息，并解析
-bool MprpcChannel::recvResponse(int fd, google::protobuf::Message* response, google::protobuf::RpcController* controller)
+// ---- helpers ----
+// 构建一个RPC请求的序列化数据帧
+bool MprpcChannel::buildRequestFrame(const google::protobuf::MethodDescriptor* method,
+                                     const google::protobuf::Message* request,
+                                     uint64_t request_id,
+                                     uint32_t method_id,
+                                     uint32_t timeout_ms,
+                                     uint32_t stream_window,
+                                     const RpcTraceContext& trace,
+                                     uint32_t peer_accepted,
+                                     std::string& out,
+                                     google::protobuf::RpcController* controller)
 {
-    // 接收消息长度
-    uint32_t resp_len = 0;
-    int recvd = 0;
-    char lenbuf[4];
-    while (recvd < 4)
-    {
-        int n = ::recv(fd, lenbuf + recvd, 4 - recvd, 0);
-        if (n > 0) { recvd += n; continue; }
-        if (n == 0) { controller->SetFailed("connection closed before length"); return false; }
-        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) { continue; }
-        char errtext[512] = {0};
-        sprintf(errtext, "recv error! errno:   %d", errno);
-        controller->SetFailed(errtext);
-        return false;
+	// 从MethodDescriptor中提取服务名和方法名
+    const google::protobuf::ServiceDescriptor *sd = method->service();
+
+	// 先算出请求参数的大小，header和args都直接序列化进out，不产生中间字符串
+    size_t args_size = request->ByteSizeLong();
+
+	// 服务端能解压的大参数先序列化再压缩，encoded保存最终要发出的args（压缩没有收益时就是原始数据）
+    std::string encoded;
+    const uint32_t codec = RpcCompress::Choose(peer_accepted, args_size);
+    uint32_t raw_size = 0;
+    if (codec != mprpc::RPC_COMPRESS_NONE)
+    {
+        if (!request->SerializeToString(&encoded))
+        {
+            MprpcController::Fail(controller, mprpc::RPC_INTERNAL, "serialize request error!");
+            return false;
+        }
+        std::string compressed;
+        if (RpcCompress::Compress(codec, encoded.data(), encoded.size(), &compressed))
+        {
+            raw_size = (uint32_t)encoded.size();
+            encoded.swap(compressed);
+        }
+        args_size = encoded.size();
     }
-    ::memcpy(&resp_len, lenbuf, 4);
-
-    // 接收消息体
-    std::string resp_buf;
-    resp_buf.resize(resp_len);
-    size_t got = 0;
-    while (got < resp_buf.size())
-    {
-        int n = ::recv(fd, &resp_buf[got], (int)(resp_buf.size() - got), 0);
-        if (n > 0) { got += n; continue; }
-        if (n == 0) { controller->SetFailed("connection closed mid-body"); return false; }
-        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) { continue; }
-        char errtext[512] = {0};
-        sprintf(errtext, "recv error! errno:   %d", errno);
-        controller->SetFailed(errtext);
-        return false;
+
+	// 构造RPC请求头
+    mprpc::RpcHeader header;
+    if (method_id != 0)
+    {
+        header.set_method_id(method_id);
+    }
+    else
+    {
+        header.set_service_name(sd->name());
+        header.set_method_name(method->name());
     }
+    header.set_args_size((uint32_t)args_size);
+    header.set_request_id(request_id);
+    header.set_timeout_ms(timeout_ms);
+    header.set_trace_id(trace.traceId);
+    header.set_span_id(trace.spanId);
+    header.set_trace_flags(trace.sampled ? 1 : 0);
+    header.set_stream_window(stream_window);
+    header.set_accept_compression(RpcCompress::Accepted());
+    if (raw_size != 0)
+    {
+        header.set_compression(codec);
+        header.set_raw_size(raw_size);
+    }
+    const size_t header_size = header.ByteSizeLong();
 
-    // 解析消息
-    if (!response->ParseFromArray(resp_buf.data(), (int)resp_buf.size()))
+	//构造完整的请求帧
+    out.resize(4 + header_size + args_size);
+    uint32_t header_len = (uint32_t)header_size;
+    ::memcpy(&out[0], &header_len, 4);
+    uint8_t *target = reinterpret_cast<uint8_t *>(&out[4]);
+    target = header.SerializeWithCachedSizesToArray(target);
+    if (codec != mprpc::RPC_COMPRESS_NONE)
+    {
+        ::memcpy(target, encoded.data(), encoded.size());
+        return true;
+    }
+    uint8_t *end = request->SerializeWithCachedSizesToArray(target);
+    if ((size_t)(end - target) != args_size)
     {
-        controller->SetFailed("parse response error!");
+        MprpcController::Fail(controller, mprpc::RPC_INTERNAL, "serialize request error!");
         return false;
     }
     return true;
-}
\ No newline at end of file
+}
+
+// 解析RPC方法当前的实例列表：由MprpcResolver维护watch驱动的缓存，缓存命中时不访问zookeeper
+MprpcEndpointListPtr MprpcChannel::resolveEndpoints(const std::string& service,
+                                                    const std::string& method,
+                                                    google::protobuf::RpcController* controller)
+{
+    std::string err;
+    MprpcEndpointListPtr endpoints = MprpcResolver::GetInstance().Resolve("/" + service + "/" + method, err);
+    if (!endpoints)
+    {
+        MprpcController::Fail(controller, mprpc::RPC_INTERNAL, err);
+    }
+    return endpoints;
+}
@@ -0,0 +1,163 @@
+#include "mprpccircuitbreaker.h"
+#include "mprpcapplication.h"
+#include "rpcheader.pb.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+/*
+熔断配置（均为可选项）：
+cb_consecutive_failures   连续失败多少次后熔断，默认5，0表示不按失败次数熔断
+cb_base_eject_ms          第一次熔断的时长，默认1000
+cb_max_eject_ms           熔断时长的上限，默认30000
+cb_outlier_factor_pct     延迟超过其他实例中位数的百分之多少判为离群，默认300，0表示不做离群检测
+cb_outlier_min_ms         平均延迟低于它时不判为离群，默认50
+*/
+struct BreakerConfig
+{
+	uint32_t consecutiveFailures;
+	int64_t baseEjectUs;
+	int64_t maxEjectUs;
+	double outlierFactor;
+	uint64_t outlierMinUs;
+};
+
+const BreakerConfig &config()
+{
+	static const BreakerConfig c = []() {
+		MprpcConfig &conf = MprpcApplication::GetConfig();
+		BreakerConfig bc;
+		bc.consecutiveFailures = (uint32_t)std::max(0, conf.LoadInt("cb_consecutive_failures", 5));
+		bc.baseEjectUs = (int64_t)std::max(1, conf.LoadInt("cb_base_eject_ms", 1000)) * 1000;
+		bc.maxEjectUs = std::max(bc.baseEjectUs, (int64_t)conf.LoadInt("cb_max_eject_ms", 30000) * 1000);
+		bc.outlierFactor = std::max(0, conf.LoadInt("cb_outlier_factor_pct", 300)) / 100.0;
+		bc.outlierMinUs = (uint64_t)std::max(0, conf.LoadInt("cb_outlier_min_ms", 50)) * 1000;
+		return bc;
+	}();
+	return c;
+}
+
+int64_t NowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+MprpcCircuitBreaker::MprpcCircuitBreaker()
+	: m_state(kClosed), m_consecutiveFailures(0), m_openUntilUs(0), m_probe(kNoTicket), m_nextTicket(kNoTicket + 1)
+	, m_ewmaUs(0), m_reports(0)
+	, m_ejections(0)
+{
+}
+
+bool MprpcCircuitBreaker::Allow(Ticket *ticket)
+{
+	*ticket = kNoTicket;
+	int state = m_state.load(std::memory_order_acquire);
+	if (state == kClosed) return true;
+	if (state == kOpen)
+	{
+		if (NowUs() < m_openUntilUs.load(std::memory_order_relaxed)) return false;
+		// 熔断到期，转入half_open，由下面抢探测名额
+		m_state.compare_exchange_strong(state, kHalfOpen, std::memory_order_acq_rel);
+	}
+	// 每次发出的探测凭证都不同，上一轮探测迟到的结果对不上当前的凭证
+	Ticket expected = kNoTicket;
+	const Ticket probe = m_nextTicket.fetch_add(1, std::memory_order_relaxed);
+	if (!m_probe.compare_exchange_strong(expected, probe, std::memory_order_acq_rel)) return false;
+	*ticket = probe;
+	return true;
+}
+
+void MprpcCircuitBreaker::Report(Ticket ticket, bool failed, uint64_t latency_us)
+{
+	const int state = m_state.load(std::memory_order_acquire);
+	if (state == kOpen) return; // 熔断之前发出的调用迟到的结果
+	if (state == kHalfOpen)
+	{
+		// 只有当前探测请求的结果决定恢复还是再次熔断，其他调用的结果忽略
+		Ticket expected = ticket;
+		if (ticket == kNoTicket || !m_probe.compare_exchange_strong(expected, kNoTicket, std::memory_order_acq_rel))
+		{
+			return;
+		}
+		if (failed)
+		{
+			Trip();
+			return;
+		}
+		std::lock_guard<std::mutex> lk(m_tripMu);
+		m_ejections = 0;
+		m_consecutiveFailures.store(0, std::memory_order_relaxed);
+		// 熔断前的平均延迟已经没有参考意义，从探测请求的延迟重新开始（没有延迟时清零，等下一个样本）
+		m_ewmaUs.store(latency_us, std::memory_order_relaxed);
+		m_state.store(kClosed, std::memory_order_release);
+		return;
+	}
+
+	if (failed)
+	{
+		const uint32_t n = m_consecutiveFailures.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (config().consecutiveFailures > 0 && n >= config().consecutiveFailures)
+		{
+			Trip();
+		}
+		return;
+	}
+	m_consecutiveFailures.store(0, std::memory_order_relaxed);
+	if (latency_us == 0) return;
+	// EWMA，权重1/8；并发更新时偶尔丢一个样本无关紧要
+	const uint64_t old = m_ewmaUs.load(std::memory_order_relaxed);
+	const uint64_t ewma = old == 0 ? latency_us : (uint64_t)((int64_t)old + ((int64_t)latency_us - (int64_t)old) / 8);
+	m_ewmaUs.store(ewma, std::memory_order_relaxed);
+}
+
+void MprpcCircuitBreaker::Release(Ticket ticket)
+{
+	if (ticket == kNoTicket) return;
+	m_probe.compare_exchange_strong(ticket, kNoTicket, std::memory_order_acq_rel);
+}
+
+void MprpcCircuitBreaker::Eject()
+{
+	Trip();
+}
+
+void MprpcCircuitBreaker::Trip()
+{
+	std::lock_guard<std::mutex> lk(m_tripMu);
+	if (m_state.load(std::memory_order_relaxed) == kOpen) return;
+	++m_ejections;
+	const int shift = (int)std::min<uint32_t>(m_ejections - 1, 20);
+	const int64_t duration = std::min(config().baseEjectUs << shift, config().maxEjectUs);
+	m_openUntilUs.store(NowUs() + duration, std::memory_order_relaxed);
+	m_consecutiveFailures.store(0, std::memory_order_relaxed);
+	m_probe.store(kNoTicket, std::memory_order_relaxed);
+	m_state.store(kOpen, std::memory_order_release);
+}
+
+bool MprpcCircuitBreaker::IsFailure(int error_code)
+{
+	switch (error_code)
+	{
+	case mprpc::RPC_INTERNAL:
+	case mprpc::RPC_QUEUE_FULL:
+	case mprpc::RPC_DEADLINE_EXCEEDED:
+	case mprpc::RPC_UNAVAILABLE:
+	case mprpc::RPC_OVERLOADED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+double MprpcCircuitBreaker::OutlierFactor()
+{
+	return config().outlierFactor;
+}
+
+uint64_t MprpcCircuitBreaker::OutlierMinUs()
+{
+	return config().outlierMinUs;
+}
@@ -80,4 +80,22 @@ std::string MprpcConfig::Load(const std::string &key)
 		return "";
 	}
 	return it->second;
+}
+
+// 查询整数配置项信息
+int MprpcConfig::LoadInt(const std::string &key, int default_value)
+{
+	std::string value = Load(key);
+	if (value.empty())
+	{
+		return default_value;
+	}
+	char *end = nullptr;
+	long v = strtol(value.c_str(), &end, 10);
+	if (end == value.c_str())
+	{
+		LOG_WARN << "Config key: " << key << " has invalid integer value: " << value;
+		return default_value;
+	}
+	return (int)v;
 }
\ No newline at end of file
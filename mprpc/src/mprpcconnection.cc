@@ -0,0 +1,679 @@
+#include "mprpcconnection.h"
+#include "mprpcapplication.h"
+#include "mprpcchannel.h"
+#include "mprpccontroller.h"
+#include "mprpctimer.h"
+#include "mprpcstream.h"
+#include "rpccompress.h"
+#include "rpcheader.pb.h"
+#include "logger/logger.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+
+namespace {
+// 响应头长度的上限，超过时按协议错误断开连接
+const uint32_t kMaxResponseHeaderSize = 1024 * 1024;
+
+// 是否开启写合并，配置项 rpc_write_coalesce（默认0）；rpc_coalesce_window_us 为写者发出前等待并发帧的窗口（默认0，不等待）
+bool WriteCoalesce()
+{
+	static const bool on = MprpcApplication::GetConfig().LoadInt("rpc_write_coalesce", 0) != 0;
+	return on;
+}
+
+int CoalesceWindowUs()
+{
+	static const int us = std::max(0, MprpcApplication::GetConfig().LoadInt("rpc_coalesce_window_us", 0));
+	return us;
+}
+
+// 把iov全部写出，处理部分写；用sendmsg而不是writev，以便带上MSG_NOSIGNAL
+bool SendIov(int fd, std::vector<struct iovec> &iov)
+{
+	size_t first = 0;
+	while (first < iov.size())
+	{
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov[first];
+		msg.msg_iovlen = std::min<size_t>(iov.size() - first, IOV_MAX);
+		ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (n == -1)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+			return false;
+		}
+		size_t written = (size_t)n;
+		while (first < iov.size() && written >= iov[first].iov_len)
+		{
+			written -= iov[first].iov_len;
+			++first;
+		}
+		if (written > 0)
+		{
+			iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + written;
+			iov[first].iov_len -= written;
+		}
+	}
+	return true;
+}
+
+// 解析响应body，压缩过的先解压
+bool ParseResponse(const mprpc::RpcResponseHeader &header, const char *body, size_t body_size,
+				   google::protobuf::Message *response)
+{
+	if (header.compression() == mprpc::RPC_COMPRESS_NONE)
+	{
+		return response->ParseFromArray(body, (int)body_size);
+	}
+	std::string raw;
+	return RpcCompress::Decompress(header.compression(), body, body_size, header.raw_size(), &raw) &&
+		   response->ParseFromArray(raw.data(), (int)raw.size());
+}
+
+// connect，timeout_ms>0时用非阻塞connect+poll限制建连时间，超时errno为ETIMEDOUT；失败时关闭fd
+bool ConnectFd(int fd, const struct sockaddr *addr, socklen_t len, int timeout_ms)
+{
+	int ret = 0;
+	if (timeout_ms > 0)
+	{
+		// 非阻塞connect，用poll等待可写，超时返回ETIMEDOUT；连上之后恢复阻塞模式交给读线程
+		int flags = ::fcntl(fd, F_GETFL, 0);
+		::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+		ret = ::connect(fd, addr, len);
+		if (ret == -1 && errno == EINPROGRESS)
+		{
+			struct pollfd pfd = {fd, POLLOUT, 0};
+			int n = ::poll(&pfd, 1, timeout_ms);
+			int err = 0;
+			socklen_t errlen = sizeof(err);
+			if (n == 0)
+			{
+				errno = ETIMEDOUT;
+			}
+			else if (n > 0 && ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0)
+			{
+				if (err == 0) ret = 0;
+				else errno = err;
+			}
+		}
+		::fcntl(fd, F_SETFL, flags);
+	}
+	else
+	{
+		ret = ::connect(fd, addr, len);
+	}
+	if (-1 == ret)
+	{
+		int saved = errno;
+		::close(fd);
+		errno = saved;
+		return false;
+	}
+	return true;
+}
+}
+
+std::shared_ptr<MprpcConnection> MprpcConnection::Connect(const struct sockaddr_in &addr, int timeout_ms)
+{
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) return nullptr;
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+	// 池中的连接可能长时间空闲，对端静默消失时靠keepalive发现：空闲30s开始探测，5s一次，3次无应答即断开
+	int idle = 30, interval = 5, count = 3;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+	if (!ConnectFd(fd, (const struct sockaddr *)&addr, sizeof(addr), timeout_ms)) return nullptr;
+	return Start(fd);
+}
+
+std::shared_ptr<MprpcConnection> MprpcConnection::ConnectUnix(const std::string &path, int timeout_ms)
+{
+	struct sockaddr_un addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return nullptr;
+	}
+	::memcpy(addr.sun_path, path.c_str(), path.size());
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) return nullptr;
+	// 对端进程退出时内核立即关闭连接，不需要keepalive
+	if (!ConnectFd(fd, (const struct sockaddr *)&addr, sizeof(addr), timeout_ms)) return nullptr;
+	return Start(fd);
+}
+
+std::shared_ptr<MprpcConnection> MprpcConnection::Start(int fd)
+{
+	std::shared_ptr<MprpcConnection> conn(new MprpcConnection(fd));
+	// 读线程持有一份强引用：连接至少活到读线程退出（fd被关闭），异步回调里释放最后一个引用也是安全的
+	conn->m_reader = std::thread([conn]() { conn->ReadLoop(); });
+	return conn;
+}
+
+MprpcConnection::MprpcConnection(int fd)
+	: m_fd(fd), m_alive(true), m_inflight(0), m_lastActive(0)
+{
+	Touch();
+}
+
+MprpcConnection::~MprpcConnection()
+{
+	Close();
+	if (m_reader.joinable())
+	{
+		if (m_reader.get_id() == std::this_thread::get_id())
+			m_reader.detach();
+		else
+			m_reader.join();
+	}
+	::close(m_fd);
+}
+
+void MprpcConnection::Close()
+{
+	// shutdown会让阻塞在recv上的读线程返回0，由读线程统一FailAll
+	m_alive.store(false, std::memory_order_release);
+	::shutdown(m_fd, SHUT_RDWR);
+}
+
+bool MprpcConnection::Call(uint64_t request_id, const google::protobuf::MethodDescriptor *method, const std::string &frame,
+						   google::protobuf::Message *response,
+						   google::protobuf::RpcController *controller,
+						   google::protobuf::Closure *done,
+						   Clock::time_point deadline)
+{
+	auto call = std::make_shared<PendingCall>();
+	call->method = method;
+	call->response = response;
+	call->controller = controller;
+	call->done = done;
+	return Issue(call, request_id, frame, deadline);
+}
+
+bool MprpcConnection::CallBatch(uint64_t request_id, const std::string &frame, std::vector<MprpcBatchCall> *calls,
+								google::protobuf::RpcController *controller,
+								google::protobuf::Closure *done,
+								Clock::time_point deadline)
+{
+	auto call = std::make_shared<PendingCall>();
+	call->batch = calls;
+	call->controller = controller;
+	call->done = done;
+	return Issue(call, request_id, frame, deadline);
+}
+
+bool MprpcConnection::Issue(const PendingCallPtr &call, uint64_t request_id, const std::string &frame,
+							Clock::time_point deadline)
+{
+	google::protobuf::Closure *done = call->done;
+	bool alive = false;
+	{
+		std::lock_guard<std::mutex> lk(m_pendingMu);
+		alive = Alive();
+		if (alive)
+		{
+			// 先计入在途再登记，读线程结束它时扣减的一定是已经加上的计数
+			m_inflight.fetch_add(1, std::memory_order_relaxed);
+			m_pending.emplace(request_id, call);
+		}
+	}
+	if (!alive)
+	{
+		// 还没有登记为在途，不经过Finish扣减在途计数；done在锁外执行，它可以再次使用这个连接
+		SetCallError(call, mprpc::RPC_UNAVAILABLE, "connection closed");
+		Complete(call);
+		return false;
+	}
+	Touch();
+
+	if (!SendFrame(frame))
+	{
+		char errtext[512] = {0};
+		sprintf(errtext, "send error! errno:   %d", errno);
+		// 如果读线程已经把它摘走（连接同时出错），就由读线程结束它
+		if (TakePending(request_id))
+		{
+			Close();
+			FailCall(call, mprpc::RPC_UNAVAILABLE, errtext);
+			return false;
+		}
+		Close();
+	}
+
+	const bool has_deadline = deadline != Clock::time_point::max();
+	if (done)
+	{
+		if (has_deadline)
+		{
+			// 异步调用的超时由定时线程检查（同步调用直接wait_until），定时线程只持有弱引用，不延长连接的生命周期
+			std::weak_ptr<MprpcConnection> weak = shared_from_this();
+			MprpcTimer::Instance().Add(deadline, [weak, request_id]() {
+				if (auto conn = weak.lock()) conn->Expire(request_id);
+			});
+		}
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lk(call->mu);
+	if (has_deadline && !call->cv.wait_until(lk, deadline, [&call]() { return call->finished; }))
+	{
+		// 超时：摘掉在途请求（响应恰好同时到达时由读线程结束它），然后等Finish把finished置位
+		lk.unlock();
+		Expire(request_id);
+		lk.lock();
+	}
+	call->cv.wait(lk, [&call]() { return call->finished; });
+	return call->controller == nullptr || !call->controller->Failed();
+}
+
+bool MprpcConnection::CallStream(uint64_t request_id, const google::protobuf::MethodDescriptor *method,
+								 const std::string &frame, const std::shared_ptr<MprpcStreamQueue> &queue,
+								 Clock::time_point deadline)
+{
+	auto call = std::make_shared<PendingCall>();
+	call->method = method;
+	call->stream = queue;
+	bool alive = false;
+	{
+		std::lock_guard<std::mutex> lk(m_pendingMu);
+		alive = Alive();
+		if (alive)
+		{
+			// 先计入在途再登记，读线程结束它时扣减的一定是已经加上的计数
+			m_inflight.fetch_add(1, std::memory_order_relaxed);
+			m_pending.emplace(request_id, call);
+		}
+	}
+	if (!alive)
+	{
+		queue->End(mprpc::RPC_UNAVAILABLE, "connection closed");
+		return false;
+	}
+	Touch();
+
+	if (!SendFrame(frame))
+	{
+		char errtext[512] = {0};
+		sprintf(errtext, "send error! errno:   %d", errno);
+		if (TakePending(request_id))
+		{
+			FailCall(call, mprpc::RPC_UNAVAILABLE, errtext);
+			Close();
+			return false;
+		}
+		Close();
+	}
+	if (deadline != Clock::time_point::max())
+	{
+		std::weak_ptr<MprpcConnection> weak = shared_from_this();
+		MprpcTimer::Instance().Add(deadline, [weak, request_id]() {
+			if (auto conn = weak.lock()) conn->Expire(request_id);
+		});
+	}
+	return true;
+}
+
+bool MprpcConnection::SendStreamControl(uint64_t request_id, uint32_t credit, bool cancel)
+{
+	mprpc::RpcHeader header;
+	header.set_request_id(request_id);
+	header.set_stream_credit(credit);
+	header.set_stream_cancel(cancel);
+	std::string frame(4, '\0');
+	header.AppendToString(&frame);
+	uint32_t header_len = (uint32_t)(frame.size() - 4);
+	::memcpy(&frame[0], &header_len, 4);
+	return SendFrame(frame);
+}
+
+void MprpcConnection::Expire(uint64_t request_id)
+{
+	PendingCallPtr call = TakePending(request_id);
+	if (!call) return;
+	FailCall(call, mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded");
+}
+
+uint32_t MprpcConnection::MethodId(const google::protobuf::MethodDescriptor *method)
+{
+	std::lock_guard<std::mutex> lk(m_methodIdMu);
+	auto it = m_methodIds.find(method);
+	return it == m_methodIds.end() ? 0 : it->second;
+}
+
+bool MprpcConnection::SendFrame(const std::string &frame)
+{
+	if (WriteCoalesce())
+	{
+		return CoalesceFrame(frame);
+	}
+	std::lock_guard<std::mutex> lk(m_sendMu);
+	const char *p = frame.data();
+	size_t left = frame.size();
+	// 只要还要数据未发送，就继续发送
+	while (left > 0)
+	{
+		ssize_t n = ::send(m_fd, p, left, MSG_NOSIGNAL);
+		if (n > 0) { p += n; left -= (size_t)n; continue; }
+		if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+		return false;
+	}
+	return true;
+}
+
+bool MprpcConnection::CoalesceFrame(const std::string &frame)
+{
+	std::unique_lock<std::mutex> lk(m_queueMu);
+	m_sendQueue.push_back(&frame);
+	const uint64_t seq = ++m_queuedSeq;
+	// 已经有写者：等它把这一帧一起写出（写者只在队列为空时退出，所以要么等到写完，要么轮到自己做写者）
+	m_queueCv.wait(lk, [this, seq]() { return m_sentSeq >= seq || !m_writing; });
+	if (m_sentSeq >= seq)
+	{
+		return !m_sendBroken;
+	}
+
+	m_writing = true;
+	// 同一连接上还有其他在途调用时，等一个短窗口让并发的帧排进来，单独的调用不等待
+	if (CoalesceWindowUs() > 0 && m_inflight.load(std::memory_order_relaxed) > 1)
+	{
+		lk.unlock();
+		std::this_thread::sleep_for(std::chrono::microseconds(CoalesceWindowUs()));
+		lk.lock();
+	}
+	std::vector<const std::string *> batch;
+	std::vector<struct iovec> iov;
+	while (!m_sendQueue.empty())
+	{
+		batch.swap(m_sendQueue);
+		const uint64_t upto = m_queuedSeq;
+		const bool broken = m_sendBroken;
+		lk.unlock();
+
+		bool ok = !broken;
+		if (ok)
+		{
+			iov.clear();
+			for (const std::string *f : batch)
+			{
+				iov.push_back({const_cast<char *>(f->data()), f->size()});
+			}
+			ok = SendIov(m_fd, iov);
+		}
+		batch.clear();
+
+		lk.lock();
+		if (!ok) m_sendBroken = true;
+		m_sentSeq = upto;
+		m_queueCv.notify_all();
+	}
+	m_writing = false;
+	m_queueCv.notify_all();
+	return !m_sendBroken;
+}
+
+void MprpcConnection::ReadLoop()
+{
+	// 按块读取，一次recv可能带回多个响应帧（管线化时尤其常见）
+	std::vector<char> buf(64 * 1024);
+	size_t begin = 0, end = 0;
+	std::string reason = "connection closed by peer";
+	bool broken = false;
+	// 帧（或帧头）比缓冲区大时扩容，否则缓冲区读满后recv的长度为0，会被当成对端关闭
+	auto reserve = [&buf, &begin, &end](size_t need) {
+		if (need <= buf.size()) return;
+		std::vector<char> bigger(need);
+		::memcpy(bigger.data(), buf.data() + begin, end - begin);
+		end -= begin;
+		begin = 0;
+		buf.swap(bigger);
+	};
+	while (!broken)
+	{
+		// 解析出缓冲区中所有完整的帧
+		while (end - begin >= 4)
+		{
+			uint32_t header_size = 0;
+			::memcpy(&header_size, buf.data() + begin, 4);
+			// 响应头只有几个字段，长度离谱说明数据已经错位，不再为它分配内存
+			if (header_size > kMaxResponseHeaderSize)
+			{
+				reason = "rpc response header too large: " + std::to_string(header_size);
+				broken = true;
+				break;
+			}
+			if (end - begin < 4 + (size_t)header_size)
+			{
+				reserve(4 + (size_t)header_size);
+				break;
+			}
+			mprpc::RpcResponseHeader header;
+			if (!header.ParseFromArray(buf.data() + begin + 4, (int)header_size))
+			{
+				reason = "parse rpc response header error!";
+				broken = true;
+				break;
+			}
+			size_t frame_size = 4 + (size_t)header_size + header.body_size();
+			if (end - begin < frame_size)
+			{
+				// 超大响应：扩容后继续读
+				reserve(frame_size);
+				break;
+			}
+			Dispatch(header, buf.data() + begin + 4 + header_size, header.body_size());
+			begin += frame_size;
+		}
+		if (broken) break;
+		if (begin == end) { begin = end = 0; }
+		else if (begin > 0 && buf.size() - end < 4096)
+		{
+			::memmove(buf.data(), buf.data() + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+
+		ssize_t n = ::recv(m_fd, buf.data() + end, buf.size() - end, 0);
+		if (n > 0) { end += (size_t)n; continue; }
+		if (n == 0) break;
+		if (errno == EINTR) continue;
+		char errtext[512] = {0};
+		sprintf(errtext, "recv error! errno:   %d", errno);
+		reason = errtext;
+		break;
+	}
+	FailAll(reason);
+}
+
+void MprpcConnection::Dispatch(const mprpc::RpcResponseHeader &header, const char *body, size_t body_size)
+{
+	PendingCallPtr call;
+	{
+		// 流式调用的中间消息不摘除在途项，直到流的最后一帧
+		std::lock_guard<std::mutex> lk(m_pendingMu);
+		auto it = m_pending.find(header.request_id());
+		if (it != m_pending.end())
+		{
+			call = it->second;
+			if (!call->stream || !header.stream_more()) m_pending.erase(it);
+		}
+	}
+	if (!call)
+	{
+		LOG_WARN << "MprpcConnection: drop response of unknown request_id " << header.request_id();
+		return;
+	}
+	if (header.accept_compression() != 0)
+	{
+		m_peerAccepted.store(header.accept_compression(), std::memory_order_relaxed);
+	}
+	if (header.method_id() != 0 && call->method != nullptr)
+	{
+		// 按名字调用的响应会带回方法id，之后这条连接上的同一方法只发id
+		std::lock_guard<std::mutex> lk(m_methodIdMu);
+		m_methodIds[call->method] = header.method_id();
+	}
+	if (call->stream)
+	{
+		if (header.stream_more())
+		{
+			Touch();
+			call->stream->Push(body, body_size);
+			return;
+		}
+		call->stream->End(header.error_code(), header.error_text());
+		Finish(call);
+		return;
+	}
+	if (call->batch)
+	{
+		if (header.error_code() != mprpc::RPC_OK)
+		{
+			FailCall(call, header.error_code(), header.error_text());
+			return;
+		}
+		DispatchBatch(call, body, body_size);
+		Finish(call);
+		return;
+	}
+	if (header.error_code() != mprpc::RPC_OK)
+	{
+		MprpcController::Fail(call->controller, header.error_code(), header.error_text());
+	}
+	else if (!ParseResponse(header, body, body_size, call->response))
+	{
+		MprpcController::Fail(call->controller, mprpc::RPC_INTERNAL, "parse response error!");
+	}
+	Finish(call);
+}
+
+// 批量响应的body是各子调用的 header_size + RpcResponseHeader + body，子响应的request_id是它在批内的下标
+void MprpcConnection::DispatchBatch(const PendingCallPtr &call, const char *body, size_t body_size)
+{
+	std::vector<MprpcBatchCall> &items = *call->batch;
+	std::vector<bool> answered(items.size(), false);
+	size_t offset = 0;
+	while (offset + 4 <= body_size)
+	{
+		uint32_t header_size = 0;
+		::memcpy(&header_size, body + offset, 4);
+		mprpc::RpcResponseHeader sub;
+		if (offset + 4 + header_size > body_size ||
+			!sub.ParseFromArray(body + offset + 4, (int)header_size) ||
+			offset + 4 + header_size + sub.body_size() > body_size)
+		{
+			break;
+		}
+		const char *sub_body = body + offset + 4 + header_size;
+		offset += 4 + header_size + sub.body_size();
+		if (sub.request_id() >= items.size() || answered[sub.request_id()]) continue;
+
+		MprpcBatchCall &item = items[sub.request_id()];
+		answered[sub.request_id()] = true;
+		if (sub.accept_compression() != 0)
+		{
+			m_peerAccepted.store(sub.accept_compression(), std::memory_order_relaxed);
+		}
+		if (sub.method_id() != 0)
+		{
+			std::lock_guard<std::mutex> lk(m_methodIdMu);
+			m_methodIds[item.method] = sub.method_id();
+		}
+		if (sub.error_code() != mprpc::RPC_OK)
+		{
+			MprpcController::Fail(item.controller, sub.error_code(), sub.error_text());
+		}
+		else if (!ParseResponse(sub, sub_body, sub.body_size(), item.response))
+		{
+			MprpcController::Fail(item.controller, mprpc::RPC_INTERNAL, "parse response error!");
+		}
+	}
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		if (!answered[i]) MprpcController::Fail(items[i].controller, mprpc::RPC_INTERNAL, "missing response in batch");
+	}
+}
+
+MprpcConnection::PendingCallPtr MprpcConnection::TakePending(uint64_t request_id)
+{
+	std::lock_guard<std::mutex> lk(m_pendingMu);
+	auto it = m_pending.find(request_id);
+	if (it == m_pending.end()) return nullptr;
+	PendingCallPtr call = std::move(it->second);
+	m_pending.erase(it);
+	return call;
+}
+
+void MprpcConnection::FailAll(const std::string &reason)
+{
+	std::unordered_map<uint64_t, PendingCallPtr> pending;
+	{
+		std::lock_guard<std::mutex> lk(m_pendingMu);
+		m_alive.store(false, std::memory_order_release);
+		pending.swap(m_pending);
+	}
+	for (auto &kv : pending)
+	{
+		FailCall(kv.second, mprpc::RPC_UNAVAILABLE, reason);
+	}
+}
+
+void MprpcConnection::FailCall(const PendingCallPtr &call, int error_code, const std::string &reason)
+{
+	SetCallError(call, error_code, reason);
+	Finish(call);
+}
+
+void MprpcConnection::SetCallError(const PendingCallPtr &call, int error_code, const std::string &reason)
+{
+	if (call->stream)
+	{
+		call->stream->End(error_code, reason);
+	}
+	else
+	{
+		MprpcController::Fail(call->controller, error_code, reason);
+		if (call->batch)
+		{
+			for (MprpcBatchCall &item : *call->batch)
+			{
+				MprpcController::Fail(item.controller, error_code, reason);
+			}
+		}
+	}
+}
+
+void MprpcConnection::Finish(const PendingCallPtr &call)
+{
+	m_inflight.fetch_sub(1, std::memory_order_relaxed);
+	Touch();
+	Complete(call);
+}
+
+void MprpcConnection::Complete(const PendingCallPtr &call)
+{
+	if (call->done)
+	{
+		call->done->Run();
+		return;
+	}
+	std::lock_guard<std::mutex> lk(call->mu);
+	call->finished = true;
+	call->cv.notify_one();
+}
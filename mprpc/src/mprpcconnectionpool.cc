@@ -0,0 +1,259 @@
+#include "mprpcconnectionpool.h"
+#include "mprpcconnection.h"
+#include "mprpcresolver.h"
+#include "mprpcapplication.h"
+#include "logger/logger.h"
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace {
+const int kDefaultMaxConnsPerKey = 4;
+const int kDefaultIdleTimeoutMs = 60 * 1000;
+const int kDefaultSweepIntervalMs = 1000;
+const int kDefaultStatsLogMs = 60 * 1000;
+}
+
+MprpcConnectionPool &MprpcConnectionPool::GetInstance()
+{
+	static MprpcConnectionPool pool;
+	return pool;
+}
+
+/*
+连接池配置（均为可选项）：
+rpc_max_conns_per_endpoint   每个实例最多建立的连接数，默认4
+rpc_pool_idle_timeout_ms     连接空闲多久后关闭，默认60000，0表示不按空闲关闭
+rpc_pool_prewarm             发现实例时预先建立的连接数，默认0（不预热）
+rpc_pool_sweep_interval_ms   维护线程的巡检周期，默认1000
+rpc_pool_stats_log_ms        维护线程打印连接池计数的周期，默认60000，0表示不打印
+*/
+MprpcConnectionPool::MprpcConnectionPool()
+	: m_rr(0), m_hits(0), m_misses(0), m_dials(0), m_dialFailures(0), m_unixDials(0), m_evictedIdle(0), m_evictedDead(0)
+{
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	int max_conns = config.LoadInt("rpc_max_conns_per_endpoint", kDefaultMaxConnsPerKey);
+	m_maxConnsPerKey = max_conns > 0 ? (size_t)max_conns : (size_t)kDefaultMaxConnsPerKey;
+	int prewarm = config.LoadInt("rpc_pool_prewarm", 0);
+	m_prewarm = prewarm > 0 ? std::min((size_t)prewarm, m_maxConnsPerKey) : 0;
+	m_idleTimeoutMs = config.LoadInt("rpc_pool_idle_timeout_ms", kDefaultIdleTimeoutMs);
+	m_sweepIntervalMs = config.LoadInt("rpc_pool_sweep_interval_ms", kDefaultSweepIntervalMs);
+	if (m_sweepIntervalMs <= 0) m_sweepIntervalMs = kDefaultSweepIntervalMs;
+	m_statsLogMs = std::max(0, config.LoadInt("rpc_pool_stats_log_ms", kDefaultStatsLogMs));
+
+	// 池是进程级单例，维护线程随进程存在
+	std::thread([this]() { MaintainLoop(); }).detach();
+}
+
+std::shared_ptr<MprpcConnection> MprpcConnectionPool::Acquire(const MprpcEndpoint &endpoint, int connect_timeout_ms)
+{
+	const std::string &key = endpoint.id;
+	Target target;
+	target.addr = endpoint.addr;
+	target.unixPath = endpoint.unixPath;
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		Bucket &bucket = m_buckets[key];
+		bucket.target = target;
+		std::shared_ptr<MprpcConnection> best;
+		for (auto it = bucket.conns.begin(); it != bucket.conns.end();)
+		{
+			if (!(*it)->Alive())
+			{
+				it = bucket.conns.erase(it);
+				m_evictedDead.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			if (!best || (*it)->Inflight() < best->Inflight()) best = *it;
+			++it;
+		}
+		if (best && (best->Inflight() == 0 || bucket.conns.size() >= m_maxConnsPerKey))
+		{
+			// 在锁内刷新活跃时间，维护线程不会把刚交出去、还没发出请求的连接当作空闲关闭
+			best->Touch();
+			m_hits.fetch_add(1, std::memory_order_relaxed);
+			return best;
+		}
+	}
+	// 在锁外拨号，避免阻塞其他实例的调用
+	m_misses.fetch_add(1, std::memory_order_relaxed);
+	m_dials.fetch_add(1, std::memory_order_relaxed);
+	std::shared_ptr<MprpcConnection> conn = Dial(target, connect_timeout_ms);
+	if (!conn)
+	{
+		m_dialFailures.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lk(m_mu);
+	auto &conns = m_buckets[key].conns;
+	if (conns.size() < m_maxConnsPerKey)
+	{
+		conns.push_back(conn);
+		return conn;
+	}
+	// 并发拨号时池子已经被别的线程填满：关掉多拨的这条，改用池里的连接
+	conn->Close();
+	std::shared_ptr<MprpcConnection> pooled = conns[m_rr++ % conns.size()];
+	pooled->Touch();
+	return pooled;
+}
+
+void MprpcConnectionPool::Prewarm(const std::vector<MprpcEndpoint> &endpoints)
+{
+	if (m_prewarm == 0) return;
+	std::lock_guard<std::mutex> lk(m_mu);
+	for (const MprpcEndpoint &ep : endpoints)
+	{
+		Bucket &bucket = m_buckets[ep.id];
+		bucket.target.addr = ep.addr;
+		bucket.target.unixPath = ep.unixPath;
+		bucket.warm = true;
+	}
+	m_cv.notify_one();
+}
+
+MprpcConnectionPool::Stats MprpcConnectionPool::GetStats() const
+{
+	Stats stats;
+	stats.hits = m_hits.load(std::memory_order_relaxed);
+	stats.misses = m_misses.load(std::memory_order_relaxed);
+	stats.dials = m_dials.load(std::memory_order_relaxed);
+	stats.dialFailures = m_dialFailures.load(std::memory_order_relaxed);
+	stats.unixDials = m_unixDials.load(std::memory_order_relaxed);
+	stats.evictedIdle = m_evictedIdle.load(std::memory_order_relaxed);
+	stats.evictedDead = m_evictedDead.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lk(m_mu);
+	for (const auto &kv : m_buckets)
+	{
+		stats.connections += kv.second.conns.size();
+	}
+	return stats;
+}
+
+std::string MprpcConnectionPool::Dump() const
+{
+	const Stats stats = GetStats();
+	char line[256];
+	snprintf(line, sizeof(line),
+			 "pool connections=%zu hits=%llu misses=%llu dials=%llu dial_failures=%llu unix_dials=%llu "
+			 "evicted_idle=%llu evicted_dead=%llu\n",
+			 stats.connections, (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+			 (unsigned long long)stats.dials, (unsigned long long)stats.dialFailures,
+			 (unsigned long long)stats.unixDials, (unsigned long long)stats.evictedIdle,
+			 (unsigned long long)stats.evictedDead);
+	return line;
+}
+
+void MprpcConnectionPool::MaintainLoop()
+{
+	std::vector<std::pair<std::string, Target>> to_dial;
+	MprpcConnection::Clock::time_point next_log = MprpcConnection::Clock::now() + std::chrono::milliseconds(m_statsLogMs);
+	for (;;)
+	{
+		to_dial.clear();
+		Sweep(to_dial);
+		if (m_statsLogMs > 0 && MprpcConnection::Clock::now() >= next_log)
+		{
+			next_log = MprpcConnection::Clock::now() + std::chrono::milliseconds(m_statsLogMs);
+			std::string line = Dump();
+			line.pop_back();
+				LOG_INFO << "MprpcConnectionPool: " << line;
+		}
+		// 拨号在锁外进行，每轮每个实例补一条，拨号慢的实例不会拖住整个池
+		for (const auto &kd : to_dial)
+		{
+			DialWarm(kd.first, kd.second);
+		}
+		std::unique_lock<std::mutex> lk(m_mu);
+		m_cv.wait_for(lk, std::chrono::milliseconds(m_sweepIntervalMs));
+	}
+}
+
+void MprpcConnectionPool::Sweep(std::vector<std::pair<std::string, Target>> &to_dial)
+{
+	const MprpcConnection::Clock::time_point now = MprpcConnection::Clock::now();
+	std::vector<std::shared_ptr<MprpcConnection>> idle;
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		for (auto it = m_buckets.begin(); it != m_buckets.end();)
+		{
+			Bucket &bucket = it->second;
+			for (auto cit = bucket.conns.begin(); cit != bucket.conns.end();)
+			{
+				const std::shared_ptr<MprpcConnection> &conn = *cit;
+				if (!conn->Alive())
+				{
+					cit = bucket.conns.erase(cit);
+					m_evictedDead.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+				const size_t keep = bucket.warm ? m_prewarm : 0;
+				if (m_idleTimeoutMs > 0 && bucket.conns.size() > keep && conn->Inflight() == 0 &&
+					now - conn->LastActive() >= std::chrono::milliseconds(m_idleTimeoutMs))
+				{
+					idle.push_back(conn);
+					cit = bucket.conns.erase(cit);
+					continue;
+				}
+				++cit;
+			}
+			if (bucket.warm && bucket.conns.size() < m_prewarm)
+			{
+				to_dial.emplace_back(it->first, bucket.target);
+			}
+			if (!bucket.warm && bucket.conns.empty())
+			{
+				it = m_buckets.erase(it);
+				continue;
+			}
+			++it;
+		}
+	}
+	for (auto &conn : idle)
+	{
+		conn->Close();
+	}
+	if (!idle.empty())
+	{
+		m_evictedIdle.fetch_add(idle.size(), std::memory_order_relaxed);
+			LOG_DEBUG << "MprpcConnectionPool: closed " << idle.size() << " idle connections";
+	}
+}
+
+void MprpcConnectionPool::DialWarm(const std::string &key, const Target &target)
+{
+	m_dials.fetch_add(1, std::memory_order_relaxed);
+	std::shared_ptr<MprpcConnection> conn = Dial(target, m_sweepIntervalMs);
+	const int saved_errno = errno;
+	std::lock_guard<std::mutex> lk(m_mu);
+	auto it = m_buckets.find(key);
+	if (!conn)
+	{
+		m_dialFailures.fetch_add(1, std::memory_order_relaxed);
+			LOG_WARN << "MprpcConnectionPool: prewarm " << key << " failed, errno: " << saved_errno;
+		if (it != m_buckets.end()) it->second.warm = false;
+		return;
+	}
+	if (it == m_buckets.end() || it->second.conns.size() >= m_maxConnsPerKey)
+	{
+		conn->Close();
+		return;
+	}
+	it->second.conns.push_back(conn);
+}
+
+std::shared_ptr<MprpcConnection> MprpcConnectionPool::Dial(const Target &target, int timeout_ms)
+{
+	if (!target.unixPath.empty())
+	{
+		std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(target.unixPath, timeout_ms);
+		if (conn)
+		{
+			m_unixDials.fetch_add(1, std::memory_order_relaxed);
+			return conn;
+		}
+			LOG_DEBUG << "MprpcConnectionPool: connect " << target.unixPath << " failed, errno: " << errno << ", use tcp";
+	}
+	return MprpcConnection::Connect(target.addr, timeout_ms);
+}
@@ -1,15 +1,27 @@
 #include "mprpccontroller.h"
 
+namespace {
+// 与rpcheader.proto中的RPC_INTERNAL保持一致（这里不引入生成的头文件）
+const int kRpcInternal = 4;
+
+thread_local MprpcController::Clock::time_point t_inheritedDeadline = MprpcController::Clock::time_point::max();
+}
+
 MprpcController::MprpcController()
 {
 	m_failed = false;
+	m_errorCode = 0;
 	m_errText = "";
+	m_deadline = Clock::time_point::max();
 }
 
 void MprpcController::Reset()
 {
 	m_failed = false;
+	m_errorCode = 0;
 	m_errText = "";
+	m_deadline = Clock::time_point::max();
+	m_hashKey.clear();
 }
 
 bool MprpcController::Failed() const
@@ -23,14 +35,72 @@ std::string MprpcController::ErrorText() const
 }
 
 void MprpcController::SetFailed(const std::string &reason)
+{
+	SetFailed(kRpcInternal, reason);
+}
+
+void MprpcController::SetFailed(int error_code, const std::string &reason)
 {
 	m_failed = true;
+	m_errorCode = error_code;
 	m_errText = reason;
 }
 
-// 超时接口已移除
+int MprpcController::ErrorCode() const
+{
+	return m_errorCode;
+}
+
+void MprpcController::Fail(google::protobuf::RpcController *controller, int error_code, const std::string &reason)
+{
+	// 调用方可以不传controller，这时错误直接丢弃
+	if (controller == nullptr) return;
+	MprpcController *mc = dynamic_cast<MprpcController *>(controller);
+	if (mc) mc->SetFailed(error_code, reason);
+	else controller->SetFailed(reason);
+}
+
+void MprpcController::SetTimeout(int timeout_ms)
+{
+	m_deadline = timeout_ms > 0 ? Clock::now() + std::chrono::milliseconds(timeout_ms) : Clock::time_point::max();
+}
+
+void MprpcController::SetDeadline(Clock::time_point deadline)
+{
+	m_deadline = deadline;
+}
+
+bool MprpcController::HasDeadline() const
+{
+	return m_deadline != Clock::time_point::max();
+}
+
+MprpcController::Clock::time_point MprpcController::Deadline() const
+{
+	return m_deadline;
+}
+
+void MprpcController::SetInheritedDeadline(Clock::time_point deadline)
+{
+	t_inheritedDeadline = deadline;
+}
+
+MprpcController::Clock::time_point MprpcController::InheritedDeadline()
+{
+	return t_inheritedDeadline;
+}
+
+void MprpcController::SetHashKey(const std::string &key)
+{
+	m_hashKey = key;
+}
+
+const std::string &MprpcController::HashKey() const
+{
+	return m_hashKey;
+}
 
 // 目前未实现具体的功能
 void MprpcController::StartCancel(){}
 bool MprpcController::IsCanceled() const{ return false;}
-void MprpcController::NotifyOnCancel(google::protobuf::Closure *callback){}
\ No newline at end of file
+void MprpcController::NotifyOnCancel(google::protobuf::Closure *callback){}
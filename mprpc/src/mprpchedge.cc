@@ -0,0 +1,99 @@
+#include "mprpchedge.h"
+#include "mprpcapplication.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace {
+// 窗口内样本少于它时分位数没有意义，沿用上一个窗口的对冲延迟
+const uint64_t kMinSamples = 20;
+// 令牌上限：空闲一段时间后最多允许连续发10个对冲请求
+const int64_t kMaxTokensMilli = 10 * 1000;
+
+int64_t NowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+MprpcHedgePolicy *MprpcHedgePolicy::For(const google::protobuf::MethodDescriptor *method)
+{
+	static std::mutex s_mu;
+	static std::unordered_map<const google::protobuf::MethodDescriptor *, std::unique_ptr<MprpcHedgePolicy>> s_policies;
+	std::lock_guard<std::mutex> lk(s_mu);
+	auto it = s_policies.find(method);
+	if (it == s_policies.end())
+	{
+		MprpcConfig &config = MprpcApplication::GetConfig();
+		const std::string service = method->service()->name();
+		std::string on = config.Load("rpc_hedge." + service + "." + method->name());
+		if (on.empty()) on = config.Load("rpc_hedge." + service);
+		std::unique_ptr<MprpcHedgePolicy> policy;
+		if (!on.empty() && atoi(on.c_str()) != 0)
+		{
+			policy.reset(new MprpcHedgePolicy());
+		}
+		it = s_policies.emplace(method, std::move(policy)).first;
+	}
+	return it->second.get();
+}
+
+MprpcHedgePolicy::MprpcHedgePolicy()
+	: m_windowEndUs(0), m_delayUs(0), m_tokensMilli(kMaxTokensMilli)
+{
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	m_percentile = std::min(std::max(config.LoadInt("rpc_hedge_percentile", 95), 1), 99) / 100.0;
+	m_minDelayUs = (uint64_t)std::max(config.LoadInt("rpc_hedge_min_delay_ms", 1), 0) * 1000;
+	m_budgetMilli = (int64_t)std::max(config.LoadInt("rpc_hedge_budget_pct", 10), 0) * 10;
+	m_windowUs = (int64_t)std::max(config.LoadInt("rpc_hedge_window_ms", 1000), 10) * 1000;
+	m_windowEndUs.store(NowUs() + m_windowUs, std::memory_order_relaxed);
+}
+
+uint64_t MprpcHedgePolicy::OnCall()
+{
+	if (m_tokensMilli.load(std::memory_order_relaxed) < kMaxTokensMilli)
+	{
+		m_tokensMilli.fetch_add(m_budgetMilli, std::memory_order_relaxed);
+	}
+	const int64_t now = NowUs();
+	if (now >= m_windowEndUs.load(std::memory_order_relaxed))
+	{
+		Roll(now);
+	}
+	return m_delayUs.load(std::memory_order_relaxed);
+}
+
+bool MprpcHedgePolicy::TryHedge()
+{
+	if (m_tokensMilli.fetch_sub(1000, std::memory_order_relaxed) >= 1000) return true;
+	m_tokensMilli.fetch_add(1000, std::memory_order_relaxed);
+	return false;
+}
+
+void MprpcHedgePolicy::RefundHedge()
+{
+	m_tokensMilli.fetch_add(1000, std::memory_order_relaxed);
+}
+
+void MprpcHedgePolicy::Record(uint64_t latency_us)
+{
+	m_window.Record(latency_us);
+}
+
+void MprpcHedgePolicy::Roll(int64_t now_us)
+{
+	std::unique_lock<std::mutex> lk(m_rollMu, std::try_to_lock);
+	if (!lk.owns_lock() || now_us < m_windowEndUs.load(std::memory_order_relaxed)) return;
+
+	RpcLatencyHistogram::Snapshot snap;
+	snap.Merge(m_window);
+	m_window.Reset();
+	if (snap.count >= kMinSamples)
+	{
+		m_delayUs.store(std::max(snap.Percentile(m_percentile), m_minDelayUs), std::memory_order_relaxed);
+	}
+	m_windowEndUs.store(now_us + m_windowUs, std::memory_order_relaxed);
+}
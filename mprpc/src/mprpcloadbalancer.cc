@@ -0,0 +1,93 @@
+#include "mprpcloadbalancer.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+// 一致性哈希环上每个实例的虚拟节点数，让键在少量实例之间也分布得比较均匀
+const int kVirtualNodes = 160;
+
+// FNV-1a + splitmix64收尾：跨进程稳定，不同网关上相同的键会落到同一个实例
+uint64_t hashKey(const std::string &key)
+{
+	uint64_t h = 1469598103934665603ULL;
+	for (unsigned char c : key)
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	h += 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+class RoundRobinBalancer : public MprpcLoadBalancer
+{
+public:
+	const MprpcEndpoint &Select(const MprpcEndpointList &list, const std::string &) override
+	{
+		uint64_t n = m_next.fetch_add(1, std::memory_order_relaxed);
+		return list.endpoints[n % list.endpoints.size()];
+	}
+
+private:
+	std::atomic<uint64_t> m_next{0};
+};
+
+class P2CBalancer : public MprpcLoadBalancer
+{
+public:
+	const MprpcEndpoint &Select(const MprpcEndpointList &list, const std::string &) override
+	{
+		const size_t n = list.endpoints.size();
+		if (n == 1) return list.endpoints[0];
+		thread_local std::minstd_rand rng(std::random_device{}());
+		size_t a = rng() % n;
+		size_t b = rng() % (n - 1);
+		if (b >= a) ++b; // 保证两个候选不同
+		const MprpcEndpoint &x = list.endpoints[a];
+		const MprpcEndpoint &y = list.endpoints[b];
+		return y.outstanding->load(std::memory_order_relaxed) < x.outstanding->load(std::memory_order_relaxed) ? y : x;
+	}
+};
+
+class ConsistentHashBalancer : public MprpcLoadBalancer
+{
+public:
+	const MprpcEndpoint &Select(const MprpcEndpointList &list, const std::string &hash_key) override
+	{
+		if (hash_key.empty() || list.endpoints.size() == 1)
+		{
+			return m_fallback.Select(list, hash_key);
+		}
+		// 哈希环跟随实例列表快照构建一次，列表刷新后自然重建
+		std::call_once(list.ringOnce, [&list]() {
+			list.ring.reserve(list.endpoints.size() * kVirtualNodes);
+			for (uint32_t i = 0; i < list.endpoints.size(); ++i)
+			{
+				for (int v = 0; v < kVirtualNodes; ++v)
+				{
+					list.ring.emplace_back(hashKey(list.endpoints[i].id + "#" + std::to_string(v)), i);
+				}
+			}
+			std::sort(list.ring.begin(), list.ring.end());
+		});
+		// 顺时针找到第一个不小于键哈希的虚拟节点，越过末尾则回到环首
+		auto it = std::lower_bound(list.ring.begin(), list.ring.end(),
+								   std::make_pair(hashKey(hash_key), (uint32_t)0));
+		if (it == list.ring.end()) it = list.ring.begin();
+		return list.endpoints[it->second];
+	}
+
+private:
+	P2CBalancer m_fallback;
+};
+}
+
+std::shared_ptr<MprpcLoadBalancer> MprpcLoadBalancer::Create(const std::string &policy)
+{
+	if (policy == "round_robin") return std::make_shared<RoundRobinBalancer>();
+	if (policy == "p2c") return std::make_shared<P2CBalancer>();
+	if (policy == "consistent_hash") return std::make_shared<ConsistentHashBalancer>();
+	return nullptr;
+}
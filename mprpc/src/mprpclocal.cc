@@ -0,0 +1,33 @@
+#include "mprpclocal.h"
+#include "logger/logger.h"
+
+MprpcLocalRegistry &MprpcLocalRegistry::GetInstance()
+{
+	static MprpcLocalRegistry registry;
+	return registry;
+}
+
+void MprpcLocalRegistry::Register(const std::string &service, std::shared_ptr<MprpcLocalTarget> target)
+{
+	std::lock_guard<std::mutex> lk(m_mu);
+	m_targets[service] = std::move(target);
+	m_size.store(m_targets.size(), std::memory_order_release);
+	LOG_INFO << "MprpcLocalRegistry: " << service << " is served in process";
+}
+
+void MprpcLocalRegistry::Unregister(const std::string &service, const MprpcLocalTarget *target)
+{
+	std::lock_guard<std::mutex> lk(m_mu);
+	auto it = m_targets.find(service);
+	if (it == m_targets.end() || it->second.get() != target) return;
+	m_targets.erase(it);
+	m_size.store(m_targets.size(), std::memory_order_release);
+}
+
+std::shared_ptr<MprpcLocalTarget> MprpcLocalRegistry::Find(const std::string &service) const
+{
+	if (m_size.load(std::memory_order_acquire) == 0) return nullptr;
+	std::lock_guard<std::mutex> lk(m_mu);
+	auto it = m_targets.find(service);
+	return it == m_targets.end() ? nullptr : it->second;
+}
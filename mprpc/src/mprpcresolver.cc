@@ -0,0 +1,248 @@
+#include "mprpcresolver.h"
+#include "mprpcconnectionpool.h"
+#include "logger/logger.h"
+#include "mprpcapplication.h"
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <thread>
+
+namespace {
+// 实例与调用方在同一台机器上时，是否改走实例公布的unix域socket，配置项 rpc_prefer_unix（默认1）
+bool preferUnix()
+{
+	static const bool on = MprpcApplication::GetConfig().LoadInt("rpc_prefer_unix", 1) != 0;
+	return on;
+}
+
+// addr(网络字节序)是否是本机的地址：127.0.0.0/8或者本机某个网卡的IPv4地址
+bool isLocalAddress(in_addr_t addr)
+{
+	static const std::vector<in_addr_t> s_local = []() {
+		std::vector<in_addr_t> addrs;
+		struct ifaddrs *ifs = nullptr;
+		if (::getifaddrs(&ifs) == 0)
+		{
+			for (struct ifaddrs *p = ifs; p != nullptr; p = p->ifa_next)
+			{
+				if (p->ifa_addr && p->ifa_addr->sa_family == AF_INET)
+				{
+					addrs.push_back(((struct sockaddr_in *)p->ifa_addr)->sin_addr.s_addr);
+				}
+			}
+			::freeifaddrs(ifs);
+		}
+		return addrs;
+	}();
+	if ((ntohl(addr) >> 24) == 127) return true;
+	return std::find(s_local.begin(), s_local.end(), addr) != s_local.end();
+}
+
+// 实例节点数据 "ip:port [unix=<path>]" 中的unix域socket路径，没有时返回空
+std::string parseUnixPath(const std::string &data)
+{
+	size_t pos = data.find(" unix=");
+	if (pos == std::string::npos) return "";
+	pos += 6;
+	size_t end = data.find(' ', pos);
+	return data.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+}
+
+MprpcResolver &MprpcResolver::GetInstance()
+{
+	static MprpcResolver resolver;
+	return resolver;
+}
+
+MprpcResolver::MprpcResolver()
+	: m_session(0), m_epoch(0)
+{
+}
+
+MprpcEndpointListPtr MprpcResolver::Resolve(const std::string &method_path, std::string &err)
+{
+	std::call_once(m_zkOnce, [this]() { m_zk.Start(); });
+
+	uint64_t epoch = 0;
+	uint64_t session = 0;
+	Entry stale;
+	bool has_stale = false;
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		auto it = m_cache.find(method_path);
+		if (it != m_cache.end())
+		{
+			if (it->second.watched)
+			{
+				if (!it->second.list)
+				{
+					err = it->second.err;
+				}
+				return it->second.list;
+			}
+			// watch随会话过期失效的缓存项：重新读取，读不到时用它兜底
+			stale = it->second;
+			has_stale = true;
+		}
+		epoch = m_epoch;
+		session = m_session;
+	}
+	auto use_stale = [&stale, &err]() {
+		err = stale.err;
+		return stale.list;
+	};
+
+	// 正在重建会话：有缓存的列表就先用着，不等待重连
+	std::shared_lock<std::shared_mutex> zk_lock(m_zkMu, std::try_to_lock);
+	if (!zk_lock.owns_lock())
+	{
+		if (has_stale) return use_stale();
+		err = method_path + " zookeeper session is being re-established";
+		return nullptr;
+	}
+
+	// 缓存未命中：读子节点列表并挂watch，之后实例的任何上下线都会让缓存项作废
+	std::vector<std::string> children;
+	int flag = m_zk.WatchChildren(method_path.c_str(), children, [this, session](int type, const std::string &path) {
+		if (type == ZOO_SESSION_EVENT)
+		{
+			OnSessionExpired(session);
+		}
+		else
+		{
+			Invalidate(path);
+		}
+	});
+	if (flag != ZOK && flag != ZNONODE)
+	{
+		// zk本身出错时没有watch兜底，不缓存，下次再试；之前读到过的列表继续使用
+		if (has_stale) return use_stale();
+		err = method_path + " zookeeper error: " + std::to_string(flag);
+		return nullptr;
+	}
+
+	Entry entry;
+	if (flag == ZOK)
+	{
+		entry.list = BuildList(method_path, children);
+	}
+	zk_lock.unlock();
+	if (!entry.list)
+	{
+		entry.err = method_path + " is not exist!";
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		if (m_epoch == epoch)
+		{
+			m_cache[method_path] = entry;
+		}
+	}
+	err = entry.err;
+	return entry.list;
+}
+
+MprpcEndpointListPtr MprpcResolver::BuildList(const std::string &method_path, const std::vector<std::string> &children)
+{
+	auto list = std::make_shared<MprpcEndpointList>();
+	for (const std::string &child : children)
+	{
+		// 解析服务地址 ip:port
+		size_t idx = child.find(":");
+		if (idx == std::string::npos)
+		{
+				LOG_WARN << "MprpcResolver: invalid instance " << child << " under " << method_path;
+			continue;
+		}
+		MprpcEndpoint ep;
+		ep.id = child;
+		ep.addr.sin_family = AF_INET;
+		ep.addr.sin_port = htons((uint16_t)atoi(child.substr(idx + 1).c_str()));
+		ep.addr.sin_addr.s_addr = inet_addr(child.substr(0, idx).c_str());
+		// 只有同机实例才需要读节点数据，列表刷新时多一次zk读取
+		if (preferUnix() && isLocalAddress(ep.addr.sin_addr.s_addr))
+		{
+			ep.unixPath = parseUnixPath(m_zk.GetData((method_path + "/" + child).c_str()));
+		}
+		list->endpoints.push_back(std::move(ep));
+	}
+	if (list->endpoints.empty())
+	{
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		for (MprpcEndpoint &ep : list->endpoints)
+		{
+			auto &counter = m_outstanding[ep.id];
+			if (!counter)
+			{
+				counter = std::make_shared<std::atomic<uint32_t>>(0);
+			}
+			ep.outstanding = counter;
+			auto &breaker = m_breakers[ep.id];
+			if (!breaker)
+			{
+				breaker = std::make_shared<MprpcCircuitBreaker>();
+			}
+			ep.breaker = breaker;
+		}
+	}
+	// 新发现（或重新上线）的实例交给连接池预热，第一次调用不必等connect
+	MprpcConnectionPool::GetInstance().Prewarm(list->endpoints);
+	return list;
+}
+
+void MprpcResolver::Invalidate(const std::string &path)
+{
+		LOG_INFO << "MprpcResolver: instances changed, path: " << path;
+	std::lock_guard<std::mutex> lk(m_mu);
+	m_cache.erase(path);
+	++m_epoch;
+}
+
+void MprpcResolver::OnSessionExpired(uint64_t session)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		// 同一个会话的所有watch都会收到过期事件，只处理第一个
+		if (session != m_session) return;
+		++m_session;
+		++m_epoch;
+		for (auto &kv : m_cache)
+		{
+			kv.second.watched = false;
+		}
+	}
+		LOG_WARN << "MprpcResolver: zookeeper session expired, keep serving cached endpoints while reconnecting";
+	// 事件线程里不能调用同步的zk接口，重连交给后台线程
+	std::thread([this]() { Recover(); }).detach();
+}
+
+void MprpcResolver::Recover()
+{
+	{
+		std::unique_lock<std::shared_mutex> lk(m_zkMu);
+		m_zk.Reconnect();
+	}
+		LOG_INFO << "MprpcResolver: zookeeper session re-established, re-arm watches";
+
+	std::vector<std::string> paths;
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		for (const auto &kv : m_cache)
+		{
+			if (!kv.second.watched) paths.push_back(kv.first);
+		}
+	}
+	// 重新解析即重新读取并挂watch；失败的路径保留旧列表，下一次解析时再试
+	for (const std::string &path : paths)
+	{
+		std::string err;
+		Resolve(path, err);
+	}
+}
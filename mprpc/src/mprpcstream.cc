@@ -0,0 +1,83 @@
+#include "mprpcstream.h"
+#include "mprpcconnection.h"
+#include "mprpccontroller.h"
+#include "rpcheader.pb.h"
+
+MprpcStreamReader::MprpcStreamReader(google::protobuf::RpcController *controller, std::shared_ptr<MprpcConnection> conn,
+									 uint64_t request_id, uint32_t window, std::shared_ptr<MprpcStreamQueue> queue,
+									 EndCallback on_end)
+	: m_controller(controller), m_conn(std::move(conn)), m_requestId(request_id), m_window(window), m_consumed(0)
+	, m_queue(std::move(queue)), m_onEnd(std::move(on_end)), m_ended(false)
+{
+}
+
+MprpcStreamReader::~MprpcStreamReader()
+{
+	Cancel();
+}
+
+bool MprpcStreamReader::Read(google::protobuf::Message *msg)
+{
+	if (m_ended) return false;
+	std::string body;
+	bool got = false;
+	int error_code = 0;
+	std::string error_text;
+	{
+		std::unique_lock<std::mutex> lk(m_queue->mu);
+		m_queue->cv.wait(lk, [this]() { return !m_queue->messages.empty() || m_queue->ended; });
+		if (!m_queue->messages.empty())
+		{
+			body.swap(m_queue->messages.front());
+			m_queue->messages.pop_front();
+			got = true;
+		}
+		else
+		{
+			error_code = m_queue->errorCode;
+			error_text = m_queue->errorText;
+		}
+	}
+
+	if (!got)
+	{
+		if (error_code != mprpc::RPC_OK)
+		{
+			MprpcController::Fail(m_controller, error_code, error_text);
+		}
+		End(error_code);
+		return false;
+	}
+	if (!msg->ParseFromString(body))
+	{
+		MprpcController::Fail(m_controller, mprpc::RPC_INTERNAL, "parse stream message error!");
+		if (m_conn) m_conn->SendStreamControl(m_requestId, 0, true);
+		End(mprpc::RPC_INTERNAL);
+		return false;
+	}
+	// 攒够半个窗口再追加，避免每条消息都回一个流控帧
+	if (m_conn && ++m_consumed >= (m_window + 1) / 2)
+	{
+		m_conn->SendStreamControl(m_requestId, m_consumed, false);
+		m_consumed = 0;
+	}
+	return true;
+}
+
+void MprpcStreamReader::Cancel()
+{
+	if (m_ended) return;
+	if (m_conn) m_conn->SendStreamControl(m_requestId, 0, true);
+	End(mprpc::RPC_OK);
+}
+
+void MprpcStreamReader::End(int error_code)
+{
+	m_ended = true;
+	if (m_onEnd)
+	{
+		EndCallback on_end = std::move(m_onEnd);
+		m_onEnd = nullptr;
+		on_end(error_code);
+	}
+}
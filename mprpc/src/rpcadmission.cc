@@ -0,0 +1,128 @@
+#include "rpcadmission.h"
+#include "mprpcapplication.h"
+#include "logger/logger.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+namespace {
+int64_t NowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+RpcAdmissionController::RpcAdmissionController()
+	: m_enabled(false), m_minLimit(8), m_maxLimit(2048), m_tolerance(1.5), m_windowUs(100 * 1000)
+	, m_inflight(0), m_limit(64), m_rejected(0)
+	, m_windowSum(0), m_windowCount(0), m_windowStartUs(NowUs())
+	, m_limitExact(64), m_noLoadUs(0), m_lastAvgUs(0)
+{
+}
+
+void RpcAdmissionController::Init(std::function<size_t()> queue_depth)
+{
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	m_enabled = config.LoadInt("admission_control", 0) != 0;
+	m_minLimit = std::max(1, config.LoadInt("admission_min_limit", 8));
+	m_maxLimit = std::max((int)m_minLimit, config.LoadInt("admission_max_limit", 2048));
+	m_tolerance = std::max(100, config.LoadInt("admission_tolerance_pct", 150)) / 100.0;
+	m_windowUs = (int64_t)std::max(1, config.LoadInt("admission_window_ms", 100)) * 1000;
+	m_limitExact = std::min(m_maxLimit, std::max(m_minLimit, (double)config.LoadInt("admission_initial_limit", 64)));
+	m_limit.store((int64_t)m_limitExact, std::memory_order_relaxed);
+	m_queueDepth = std::move(queue_depth);
+	m_windowStartUs.store(NowUs(), std::memory_order_relaxed);
+	if (m_enabled)
+	{
+		LOG_INFO << "RpcAdmissionController enabled, initial limit: " << (int64_t)m_limitExact
+				 << " range: [" << (int64_t)m_minLimit << ", " << (int64_t)m_maxLimit << "]";
+	}
+}
+
+RpcAdmissionController::Priority RpcAdmissionController::LoadPriority(const std::string &service, const std::string &method)
+{
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	std::string value = config.Load("admission_priority." + service + "." + method);
+	if (value.empty()) value = config.Load("admission_priority." + service);
+	if (value == "low") return kLow;
+	if (value == "high") return kHigh;
+	if (!value.empty() && value != "normal")
+	{
+		LOG_WARN << "unknown admission_priority " << value << " for " << service << "." << method << ", use normal";
+	}
+	return kNormal;
+}
+
+bool RpcAdmissionController::TryAcquire(Priority priority)
+{
+	static const int kSharePct[] = {60, 85, 100};
+	const int64_t cur = m_inflight.fetch_add(1, std::memory_order_relaxed);
+	if (!m_enabled) return true;
+	const int64_t threshold = std::max<int64_t>(1, m_limit.load(std::memory_order_relaxed) * kSharePct[priority] / 100);
+	if (cur < threshold) return true;
+	m_inflight.fetch_sub(1, std::memory_order_relaxed);
+	m_rejected.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void RpcAdmissionController::Release(bool executed, uint64_t latency_us)
+{
+	m_inflight.fetch_sub(1, std::memory_order_relaxed);
+	if (!m_enabled || !executed) return;
+	m_windowSum.fetch_add(latency_us, std::memory_order_relaxed);
+	m_windowCount.fetch_add(1, std::memory_order_relaxed);
+
+	// 窗口到期时由抢到CAS的那个线程重新计算上限，其余线程直接返回
+	const int64_t now = NowUs();
+	int64_t start = m_windowStartUs.load(std::memory_order_relaxed);
+	if (now - start >= m_windowUs &&
+		m_windowStartUs.compare_exchange_strong(start, now, std::memory_order_relaxed))
+	{
+		Update();
+	}
+}
+
+void RpcAdmissionController::Update()
+{
+	std::lock_guard<std::mutex> lk(m_updateMu);
+	const uint64_t sum = m_windowSum.exchange(0, std::memory_order_relaxed);
+	const uint64_t count = m_windowCount.exchange(0, std::memory_order_relaxed);
+	if (count == 0) return;
+
+	const double avg = std::max(1.0, (double)sum / (double)count);
+	m_lastAvgUs = avg;
+	if (m_noLoadUs == 0 || avg < m_noLoadUs) m_noLoadUs = avg;
+	else m_noLoadUs *= 1.01;
+
+	const double gradient = std::max(0.5, std::min(1.0, m_tolerance * m_noLoadUs / avg));
+	double new_limit = m_limitExact * gradient + sqrt(m_limitExact);
+	// 在途数远低于上限时不再放大，否则低负载时上限会无限增长，真正过载时要很久才能收缩回来
+	if (new_limit > m_limitExact && (double)m_inflight.load(std::memory_order_relaxed) < m_limitExact / 2)
+	{
+		new_limit = m_limitExact;
+	}
+	if (m_queueDepth && (double)m_queueDepth() > m_limitExact)
+	{
+		new_limit = std::min(new_limit, m_limitExact * 0.9);
+	}
+	m_limitExact = std::min(m_maxLimit, std::max(m_minLimit, 0.8 * m_limitExact + 0.2 * new_limit));
+	m_limit.store((int64_t)llround(m_limitExact), std::memory_order_relaxed);
+}
+
+std::string RpcAdmissionController::Dump() const
+{
+	double no_load = 0, last_avg = 0;
+	{
+		std::lock_guard<std::mutex> lk(m_updateMu);
+		no_load = m_noLoadUs;
+		last_avg = m_lastAvgUs;
+	}
+	char line[256];
+	snprintf(line, sizeof(line),
+			 "admission enabled=%d limit=%lld inflight=%lld rejected=%llu noload_us=%.0f last_avg_us=%.0f\n",
+			 m_enabled ? 1 : 0, (long long)m_limit.load(std::memory_order_relaxed),
+			 (long long)m_inflight.load(std::memory_order_relaxed),
+			 (unsigned long long)m_rejected.load(std::memory_order_relaxed), no_load, last_avg);
+	return line;
+}
@@ -0,0 +1,58 @@
+#include "rpcarena.h"
+#include <vector>
+
+namespace {
+// 初始块大小：覆盖绝大多数请求/响应，小消息的整个调用过程不会再malloc
+const size_t kInitialBlockSize = 8 * 1024;
+// 每个线程最多缓存的Arena数量
+const size_t kMaxCachedPerThread = 64;
+
+struct ArenaCache
+{
+	std::vector<RpcArena *> free_list;
+	~ArenaCache()
+	{
+		for (RpcArena *arena : free_list) delete arena;
+	}
+};
+thread_local ArenaCache t_cache;
+}
+
+google::protobuf::ArenaOptions RpcArena::MakeOptions(char *block, size_t size)
+{
+	google::protobuf::ArenaOptions options;
+	options.initial_block = block;
+	options.initial_block_size = size;
+	return options;
+}
+
+RpcArena::RpcArena()
+	: m_initialBlock(new char[kInitialBlockSize])
+	, m_arena(MakeOptions(m_initialBlock.get(), kInitialBlockSize))
+{
+}
+
+RpcArena *RpcArena::Acquire()
+{
+	auto &free_list = t_cache.free_list;
+	if (free_list.empty())
+	{
+		return new RpcArena();
+	}
+	RpcArena *arena = free_list.back();
+	free_list.pop_back();
+	return arena;
+}
+
+void RpcArena::Release(RpcArena *arena)
+{
+	if (arena == nullptr) return;
+	arena->m_arena.Reset();
+	auto &free_list = t_cache.free_list;
+	if (free_list.size() >= kMaxCachedPerThread)
+	{
+		delete arena;
+		return;
+	}
+	free_list.push_back(arena);
+}
@@ -0,0 +1,93 @@
+#include "rpccompress.h"
+#include "mprpcapplication.h"
+#include "rpcheader.pb.h"
+#include <algorithm>
+#ifdef MPRPC_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace {
+// 压缩帧解压后的上限，防止损坏或恶意的raw_size让接收方申请过大的内存
+const size_t kMaxRawSize = 64 * 1024 * 1024;
+
+/*
+压缩配置（均为可选项）：
+rpc_compression          是否声明并使用压缩，默认1，置0时既不压缩也不接收压缩帧
+rpc_compress_threshold   负载不小于多少字节才压缩，默认4096
+*/
+struct CompressConfig
+{
+	uint32_t accepted;
+	size_t threshold;
+};
+
+const CompressConfig &config()
+{
+	static const CompressConfig c = []() {
+		MprpcConfig &conf = MprpcApplication::GetConfig();
+		CompressConfig cc;
+		cc.accepted = 0;
+		if (conf.LoadInt("rpc_compression", 1) != 0)
+		{
+#ifdef MPRPC_HAVE_LZ4
+			cc.accepted |= 1u << mprpc::RPC_COMPRESS_LZ4;
+#endif
+		}
+		cc.threshold = (size_t)std::max(1, conf.LoadInt("rpc_compress_threshold", 4096));
+		return cc;
+	}();
+	return c;
+}
+}
+
+uint32_t RpcCompress::Accepted()
+{
+	return config().accepted;
+}
+
+uint32_t RpcCompress::Choose(uint32_t peer_accepted, size_t size)
+{
+	if (size < config().threshold) return mprpc::RPC_COMPRESS_NONE;
+	const uint32_t usable = peer_accepted & config().accepted;
+	if (usable & (1u << mprpc::RPC_COMPRESS_LZ4)) return mprpc::RPC_COMPRESS_LZ4;
+	return mprpc::RPC_COMPRESS_NONE;
+}
+
+bool RpcCompress::Compress(uint32_t codec, const char *data, size_t size, std::string *out)
+{
+#ifdef MPRPC_HAVE_LZ4
+	if (codec == mprpc::RPC_COMPRESS_LZ4 && size <= (size_t)LZ4_MAX_INPUT_SIZE)
+	{
+		out->resize((size_t)LZ4_compressBound((int)size));
+		const int n = LZ4_compress_default(data, &(*out)[0], (int)size, (int)out->size());
+		if (n <= 0 || (size_t)n >= size) return false;
+		out->resize((size_t)n);
+		return true;
+	}
+#else
+	(void)codec;
+	(void)data;
+	(void)size;
+	(void)out;
+#endif
+	return false;
+}
+
+bool RpcCompress::Decompress(uint32_t codec, const char *data, size_t size, size_t raw_size, std::string *out)
+{
+	if (raw_size > kMaxRawSize) return false;
+#ifdef MPRPC_HAVE_LZ4
+	if (codec == mprpc::RPC_COMPRESS_LZ4 && size <= (size_t)LZ4_MAX_INPUT_SIZE)
+	{
+		out->resize(raw_size);
+		const int n = LZ4_decompress_safe(data, &(*out)[0], (int)size, (int)raw_size);
+		return n >= 0 && (size_t)n == raw_size;
+	}
+#else
+	(void)codec;
+	(void)data;
+	(void)size;
+	(void)out;
+#endif
+	return false;
+}
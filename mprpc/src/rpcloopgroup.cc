@@ -0,0 +1,175 @@
+#include "rpcloopgroup.h"
+#include "mprpcapplication.h"
+#include "logger/logger.h"
+#include <muduo/net/TcpServer.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+
+namespace {
+// NUMA节点node上的核，读不到时返回空
+std::vector<int> NodeCpus(int node)
+{
+	std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string list;
+	if (!std::getline(in, list)) return {};
+	return RpcLoopGroup::ParseCpuList(list);
+}
+}
+
+std::vector<int> RpcLoopGroup::ConfiguredCores()
+{
+	MprpcConfig &conf = MprpcApplication::GetConfig();
+	std::vector<int> cpus = ParseCpuList(conf.Load("rpc_io_cores"));
+	const int node = conf.LoadInt("rpc_io_numa_node", -1);
+	if (cpus.empty() && node >= 0)
+	{
+		cpus = NodeCpus(node);
+		if (cpus.empty()) LOG_WARN << "RpcLoopGroup: no cpu found on numa node " << node;
+	}
+	int loops = conf.LoadInt("rpc_reuseport_loops", 0);
+	if (loops <= 0) loops = (int)cpus.size();
+
+	std::vector<int> cores;
+	for (int i = 0; i < loops; ++i)
+	{
+		cores.push_back(cpus.empty() ? -1 : cpus[(size_t)i % cpus.size()]);
+	}
+	return cores;
+}
+
+std::vector<int> RpcLoopGroup::ParseCpuList(const std::string &list)
+{
+	std::vector<int> cpus;
+	size_t pos = 0;
+	while (pos < list.size())
+	{
+		size_t end = list.find(',', pos);
+		if (end == std::string::npos) end = list.size();
+		const std::string item = list.substr(pos, end - pos);
+		pos = end + 1;
+
+		char *rest = nullptr;
+		long first = strtol(item.c_str(), &rest, 10);
+		if (rest == item.c_str() || first < 0) continue;
+		long last = first;
+		if (*rest == '-')
+		{
+			const char *from = rest + 1;
+			last = strtol(from, &rest, 10);
+			if (rest == from || last < first) continue;
+		}
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+		{
+			cpus.push_back((int)cpu);
+		}
+	}
+	return cpus;
+}
+
+int RpcLoopGroup::CpuNode(int core)
+{
+	// 核所属的节点在sysfs里表现为 cpuN/nodeM 目录项
+	const std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(core);
+	DIR *dir = ::opendir(path.c_str());
+	if (dir == nullptr) return -1;
+	int node = -1;
+	while (struct dirent *entry = ::readdir(dir))
+	{
+		if (::strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+		{
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	::closedir(dir);
+	return node;
+}
+
+RpcLoopGroup::RpcLoopGroup(const muduo::net::InetAddress &addr, const std::string &name, const std::vector<int> &cores)
+	: m_addr(addr), m_name(name), m_cores(cores), m_loops(cores.size(), nullptr)
+{
+}
+
+RpcLoopGroup::~RpcLoopGroup()
+{
+	Stop();
+}
+
+void RpcLoopGroup::Start()
+{
+	for (size_t i = 0; i < m_cores.size(); ++i)
+	{
+		m_threads.emplace_back([this, i]() { ThreadFunc(i); });
+	}
+	std::unique_lock<std::mutex> lk(m_mu);
+	m_cv.wait(lk, [this]() { return m_started == m_cores.size(); });
+}
+
+void RpcLoopGroup::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		for (muduo::net::EventLoop *loop : m_loops)
+		{
+			if (loop) loop->quit();
+		}
+	}
+	for (std::thread &t : m_threads)
+	{
+		if (t.joinable()) t.join();
+	}
+	m_threads.clear();
+}
+
+muduo::net::EventLoop *RpcLoopGroup::NextLoop()
+{
+	std::lock_guard<std::mutex> lk(m_mu);
+	muduo::net::EventLoop *loop = m_loops[m_next];
+	m_next = (m_next + 1) % m_loops.size();
+	return loop;
+}
+
+void RpcLoopGroup::ThreadFunc(size_t index)
+{
+	const int core = m_cores[index];
+	if (core >= 0)
+	{
+		// 先绑核再创建loop和TcpServer，之后这个线程上分配的内存都落在本地节点
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+		if (err != 0)
+		{
+			LOG_WARN << "RpcLoopGroup: bind loop " << index << " to cpu " << core << " failed, error: " << err;
+		}
+		else
+		{
+			LOG_INFO << "RpcLoopGroup: loop " << index << " on cpu " << core << " numa node " << CpuNode(core);
+		}
+	}
+
+	muduo::net::EventLoop loop;
+	muduo::net::TcpServer server(&loop, m_addr, m_name + "#" + std::to_string(index),
+								 muduo::net::TcpServer::kReusePort);
+	server.setConnectionCallback(m_connectionCallback);
+	server.setMessageCallback(m_messageCallback);
+	// 不再分IO线程：连接留在accept它的loop上
+	server.setThreadNum(0);
+	server.start();
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		m_loops[index] = &loop;
+		++m_started;
+	}
+	m_cv.notify_all();
+
+	loop.loop();
+
+	std::lock_guard<std::mutex> lk(m_mu);
+	m_loops[index] = nullptr;
+}
@@ -0,0 +1,233 @@
+#include "rpcmetrics.h"
+#include <stdio.h>
+#include <map>
+#include <thread>
+
+RpcLatencyHistogram::RpcLatencyHistogram()
+	: m_count(0), m_sum(0), m_max(0)
+{
+	for (auto &b : m_buckets)
+	{
+		b.store(0, std::memory_order_relaxed);
+	}
+}
+
+// [0, 8)每个值一个桶；之后每个2的幂区间[2^e, 2^(e+1))分成8个等宽的桶
+int RpcLatencyHistogram::BucketIndex(uint64_t us)
+{
+	if (us < (uint64_t)kSubBuckets) return (int)us;
+	int e = 63 - __builtin_clzll(us);
+	if (e > 31) return kBuckets - 1;
+	return (e - 2) * kSubBuckets + (int)((us >> (e - 3)) & (kSubBuckets - 1));
+}
+
+uint64_t RpcLatencyHistogram::BucketUpperBound(int index)
+{
+	if (index < kSubBuckets) return (uint64_t)index;
+	int e = index / kSubBuckets + 2;
+	uint64_t sub = (uint64_t)(index % kSubBuckets);
+	uint64_t width = 1ull << (e - 3);
+	return ((kSubBuckets + sub) << (e - 3)) + width - 1;
+}
+
+void RpcLatencyHistogram::Record(uint64_t us)
+{
+	m_buckets[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(us, std::memory_order_relaxed);
+	uint64_t cur = m_max.load(std::memory_order_relaxed);
+	while (us > cur && !m_max.compare_exchange_weak(cur, us, std::memory_order_relaxed))
+	{
+	}
+}
+
+void RpcLatencyHistogram::Reset()
+{
+	for (auto &b : m_buckets)
+	{
+		b.store(0, std::memory_order_relaxed);
+	}
+	m_count.store(0, std::memory_order_relaxed);
+	m_sum.store(0, std::memory_order_relaxed);
+	m_max.store(0, std::memory_order_relaxed);
+}
+
+void RpcLatencyHistogram::Snapshot::Merge(const RpcLatencyHistogram &h)
+{
+	if (buckets.empty()) buckets.assign(kBuckets, 0);
+	for (int i = 0; i < kBuckets; ++i)
+	{
+		buckets[i] += h.m_buckets[i].load(std::memory_order_relaxed);
+	}
+	count += h.m_count.load(std::memory_order_relaxed);
+	sum += h.m_sum.load(std::memory_order_relaxed);
+	uint64_t m = h.m_max.load(std::memory_order_relaxed);
+	if (m > max) max = m;
+}
+
+uint64_t RpcLatencyHistogram::Snapshot::Percentile(double q) const
+{
+	if (count == 0 || buckets.empty()) return 0;
+	// 各计数不是同一时刻读到的，按桶的总数而不是count来算排名
+	uint64_t total = 0;
+	for (uint64_t b : buckets) total += b;
+	uint64_t rank = (uint64_t)(q * (double)total);
+	if (rank >= total) rank = total - 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < kBuckets; ++i)
+	{
+		seen += buckets[i];
+		if (seen > rank)
+		{
+			uint64_t upper = BucketUpperBound(i);
+			return upper < max ? upper : max;
+		}
+	}
+	return max;
+}
+
+RpcMethodMetrics::RpcMethodMetrics(const std::string &name)
+	: m_name(name), m_shards(new Shard[kShards]), m_inflight(0)
+{
+}
+
+RpcMethodMetrics::Shard &RpcMethodMetrics::LocalShard()
+{
+	// 每个线程第一次记录时按轮询分到一个分片，之后固定不变
+	static std::atomic<unsigned> s_next{0};
+	thread_local unsigned t_shard = s_next.fetch_add(1, std::memory_order_relaxed) % kShards;
+	return m_shards[t_shard];
+}
+
+void RpcMethodMetrics::OnStart()
+{
+	LocalShard().requests.fetch_add(1, std::memory_order_relaxed);
+	m_inflight.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RpcMethodMetrics::OnFinish(bool ok, const RpcCallTiming &timing)
+{
+	m_inflight.fetch_sub(1, std::memory_order_relaxed);
+	Shard &shard = LocalShard();
+	if (!ok)
+	{
+		shard.errors.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	using Clock = RpcCallTiming::Clock;
+	const Clock::time_point end = Clock::now();
+	const Clock::time_point unset;
+	auto record = [&shard](Phase phase, Clock::time_point from, Clock::time_point to) {
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+		shard.phases[phase].Record(us > 0 ? (uint64_t)us : 0);
+	};
+	if (timing.decoded != unset)
+	{
+		record(kDecode, timing.start, timing.decoded);
+	}
+	if (timing.handlerStart != unset)
+	{
+		record(kQueue, timing.decoded, timing.handlerStart);
+	}
+	if (timing.handlerEnd != unset)
+	{
+		record(kHandler, timing.handlerStart, timing.handlerEnd);
+		record(kSerialize, timing.handlerEnd, end);
+	}
+	record(kTotal, timing.start, end);
+}
+
+RpcMethodMetrics::Snapshot RpcMethodMetrics::Collect() const
+{
+	Snapshot snap;
+	for (int i = 0; i < kShards; ++i)
+	{
+		const Shard &shard = m_shards[i];
+		snap.requests += shard.requests.load(std::memory_order_relaxed);
+		snap.errors += shard.errors.load(std::memory_order_relaxed);
+		for (int p = 0; p < kPhaseCount; ++p)
+		{
+			snap.phases[p].Merge(shard.phases[p]);
+		}
+	}
+	snap.inflight = m_inflight.load(std::memory_order_relaxed);
+	return snap;
+}
+
+RpcMetrics::RpcMetrics()
+	: m_unrouted(0), m_lastDump(RpcCallTiming::Clock::now())
+{
+}
+
+RpcMethodMetrics *RpcMetrics::Register(const std::string &full_name)
+{
+	m_methods.emplace_back(new RpcMethodMetrics(full_name));
+	m_lastRequests.push_back(0);
+	return m_methods.back().get();
+}
+
+std::string RpcMetrics::Dump()
+{
+	static const char *kPhaseNames[RpcMethodMetrics::kPhaseCount] = {"decode", "queue", "handler", "serialize", "total"};
+
+	std::lock_guard<std::mutex> lk(m_dumpMu);
+	const RpcCallTiming::Clock::time_point now = RpcCallTiming::Clock::now();
+	double elapsed = std::chrono::duration<double>(now - m_lastDump).count();
+	if (elapsed <= 0) elapsed = 1e-9;
+	m_lastDump = now;
+
+	// 先按方法收集，再按服务汇总（方法名形如 Service.Method）
+	struct ServiceTotal
+	{
+		uint64_t requests = 0;
+		uint64_t errors = 0;
+		int64_t inflight = 0;
+		double qps = 0;
+	};
+	std::map<std::string, ServiceTotal> services;
+	std::string methods;
+	char line[512];
+	for (size_t i = 0; i < m_methods.size(); ++i)
+	{
+		const RpcMethodMetrics &m = *m_methods[i];
+		RpcMethodMetrics::Snapshot snap = m.Collect();
+		double qps = (double)(snap.requests - m_lastRequests[i]) / elapsed;
+		m_lastRequests[i] = snap.requests;
+
+		ServiceTotal &st = services[m.Name().substr(0, m.Name().find('.'))];
+		st.requests += snap.requests;
+		st.errors += snap.errors;
+		st.inflight += snap.inflight;
+		st.qps += qps;
+
+		snprintf(line, sizeof(line), "method %s requests=%llu errors=%llu inflight=%lld qps=%.1f\n",
+				 m.Name().c_str(), (unsigned long long)snap.requests, (unsigned long long)snap.errors,
+				 (long long)snap.inflight, qps);
+		methods += line;
+		for (int p = 0; p < RpcMethodMetrics::kPhaseCount; ++p)
+		{
+			const RpcLatencyHistogram::Snapshot &h = snap.phases[p];
+			if (h.count == 0) continue;
+			snprintf(line, sizeof(line),
+					 "  %-9s count=%llu avg=%lluus p50=%lluus p90=%lluus p99=%lluus p999=%lluus max=%lluus\n",
+					 kPhaseNames[p], (unsigned long long)h.count, (unsigned long long)(h.sum / h.count),
+					 (unsigned long long)h.Percentile(0.5), (unsigned long long)h.Percentile(0.9),
+					 (unsigned long long)h.Percentile(0.99), (unsigned long long)h.Percentile(0.999),
+					 (unsigned long long)h.max);
+			methods += line;
+		}
+	}
+
+	std::string out;
+	for (const auto &kv : services)
+	{
+		snprintf(line, sizeof(line), "service %s requests=%llu errors=%llu inflight=%lld qps=%.1f\n",
+				 kv.first.c_str(), (unsigned long long)kv.second.requests, (unsigned long long)kv.second.errors,
+				 (long long)kv.second.inflight, kv.second.qps);
+		out += line;
+	}
+	snprintf(line, sizeof(line), "unrouted_errors=%llu\n", (unsigned long long)m_unrouted.load(std::memory_order_relaxed));
+	out += line;
+	out += methods;
+	return out;
+}
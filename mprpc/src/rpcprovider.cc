@@ -1,8 +1,50 @@
 #include "rpcprovider.h"
 #include "mprpcapplication.h"
+#include "mprpcclosure.h"
+#include "mprpccontroller.h"
+#include "mprpcconnectionpool.h"
+#include "rpccompress.h"
+#include "rpctrace.h"
+#include "rpcloopgroup.h"
+#include "rpcunixacceptor.h"
 #include "rpcheader.pb.h"
 #include "logger/logger.h"
 #include "zookeeperutil.h"
+#include <algorithm>
+#include <signal.h>
+#include <string.h>
+
+namespace {
+// 收到SIGTERM/SIGINT，信号处理函数里只置位，由主loop上的定时器发起下线
+std::atomic<bool> g_shutdownSignal{false};
+
+void OnShutdownSignal(int)
+{
+	g_shutdownSignal.store(true, std::memory_order_relaxed);
+}
+
+// 写合并：每个IO线程上本轮loop待发出的帧，按连接归并，保持各连接第一次出现的顺序
+struct PendingReplies
+{
+	std::vector<std::pair<muduo::net::TcpConnectionPtr, muduo::net::Buffer>> m_replies;
+	std::unordered_map<const muduo::net::TcpConnection *, size_t> m_index;
+	bool m_flushQueued = false;
+};
+thread_local PendingReplies t_pendingReplies;
+
+// 由queueInLoop排在本轮回调之后执行，每个连接一次send
+void FlushReplies()
+{
+	PendingReplies &pending = t_pendingReplies;
+	for (auto &reply : pending.m_replies)
+	{
+		reply.first->send(&reply.second);
+	}
+	pending.m_replies.clear();
+	pending.m_index.clear();
+	pending.m_flushQueued = false;
+}
+}
 
 /*
 service_name => service描述
@@ -12,11 +54,20 @@ json(文本)	protobuf(二进制，效率高，有用信息多，rpc方法的描
 */
 // 这里是框架提供给外部使用的，可以发布rpc方法的函数接口
 void RpcProvider::NotifyService(google::protobuf::Service *service)
+{
+	RegisterService(service->GetDescriptor(), service, nullptr);
+}
+
+void RpcProvider::NotifyService(RpcStaticService *service)
+{
+	RegisterService(service->GetDescriptor(), nullptr, service);
+}
+
+void RpcProvider::RegisterService(const google::protobuf::ServiceDescriptor *pserviceDesc,
+								  google::protobuf::Service *service, RpcStaticService *static_service)
 {
 	ServiceInfo service_info;
 
-	// 获取了服务对象的描述信息
-	const google::protobuf::ServiceDescriptor *pserviceDesc = service->GetDescriptor();
 	// 获取服务的名字
 	std::string service_name = pserviceDesc->name();
 	// 获取服务对象service的方法的数量
@@ -30,7 +81,9 @@ void RpcProvider::NotifyService(google::protobuf::Service *service)
 		// 获取了服务对象指定下标的服务方法的描述（抽象描述）
 		const google::protobuf::MethodDescriptor *pmethodDesc = pserviceDesc->method(i);
 		std::string method_name = pmethodDesc->name();
-		service_info.m_methodMap.insert({method_name, pmethodDesc});
+		MethodInfo method_info;
+		method_info.m_method = pmethodDesc;
+		service_info.m_methodMap.insert({method_name, method_info});
 
 			LOG_DEBUG << "method_name: " << method_name;
 		// LOG_INFO("method_name: %s", method_name.c_str());
@@ -38,9 +91,43 @@ void RpcProvider::NotifyService(google::protobuf::Service *service)
 	service_info.m_service = service;
 	service_info.m_service_owner.reset(); // 不拥有所有权
 	LOG_INFO << "service_name: " << service_name << " method_count: " << methodCnt;
-	m_serviceMap.emplace(service_name, std::move(service_info));
+	auto res = m_serviceMap.emplace(service_name, std::move(service_info));
+	if (!res.second)
+	{
+		LOG_ERROR << "service_name: " << service_name << " is already registered!";
+		return;
+	}
+
+	// 为每个方法分配一个紧凑的数字id（下标即id，0保留），客户端学到id后按下标直接分发
+	for (auto &mp : res.first->second.m_methodMap)
+	{
+		mp.second.m_service = service;
+		mp.second.m_static = static_service;
+		mp.second.m_methodId = (uint32_t)m_methodTable.size();
+		mp.second.m_metrics = m_metrics.Register(service_name + "." + mp.first);
+		m_methodTable.push_back(&mp.second);
+	}
 }
 
+void RpcProvider::NotifyStreamMethod(google::protobuf::Service *service, const std::string &method_name,
+									 StreamHandler handler)
+{
+	const std::string &service_name = service->GetDescriptor()->name();
+	auto it = m_serviceMap.find(service_name);
+	if (it == m_serviceMap.end() || it->second.m_service != service)
+	{
+		LOG_ERROR << "NotifyStreamMethod: service " << service_name << " is not registered by NotifyService";
+		return;
+	}
+	auto mit = it->second.m_methodMap.find(method_name);
+	if (mit == it->second.m_methodMap.end())
+	{
+		LOG_ERROR << "NotifyStreamMethod: " << service_name << "." << method_name << " is not exist!";
+		return;
+	}
+	mit->second.m_streamHandler = std::move(handler);
+	LOG_INFO << "stream method: " << service_name << "." << method_name;
+}
 
 // 启动rpc服务节点，开始提供rpc远程网络调用服务
 void RpcProvider::Run()
@@ -52,15 +139,72 @@ void RpcProvider::Run()
 
 	LOG_INFO << "ip: " << ip << " port: " << port;
 
-	// 创建TcpServer对象
-	muduo::net::TcpServer server(&m_eventLoop, address, "RpcProvider");
-	// 绑定连接回调和消息读写回调方法	分离了网络代码和业务代码
-	server.setConnectionCallback(std::bind(&RpcProvider::OnConnection, this, std::placeholders::_1));
-	server.setMessageCallback(std::bind(&RpcProvider::OnMessage, this, std::placeholders::_1,
-										std::placeholders::_2, std::placeholders::_3));
+	m_coalesceReplies = MprpcApplication::GetConfig().LoadInt("rpc_write_coalesce", 0) != 0;
+	SetupExecutors();
+	SetupAdmission();
+
+	// 同一进程内的调用方直接调用这里的服务，配置项 rpc_local_shortcut（默认1，置0时本进程内也走网络）
+	if (MprpcApplication::GetConfig().LoadInt("rpc_local_shortcut", 1) != 0)
+	{
+		RegisterLocalTargets();
+	}
+
+	// 默认一个TcpServer：主loop accept，连接分给io_threads个IO线程
+	// 配置了多acceptor模式（见RpcLoopGroup::ConfiguredCores）时改为每个核一个带SO_REUSEPORT监听的loop
+	std::unique_ptr<muduo::net::TcpServer> server;
+	std::unique_ptr<RpcLoopGroup> loop_group;
+	std::function<muduo::net::EventLoop *()> next_io_loop;
+	const std::vector<int> loop_cores = RpcLoopGroup::ConfiguredCores();
+	if (!loop_cores.empty())
+	{
+		loop_group.reset(new RpcLoopGroup(address, "RpcProvider", loop_cores));
+		loop_group->setConnectionCallback(std::bind(&RpcProvider::OnConnection, this, std::placeholders::_1));
+		loop_group->setMessageCallback(std::bind(&RpcProvider::OnMessage, this, std::placeholders::_1,
+												 std::placeholders::_2, std::placeholders::_3));
+		// 先开始监听再注册到zk，调用方发现实例时连接已经可以建立
+		loop_group->Start();
+		next_io_loop = [&loop_group]() { return loop_group->NextLoop(); };
+		LOG_INFO << "RpcProvider: " << loop_cores.size() << " reuseport loops";
+	}
+	else
+	{
+		// 创建TcpServer对象
+		server.reset(new muduo::net::TcpServer(&m_eventLoop, address, "RpcProvider"));
+		// 绑定连接回调和消息读写回调方法	分离了网络代码和业务代码
+		server->setConnectionCallback(std::bind(&RpcProvider::OnConnection, this, std::placeholders::_1));
+		server->setMessageCallback(std::bind(&RpcProvider::OnMessage, this, std::placeholders::_1,
+											 std::placeholders::_2, std::placeholders::_3));
 
-	// 设置muduo库的线程数量
-	server.setThreadNum(4);
+		// 设置muduo库的IO线程数量，业务处理交给线程池
+		int io_threads = MprpcApplication::GetConfig().LoadInt("io_threads", 4);
+		server->setThreadNum(io_threads);
+		// 先开始监听再注册到zk，调用方发现实例时连接已经可以建立（loop启动前的连接在backlog里排队）
+		server->start();
+		std::shared_ptr<muduo::net::EventLoopThreadPool> io_loops = server->threadPool();
+		next_io_loop = [io_loops]() { return io_loops->getNextLoop(); };
+	}
+
+	// 同机的调用方优先走unix域socket，路径随实例一起公布在zk节点的数据里
+	// 配置项 rpc_unix_socket（默认1，置0关闭）、rpc_unix_dir（默认/tmp）
+	std::unique_ptr<RpcUnixAcceptor> unix_acceptor;
+	if (MprpcApplication::GetConfig().LoadInt("rpc_unix_socket", 1) != 0)
+	{
+		std::string dir = MprpcApplication::GetConfig().Load("rpc_unix_dir");
+		if (dir.empty()) dir = "/tmp";
+		unix_acceptor.reset(new RpcUnixAcceptor(&m_eventLoop, dir + "/mprpc-" + std::to_string(port) + ".sock",
+												next_io_loop));
+		unix_acceptor->setConnectionCallback(std::bind(&RpcProvider::OnConnection, this, std::placeholders::_1));
+		unix_acceptor->setMessageCallback(std::bind(&RpcProvider::OnMessage, this, std::placeholders::_1,
+													std::placeholders::_2, std::placeholders::_3));
+		if (unix_acceptor->Listen())
+		{
+			LOG_INFO << "RpcProvider listen on unix socket " << unix_acceptor->Path();
+		}
+		else
+		{
+			unix_acceptor.reset();
+		}
+	}
 
 	// 把当前rpc节点上要发布的服务全部注册到zk上面， 让rpc client可以从zk上发现服务
 	LOG_INFO << "Starting ZooKeeper client...";
@@ -68,8 +212,18 @@ void RpcProvider::Run()
 	zkCli.Start();
 	LOG_INFO << "ZooKeeper client started successfully";
 	
-	// service_name为永久性节点  method_name为临时性节点
+	// service_name、method_name为永久性节点，每个提供者实例在method下挂一个 ip:port 临时子节点
+	// 同一个方法可以有多个实例，客户端监听子节点列表并做负载均衡
 	// session timeout  30s   zkclient 网络io线程	1/3 * timeout 时间发送ping消息
+	char instance[128] = {0};
+	sprintf(instance, "%s:%d", ip.c_str(), port); // ip:port
+	// 节点数据：ip:port [unix=<path>]，子节点名仍然是ip:port，不认识unix的调用方照常走TCP
+	std::string instance_data = instance;
+	if (unix_acceptor)
+	{
+		instance_data += " unix=" + unix_acceptor->Path();
+	}
+	std::vector<std::string> instance_paths; // 下线时先删除这些临时节点
 	for (auto &sp : m_serviceMap)
 	{
 		// /service_name
@@ -81,11 +235,16 @@ void RpcProvider::Run()
 		{
 			// /service_name/method_name
 			std::string method_path = service_path + "/" + mp.first;
-			char method_path_data[128] = {0};
-			sprintf(method_path_data, "%s:%d", ip.c_str(), port); // ip:port
-						LOG_DEBUG << "Creating method path: " << method_path << " with data: " << method_path_data;
+			zkCli.Create(method_path.c_str(), nullptr, 0); // 创建永久性节点
+
+			// /service_name/method_name/ip:port
+			std::string instance_path = method_path + "/" + instance;
+						LOG_DEBUG << "Creating instance path: " << instance_path;
+			// 快速重启时上一个进程的临时节点可能还没随旧会话过期，先删掉再用当前会话重建，否则旧会话过期时会把它带走
+			zkCli.Delete(instance_path.c_str());
 			// ZOO_EPHEMERAL表示是一个临时性的结点
-			zkCli.Create(method_path.c_str(), method_path_data, strlen(method_path_data), ZOO_EPHEMERAL); // 创建临时性节点
+			zkCli.Create(instance_path.c_str(), instance_data.c_str(), (int)instance_data.size(), ZOO_EPHEMERAL); // 创建临时性节点
+			instance_paths.push_back(instance_path);
 		}
 	}
 	
@@ -93,9 +252,245 @@ void RpcProvider::Run()
 
 	LOG_INFO << "RpcProvider start service at ip:" << ip << " port:" << port;
 
+	// 可选的统计端口：curl http://ip:stats_port/ 或 nc 即可拿到文本格式的调用统计
+	std::unique_ptr<muduo::net::TcpServer> stats_server;
+	int stats_port = MprpcApplication::GetConfig().LoadInt("stats_port", 0);
+	if (stats_port > 0)
+	{
+		stats_server.reset(new muduo::net::TcpServer(&m_eventLoop, muduo::net::InetAddress(ip, (uint16_t)stats_port),
+													 "RpcProviderStats"));
+		stats_server->setMessageCallback(std::bind(&RpcProvider::OnStatsMessage, this, std::placeholders::_1,
+												   std::placeholders::_2, std::placeholders::_3));
+		stats_server->start();
+		LOG_INFO << "RpcProvider stats at ip:" << ip << " port:" << stats_port;
+	}
+
+	// 下线检查的定时器只在需要时注册：Shutdown时注册；接管信号时信号处理函数只能置标志，需要一直轮询
+	m_drainTick = std::bind(&RpcProvider::OnDrainTick, this, std::ref(zkCli), std::cref(instance_paths),
+							unix_acceptor.get());
+	if (MprpcApplication::GetConfig().LoadInt("rpc_drain_on_signal", 0) != 0)
+	{
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = OnShutdownSignal;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGTERM, &sa, nullptr);
+		sigaction(SIGINT, &sa, nullptr);
+		StartDrainTimer();
+	}
+
+	if (m_readyCallback)
+	{
+		m_eventLoop.queueInLoop(m_readyCallback);
+	}
+
 	// 启动服务
-	server.start();
 	m_eventLoop.loop();
+
+	// 之后本进程内的调用方改走网络（实例已经下线，调用方会得到连接错误），已经开始的本地调用由线程池执行完
+	UnregisterLocalTargets();
+
+	// 下线流程走完：业务线程池把剩余任务执行完后退出，连接和zk会话随局部对象一起关闭
+	for (auto &pool : m_executors)
+	{
+		pool->Stop();
+	}
+	// 业务线程已经全部结束，把这次运行中采样的span写入文件，进程随后退出时不丢最后一批
+	RpcTracer::GetInstance().FlushNow();
+	// unix域socket上的连接要在IO线程停止之前销毁（见~RpcUnixAcceptor），TCP连接由server/loop_group自己销毁
+	unix_acceptor.reset();
+	// 多acceptor模式的loop线程不随主loop退出，在这里停掉；之后各loop上不会再有回调
+	if (loop_group)
+	{
+		loop_group->Stop();
+	}
+	LOG_INFO << "RpcProvider stopped at ip:" << ip << " port:" << port;
+}
+
+void RpcProvider::StartLocal()
+{
+	SetupExecutors();
+	SetupAdmission();
+	RegisterLocalTargets();
+}
+
+void RpcProvider::StopLocal()
+{
+	UnregisterLocalTargets();
+	for (auto &pool : m_executors)
+	{
+		pool->Stop();
+	}
+}
+
+void RpcProvider::RegisterLocalTargets()
+{
+	for (auto &sp : m_serviceMap)
+	{
+		auto target = std::make_shared<LocalTarget>(this, &sp.second);
+		MprpcLocalRegistry::GetInstance().Register(sp.first, target);
+		m_localTargets.emplace_back(sp.first, std::move(target));
+	}
+}
+
+void RpcProvider::UnregisterLocalTargets()
+{
+	for (auto &target : m_localTargets)
+	{
+		MprpcLocalRegistry::GetInstance().Unregister(target.first, target.second.get());
+	}
+	m_localTargets.clear();
+}
+
+void RpcProvider::Shutdown()
+{
+	m_shutdownRequested.store(true, std::memory_order_relaxed);
+	// Run之前调用时，排队的任务在loop启动后执行，那时m_drainTick已经设置好
+	m_eventLoop.runInLoop(std::bind(&RpcProvider::StartDrainTimer, this));
+}
+
+void RpcProvider::StartDrainTimer()
+{
+	if (m_drainTimerStarted || !m_drainTick) return;
+	m_drainTimerStarted = true;
+	m_eventLoop.runEvery(0.1, m_drainTick);
+}
+
+void RpcProvider::OnDrainTick(ZkClient &zk, const std::vector<std::string> &instance_paths,
+							  RpcUnixAcceptor *unix_acceptor)
+{
+	if (m_drainQuit)
+	{
+		m_eventLoop.quit();
+		return;
+	}
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (!m_draining.load(std::memory_order_relaxed))
+	{
+		if (!m_shutdownRequested.load(std::memory_order_relaxed) && !g_shutdownSignal.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+		// 先从zk摘除：调用方的watch随即触发，之后新的调用不会再选到本实例
+		for (const std::string &path : instance_paths)
+		{
+			zk.Delete(path.c_str());
+		}
+		m_drainStart = now;
+		m_draining.store(true, std::memory_order_relaxed);
+		LOG_INFO << "RpcProvider draining, inflight: " << m_admission.Inflight();
+		return;
+	}
+
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	const std::chrono::milliseconds grace(std::max(0, config.LoadInt("rpc_drain_grace_ms", 2000)));
+	const std::chrono::milliseconds timeout(std::max(0, config.LoadInt("rpc_drain_timeout_ms", 30000)));
+	// 宽限期内照常处理，新连接也照常接受：还没刷新实例列表的调用方仍可能连过来
+	if (now - m_drainStart < grace) return;
+	if (!m_refuseConnections.load(std::memory_order_relaxed))
+	{
+		// 宽限期结束后拒绝新连接；unix域socket不经过TcpServer，单独停止监听，已经建立的连接照常处理到下线结束
+		m_refuseConnections.store(true, std::memory_order_relaxed);
+		if (unix_acceptor)
+		{
+			unix_acceptor->StopListening();
+		}
+	}
+	const int64_t inflight = m_admission.Inflight();
+	if (inflight > 0 && now - m_drainStart < timeout) return;
+	if (inflight > 0)
+	{
+		LOG_WARN << "RpcProvider drain timeout, " << inflight << " calls still in flight";
+	}
+	else
+	{
+		LOG_INFO << "RpcProvider drained";
+	}
+	m_drainQuit = true;
+}
+
+/*
+业务线程池配置（均为可选项）：
+worker_threads / worker_queue_size                         默认池，worker_threads=0 表示直接在IO线程上执行
+worker_threads.<Service> / worker_queue_size.<Service>     服务独占的线程池
+worker_threads.<Service>.<Method> / worker_queue_size.<Service>.<Method>   方法独占的线程池
+*/
+void RpcProvider::SetupExecutors()
+{
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	const int default_threads = config.LoadInt("worker_threads", 8);
+	const int default_queue = config.LoadInt("worker_queue_size", 10000);
+
+	auto create = [this](const std::string &name, int threads, int queue_size) {
+		m_executors.emplace_back(new RpcThreadPool(name, threads, (size_t)queue_size));
+		m_executors.back()->Start();
+		return m_executors.back().get();
+	};
+
+	RpcThreadPool *default_pool = nullptr;
+	if (default_threads > 0)
+	{
+		default_pool = create("default", default_threads, default_queue);
+	}
+
+	for (auto &sp : m_serviceMap)
+	{
+		const std::string &service_name = sp.first;
+		RpcThreadPool *service_pool = default_pool;
+		int service_threads = config.LoadInt("worker_threads." + service_name, 0);
+		if (service_threads > 0)
+		{
+			int queue_size = config.LoadInt("worker_queue_size." + service_name, default_queue);
+			service_pool = create(service_name, service_threads, queue_size);
+		}
+
+		for (auto &mp : sp.second.m_methodMap)
+		{
+			const std::string key = service_name + "." + mp.first;
+			int method_threads = config.LoadInt("worker_threads." + key, 0);
+			if (method_threads > 0)
+			{
+				int queue_size = config.LoadInt("worker_queue_size." + key, default_queue);
+				mp.second.m_executor = create(key, method_threads, queue_size);
+			}
+			else
+			{
+				mp.second.m_executor = service_pool;
+			}
+		}
+	}
+
+	// 流式方法的Write会等待客户端的流控帧，不能在IO线程上执行；没有分到线程池的流式方法共用一个
+	RpcThreadPool *stream_pool = nullptr;
+	for (auto &sp : m_serviceMap)
+	{
+		for (auto &mp : sp.second.m_methodMap)
+		{
+			if (!mp.second.m_streamHandler || mp.second.m_executor != nullptr) continue;
+			if (stream_pool == nullptr)
+			{
+				stream_pool = create("stream", std::max(1, config.LoadInt("stream_worker_threads", 4)), default_queue);
+			}
+			mp.second.m_executor = stream_pool;
+		}
+	}
+}
+
+void RpcProvider::SetupAdmission()
+{
+	for (auto &sp : m_serviceMap)
+	{
+		for (auto &mp : sp.second.m_methodMap)
+		{
+			mp.second.m_priority = RpcAdmissionController::LoadPriority(sp.first, mp.first);
+		}
+	}
+	// 排队长度取所有业务线程池之和，每个统计窗口只读一次
+	m_admission.Init([this]() {
+		size_t depth = 0;
+		for (auto &pool : m_executors) depth += pool->QueueSize();
+		return depth;
+	});
 }
 
 // 新的socket连接回调
@@ -103,9 +498,22 @@ void RpcProvider::OnConnection(const muduo::net::TcpConnectionPtr &conn)
 {
 	if (!conn->connected())
 	{
-		// 和rpc client的连接断开了
+		// 和rpc client的连接断开了，这条连接上还在写的流全部取消，handler的Write随即返回false
+		{
+			std::lock_guard<std::mutex> lk(m_streamMu);
+			for (auto it = m_streams.lower_bound(StreamKey(conn.get(), 0));
+				 it != m_streams.end() && it->first.first == conn.get(); ++it)
+			{
+				it->second->Cancel();
+			}
+		}
 		conn->shutdown();
 	}
+	else if (m_refuseConnections.load(std::memory_order_relaxed))
+	{
+		// 下线宽限期过后不再接受新连接，调用方在实例列表刷新后会改连其他实例
+		conn->forceClose();
+	}
 	else
 	{
 		// 连接建立后关闭Nagle，降低往返延迟
@@ -126,6 +534,7 @@ void RpcProvider::OnMessage(const muduo::net::TcpConnectionPtr &conn,
 							muduo::net::Buffer *buffer, muduo::Timestamp)
 {
 	// 基于长度字段的帧解析：当数据不足时返回，等待下一次回调
+	// header和args都直接从Buffer的可读区解析，不再先拷贝成std::string
 	while (true)
 	{
 		if (buffer->readableBytes() < 4) break;
@@ -133,11 +542,11 @@ void RpcProvider::OnMessage(const muduo::net::TcpConnectionPtr &conn,
 		uint32_t header_size = 0;
 		::memcpy(&header_size, buffer->peek(), 4);
 		if (buffer->readableBytes() < (size_t)(4 + header_size)) break;
-		std::string rpc_header_str(buffer->peek() + 4, buffer->peek() + 4 + header_size);
 		mprpc::RpcHeader rpcHeader;
-		if (!rpcHeader.ParseFromString(rpc_header_str))
+		if (!rpcHeader.ParseFromArray(buffer->peek() + 4, (int)header_size))
 		{
-			LOG_ERROR << "rpc_header_str ParseFromString failed!";
+			LOG_ERROR << "rpc header ParseFromArray failed!";
+			m_metrics.OnUnroutedError();
 			// 丢弃此帧，以免粘连阻塞
 			buffer->retrieve(4 + header_size);
 			continue;
@@ -146,87 +555,606 @@ void RpcProvider::OnMessage(const muduo::net::TcpConnectionPtr &conn,
 		size_t total = 4 + header_size + args_size;
 		if (buffer->readableBytes() < total) break;
 
-		std::string service_name = rpcHeader.service_name();
-		std::string method_name = rpcHeader.method_name();
-		std::string args_str(buffer->peek() + 4 + header_size, buffer->peek() + total);
+		HandleRequest(conn, rpcHeader, buffer->peek() + 4 + header_size, args_size);
 		buffer->retrieve(total);
+	}
+}
+
+// 处理一个完整的请求帧，args指向Buffer中的参数区，只在本函数内有效
+void RpcProvider::HandleRequest(const muduo::net::TcpConnectionPtr &conn, const mprpc::RpcHeader &rpcHeader,
+								const char *args, size_t args_size, RpcBatch *batch)
+{
+	if (batch == nullptr && (rpcHeader.stream_credit() != 0 || rpcHeader.stream_cancel()))
+	{
+		OnStreamControl(conn, rpcHeader);
+		return;
+	}
+	if (rpcHeader.batch_count() != 0)
+	{
+		if (batch == nullptr)
+		{
+			HandleBatch(conn, rpcHeader, args, args_size);
+		}
+		else
+		{
+			m_metrics.OnUnroutedError();
+			SendRpcError(conn, rpcHeader.request_id(), mprpc::RPC_BAD_REQUEST, "nested batch is not allowed", batch);
+		}
+		return;
+	}
+	const RpcCallTiming::Clock::time_point start = RpcCallTiming::Clock::now();
+	uint64_t request_id = rpcHeader.request_id();
+	const MethodInfo *minfo = nullptr;
 
-		// 获取service和method
-			LOG_DEBUG << "Processing RPC call: " << service_name << "." << method_name;
-		
+	if (rpcHeader.method_id() != 0)
+	{
+		// 紧凑模式：按数字id直接下标取方法，不做字符串查找
+		if (rpcHeader.method_id() < m_methodTable.size())
+		{
+			minfo = m_methodTable[rpcHeader.method_id()];
+		}
+		if (minfo == nullptr)
+		{
+					LOG_ERROR << "method_id: " << rpcHeader.method_id() << " is not exist!";
+			m_metrics.OnUnroutedError();
+			SendRpcError(conn, request_id, mprpc::RPC_NO_METHOD, "method_id " + std::to_string(rpcHeader.method_id()) + " is not exist!", batch);
+			return;
+		}
+	}
+	else
+	{
+		const std::string &service_name = rpcHeader.service_name();
+		const std::string &method_name = rpcHeader.method_name();
 		auto it = m_serviceMap.find(service_name);
 		if (it == m_serviceMap.end())
 		{
 					LOG_ERROR << "service_name: " << service_name << " is not exist!";
-			continue;
+			m_metrics.OnUnroutedError();
+			SendRpcError(conn, request_id, mprpc::RPC_NO_SERVICE, service_name + " is not exist!", batch);
+			return;
 		}
 		auto mit = it->second.m_methodMap.find(method_name);
 		if (mit == it->second.m_methodMap.end())
 		{
 					LOG_ERROR << "method_name: " << method_name << " is not exist!";
-			continue;
+			m_metrics.OnUnroutedError();
+			SendRpcError(conn, request_id, mprpc::RPC_NO_METHOD, service_name + "." + method_name + " is not exist!", batch);
+			return;
 		}
+		minfo = &mit->second;
+	}
+
+	google::protobuf::Service *service = minfo->m_service;
+	const google::protobuf::MethodDescriptor *method = minfo->m_method;
+	RpcThreadPool *executor = minfo->m_executor;
+	RpcMethodMetrics *metrics = minfo->m_metrics;
+	const bool streaming = rpcHeader.stream_window() != 0;
+	if (streaming && batch != nullptr)
+	{
+		// 流式调用的响应要分多帧发出，不能放进批量响应
+		m_metrics.OnUnroutedError();
+		SendRpcError(conn, request_id, mprpc::RPC_BAD_REQUEST, method->full_name() + " can not be called in a batch", batch);
+		return;
+	}
+	if (streaming != (bool)minfo->m_streamHandler)
+	{
+		// 流式方法只能流式调用，反之亦然
+		LOG_ERROR << method->full_name() << (streaming ? " is not a stream method" : " is a stream method");
+		m_metrics.OnUnroutedError();
+		SendRpcError(conn, request_id, mprpc::RPC_NO_METHOD,
+					 method->full_name() + (streaming ? " is not a stream method" : " must be called as a stream"), batch);
+		return;
+	}
+	metrics->OnStart();
+
+	// 准入控制：超过当前并发上限时立即拒绝，不解析参数、不占用业务线程
+	if (!m_admission.TryAcquire(minfo->m_priority))
+	{
+		RpcCallTiming timing;
+		timing.start = start;
+		metrics->OnFinish(false, timing);
+		SendRpcError(conn, request_id, mprpc::RPC_OVERLOADED, "server overloaded: " + method->full_name() + " rejected", batch);
+		return;
+	}
+
+	// 已定位到service和method
+		LOG_DEBUG << "Processing RPC call: " << method->full_name() << " request_id: " << request_id;
 
-		google::protobuf::Service *service = it->second.m_service;
-		const google::protobuf::MethodDescriptor *method = mit->second;
+	// 每次调用从当前IO线程的缓存里取一个Arena，上下文、request、response都分配在上面
+	// 响应在同一个IO线程上发出后整体归还，不再逐个new/delete
+	RpcArena *arena = RpcArena::Acquire();
+	CallContext *ctx = google::protobuf::Arena::Create<CallContext>(arena->Get());
+	ctx->m_conn = conn;
+	ctx->m_requestId = request_id;
+	// 按名字调用的请求，在响应里告诉客户端这个方法的id，之后同一连接上改用id调用
+	ctx->m_methodId = rpcHeader.method_id() == 0 ? minfo->m_methodId : 0;
+	ctx->m_arena = arena;
+	ctx->m_batch = batch;
+	ctx->m_acceptCompression = rpcHeader.accept_compression();
+	ctx->m_metrics = metrics;
+	ctx->m_timing.start = start;
+	// 服务端span以调用方的客户端span为父span；调用方没有带追踪上下文时在这里开一条新trace
+	RpcTraceContext upstream;
+	upstream.traceId = rpcHeader.trace_id();
+	upstream.spanId = rpcHeader.span_id();
+	upstream.sampled = (rpcHeader.trace_flags() & 1) != 0;
+	ctx->m_trace = RpcTracer::GetInstance().StartSpan(upstream);
+	ctx->m_parentSpanId = upstream.spanId;
+	if (rpcHeader.timeout_ms() > 0)
+	{
+		// 预算从收到请求时开始计，不包含网络传输时间，服务端的截止时间总是不早于客户端
+		ctx->m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(rpcHeader.timeout_ms());
+	}
+	ctx->m_request = minfo->m_static != nullptr ? minfo->m_static->NewRequest(method->index(), arena->Get())
+											  : service->GetRequestPrototype(method).New(arena->Get());
+	
+	// 压缩过的参数先解压，解压失败（算法不支持、数据损坏）和解析失败一样按RPC_BAD_REQUEST处理
+	std::string raw_args;
+	bool decoded = true;
+	if (rpcHeader.compression() != mprpc::RPC_COMPRESS_NONE)
+	{
+		decoded = RpcCompress::Decompress(rpcHeader.compression(), args, args_size, rpcHeader.raw_size(), &raw_args);
+		args = raw_args.data();
+		args_size = raw_args.size();
+	}
+	if (!decoded || !ctx->m_request->ParseFromArray(args, (int)args_size))
+	{
+				LOG_ERROR << "ParseFromArray failed for args";
+		FinishCall(ctx, mprpc::RPC_BAD_REQUEST);
+		RpcArena::Release(arena);
+		SendRpcError(conn, request_id, mprpc::RPC_BAD_REQUEST, "parse request error!", batch);
+		return;
+	}
+	
+	ctx->m_timing.decoded = RpcCallTiming::Clock::now();
 
-		google::protobuf::Message *request = service->GetRequestPrototype(method).New();
-		if (!request)
+	if (streaming)
+	{
+		// 流式调用：writer结束时回到IO线程发出最后一帧并释放Arena
+		ctx->m_stream = true;
+		std::shared_ptr<RpcStreamWriter> writer(new RpcStreamWriter(
+			conn, request_id, ctx->m_methodId, rpcHeader.stream_window(), ctx->m_deadline,
+			[this, ctx](int error_code, const std::string &error_text) {
+				ctx->m_timing.handlerEnd = RpcCallTiming::Clock::now();
+				ctx->m_conn->getLoop()->runInLoop([this, ctx, error_code, error_text]() {
+					FinishStream(ctx, error_code, error_text);
+				});
+			}));
 		{
-					LOG_ERROR << "Failed to create request message";
-			continue;
+			std::lock_guard<std::mutex> lk(m_streamMu);
+			m_streams[StreamKey(conn.get(), request_id)] = writer;
 		}
-		
-		if (!request->ParseFromString(args_str))
+		if (!executor->Submit([this, minfo, ctx, writer]() { InvokeStream(minfo, ctx, writer); }))
 		{
-					LOG_ERROR << "ParseFromString failed for args_str";
-			delete request;
-			continue;
+			LOG_WARN << "executor " << executor->Name() << " queue is full, reject " << method->full_name();
+			writer->Finish(mprpc::RPC_QUEUE_FULL, "server busy: " + executor->Name() + " queue is full");
 		}
-		
-		google::protobuf::Message *response = service->GetResponsePrototype(method).New();
-		if (!response)
+		return;
+	}
+
+	ctx->m_response = minfo->m_static != nullptr ? minfo->m_static->NewResponse(method->index(), arena->Get())
+											   : service->GetResponsePrototype(method).New(arena->Get());
+
+	// done可能在任意线程上执行，统一切回连接所属的IO线程做序列化和发送
+	google::protobuf::Closure* done = NewMprpcClosure([this, ctx]() {
+		ctx->m_timing.handlerEnd = RpcCallTiming::Clock::now();
+		ctx->m_conn->getLoop()->runInLoop([this, ctx]() { SendRpcResponse(ctx); });
+	});
+
+		LOG_DEBUG << "Calling RPC method: " << method->full_name();
+	if (executor == nullptr)
+	{
+		Invoke(minfo, ctx, done);
+		return;
+	}
+	bool submitted = executor->Submit([this, minfo, ctx, done]() {
+		Invoke(minfo, ctx, done);
+	});
+	if (!submitted)
+	{
+		LOG_WARN << "executor " << executor->Name() << " queue is full, reject " << method->full_name();
+		delete done;
+		FinishCall(ctx, mprpc::RPC_QUEUE_FULL);
+		RpcArena::Release(arena);
+		SendRpcError(conn, request_id, mprpc::RPC_QUEUE_FULL, "server busy: " + executor->Name() + " queue is full", batch);
+	}
+}
+
+void RpcProvider::Invoke(const MethodInfo *minfo, CallContext *ctx, google::protobuf::Closure *done)
+{
+	if (std::chrono::steady_clock::now() >= ctx->m_deadline)
+	{
+		// 调用方已经放弃等待，不再做无用功；回一个错误帧即可，Arena回到IO线程上释放
+		LOG_WARN << "drop expired request " << minfo->m_method->full_name() << " request_id: " << ctx->m_requestId;
+		delete done;
+		ctx->m_conn->getLoop()->runInLoop([this, ctx]() {
+			muduo::net::TcpConnectionPtr conn = ctx->m_conn;
+			uint64_t request_id = ctx->m_requestId;
+			RpcBatch *batch = ctx->m_batch;
+			FinishCall(ctx, mprpc::RPC_DEADLINE_EXCEEDED);
+			RpcArena::Release(ctx->m_arena);
+			SendRpcError(conn, request_id, mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded before execution", batch);
+		});
+		return;
+	}
+	MprpcController::SetInheritedDeadline(ctx->m_deadline);
+	ctx->m_timing.handlerStart = RpcCallTiming::Clock::now();
+	{
+		RpcTraceScope trace_scope(ctx->m_trace);
+		if (minfo->m_static != nullptr)
 		{
-					LOG_ERROR << "Failed to create response message";
-			delete request;
-			continue;
+			minfo->m_static->Dispatch(minfo->m_method->index(), nullptr, ctx->m_request, ctx->m_response, done);
+		}
+		else
+		{
+			minfo->m_service->CallMethod(minfo->m_method, nullptr, ctx->m_request, ctx->m_response, done);
 		}
+	}
+	MprpcController::SetInheritedDeadline(std::chrono::steady_clock::time_point::max());
+}
+
+void RpcProvider::CallLocal(const ServiceInfo *service, const google::protobuf::MethodDescriptor *method,
+							google::protobuf::RpcController *controller, const google::protobuf::Message *request,
+							google::protobuf::Message *response, google::protobuf::Closure *done,
+							std::chrono::steady_clock::time_point deadline, bool run_inline)
+{
+	auto mit = service->m_methodMap.find(method->name());
+	const MethodInfo *minfo = mit == service->m_methodMap.end() ? nullptr : &mit->second;
+	// 流式方法只能通过CallStream调用，请求/响应的类型不对时同样拒绝（handler会直接static_cast）
+	if (minfo == nullptr || minfo->m_method != method || minfo->m_streamHandler ||
+		request->GetDescriptor() != method->input_type() || response->GetDescriptor() != method->output_type())
+	{
+		LOG_ERROR << method->full_name() << " can not be called in process";
+		MprpcController::Fail(controller, mprpc::RPC_NO_METHOD, method->full_name() + " can not be called in process");
+		done->Run();
+		return;
+	}
 
-		google::protobuf::Closure* done = 
-			google::protobuf::NewCallback<RpcProvider,
-							const muduo::net::TcpConnectionPtr&,
-							google::protobuf::Message*>
-							(this, &RpcProvider::SendRpcResponse, conn, response);
+	RpcMethodMetrics *metrics = minfo->m_metrics;
+	metrics->OnStart();
+	auto timing = std::make_shared<RpcCallTiming>();
+	timing->start = RpcCallTiming::Clock::now();
+	timing->decoded = timing->start;
 
-			LOG_DEBUG << "Calling RPC method: " << service_name << "." << method_name;
-		service->CallMethod(method, nullptr, request, response, done);
+	// 本地调用同样占用并发名额：优先级照常生效，下线时的在途计数也包括它们
+	if (!m_admission.TryAcquire(minfo->m_priority))
+	{
+		metrics->OnFinish(false, *timing);
+		MprpcController::Fail(controller, mprpc::RPC_OVERLOADED, "server overloaded: " + method->full_name() + " rejected");
+		done->Run();
+		return;
+	}
+
+	google::protobuf::Closure *finish = NewMprpcClosure([this, metrics, timing, controller, done]() {
+		// handler没有执行（过期、队列满）时不计入handler耗时
+		const bool executed = timing->handlerStart != RpcCallTiming::Clock::time_point();
+		if (executed) timing->handlerEnd = RpcCallTiming::Clock::now();
+		m_admission.Release(executed, executed ? (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+													 timing->handlerEnd - timing->decoded).count() : 0);
+		// 调用方可以不传controller（例如批量调用中的某一项），这时按成功计
+		metrics->OnFinish(controller == nullptr || !controller->Failed(), *timing);
+		done->Run();
+	});
+
+	const RpcTraceContext trace = RpcTracer::Current();
+	auto run = [minfo, controller, request, response, finish, deadline, timing, trace]() {
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			MprpcController::Fail(controller, mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded before execution");
+			finish->Run();
+			return;
+		}
+		// response是调用方传入的，可能带着上一次调用的结果；远程调用时handler拿到的是新对象，这里保持一致
+		response->Clear();
+		const MprpcController::Clock::time_point saved = MprpcController::InheritedDeadline();
+		MprpcController::SetInheritedDeadline(deadline);
+		timing->handlerStart = RpcCallTiming::Clock::now();
+		{
+			RpcTraceScope trace_scope(trace);
+			if (minfo->m_static != nullptr)
+			{
+				minfo->m_static->Dispatch(minfo->m_method->index(), nullptr, request, response, finish);
+			}
+			else
+			{
+				minfo->m_service->CallMethod(minfo->m_method, nullptr, request, response, finish);
+			}
+		}
+		MprpcController::SetInheritedDeadline(saved);
+	};
+
+	// 同步调用的调用线程反正要等，直接在它上面执行；已经在该方法的线程池上时也不再转一次
+	RpcThreadPool *executor = minfo->m_executor;
+	if (run_inline || executor == nullptr || RpcThreadPool::Current() == executor)
+	{
+		run();
+		return;
+	}
+	if (!executor->Submit(run))
+	{
+		LOG_WARN << "executor " << executor->Name() << " queue full, reject local call " << method->full_name();
+		MprpcController::Fail(controller, mprpc::RPC_QUEUE_FULL, "server busy: " + executor->Name() + " queue is full");
+		finish->Run();
 	}
 }
 
+void RpcProvider::InvokeStream(const MethodInfo *minfo, CallContext *ctx, const std::shared_ptr<RpcStreamWriter> &writer)
+{
+	if (std::chrono::steady_clock::now() >= ctx->m_deadline)
+	{
+		LOG_WARN << "drop expired request " << minfo->m_method->full_name() << " request_id: " << ctx->m_requestId;
+		writer->Finish(mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded before execution");
+		return;
+	}
+	MprpcController::SetInheritedDeadline(ctx->m_deadline);
+	ctx->m_timing.handlerStart = RpcCallTiming::Clock::now();
+	{
+		RpcTraceScope trace_scope(ctx->m_trace);
+		minfo->m_streamHandler(*ctx->m_request, *writer);
+	}
+	MprpcController::SetInheritedDeadline(std::chrono::steady_clock::time_point::max());
+	if (std::chrono::steady_clock::now() >= ctx->m_deadline)
+	{
+		writer->Finish(mprpc::RPC_DEADLINE_EXCEEDED, "rpc deadline exceeded");
+	}
+	else
+	{
+		writer->Finish();
+	}
+}
+
+void RpcProvider::FinishStream(CallContext *ctx, int error_code, const std::string &error_text)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_streamMu);
+		m_streams.erase(StreamKey(ctx->m_conn.get(), ctx->m_requestId));
+	}
+	// 排队期间就结束的流（过期、队列满）handler没有执行，不计入准入控制的延迟统计
+	if (ctx->m_timing.handlerStart == RpcCallTiming::Clock::time_point())
+	{
+		ctx->m_timing.handlerEnd = RpcCallTiming::Clock::time_point();
+	}
+	mprpc::RpcResponseHeader header;
+	header.set_request_id(ctx->m_requestId);
+	header.set_method_id(ctx->m_methodId);
+	header.set_error_code(error_code);
+	header.set_error_text(error_text);
+	SendResponseFrame(ctx->m_conn, header, nullptr);
+	FinishCall(ctx, error_code);
+	RpcArena::Release(ctx->m_arena);
+}
+
+void RpcProvider::OnStreamControl(const muduo::net::TcpConnectionPtr &conn, const mprpc::RpcHeader &rpcHeader)
+{
+	std::shared_ptr<RpcStreamWriter> writer;
+	{
+		std::lock_guard<std::mutex> lk(m_streamMu);
+		auto it = m_streams.find(StreamKey(conn.get(), rpcHeader.request_id()));
+		if (it == m_streams.end()) return; // 流已经结束，迟到的流控帧直接忽略
+		writer = it->second;
+	}
+	if (rpcHeader.stream_cancel())
+	{
+		writer->Cancel();
+	}
+	else
+	{
+		writer->AddCredit(rpcHeader.stream_credit());
+	}
+}
+
+void RpcProvider::FinishCall(CallContext *ctx, int error_code)
+{
+	const RpcCallTiming &t = ctx->m_timing;
+	// 流式调用的耗时取决于结果集大小和客户端的消费速度，不反映服务端的处理能力，不计入延迟统计
+	const bool executed = t.handlerEnd != RpcCallTiming::Clock::time_point() && !ctx->m_stream;
+	m_admission.Release(executed, executed ? (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+												 t.handlerEnd - t.decoded).count() : 0);
+	ctx->m_metrics->OnFinish(error_code == mprpc::RPC_OK, ctx->m_timing);
+	RpcTracer::GetInstance().Record(ctx->m_trace, ctx->m_parentSpanId, RpcTracer::kServer, ctx->m_metrics->Name(),
+									ctx->m_timing.start, RpcCallTiming::Clock::now(), error_code);
+}
+
 // Closure的回调操作,用于序列化rpc的响应和网络发送
-void RpcProvider::SendRpcResponse(const muduo::net::TcpConnectionPtr &conn, google::protobuf::Message *response)
+void RpcProvider::SendRpcResponse(CallContext *ctx)
 {
-	LOG_DEBUG << "SendRpcResponse: Sending response to " << conn->peerAddress().toIpPort();
+	const muduo::net::TcpConnectionPtr &conn = ctx->m_conn;
+	LOG_DEBUG << "SendRpcResponse: Sending response to " << conn->peerAddress().toIpPort() << " request_id: " << ctx->m_requestId;
 	
-	std::string response_str;
-	if(response && response->SerializeToString(&response_str)){
-		// 发送长度前缀 + 内容（保持长连接，不主动关闭）
-		uint32_t len = (uint32_t)response_str.size();
-		char lenbuf[4];
-		::memcpy(lenbuf, &len, 4);
-		conn->send(std::string(lenbuf, 4));
-		conn->send(response_str);
-		
-			LOG_DEBUG << "SendRpcResponse: Response sent successfully, size=" << len;
+	// 发送长度前缀 + 响应头 + 内容（保持长连接，不主动关闭）
+	mprpc::RpcResponseHeader header;
+	header.set_request_id(ctx->m_requestId);
+	header.set_method_id(ctx->m_methodId);
+	bool ok = SendResponseFrame(conn, header, ctx->m_response, ctx->m_batch, ctx->m_acceptCompression);
+	if (ok)
+	{
+			LOG_DEBUG << "SendRpcResponse: Response sent successfully";
 	}
 	else
 	{
 			LOG_ERROR << "serialize response failed!";
+		SendRpcError(conn, ctx->m_requestId, mprpc::RPC_INTERNAL, "serialize response error!", ctx->m_batch);
 	}
+	FinishCall(ctx, ok ? mprpc::RPC_OK : mprpc::RPC_INTERNAL);
 	
-	// Clean up the response message to prevent memory leaks
-	if (response) {
-		delete response;
+	// 释放本次调用的Arena：ctx/request/response随之析构，必须放在最后
+	RpcArena::Release(ctx->m_arena);
+}
+
+void RpcProvider::SendRpcError(const muduo::net::TcpConnectionPtr &conn, uint64_t request_id,
+							   int error_code, const std::string &error_text, RpcBatch *batch)
+{
+	mprpc::RpcResponseHeader header;
+	header.set_request_id(request_id);
+	header.set_error_code(error_code);
+	header.set_error_text(error_text);
+	SendResponseFrame(conn, header, nullptr, batch);
+}
+
+// 把 header_size + RpcResponseHeader + body 直接序列化进一个muduo Buffer，只调用一次send
+// 长度前缀写在Buffer预留的prepend区，不需要额外拼接字符串
+bool RpcProvider::SendResponseFrame(const muduo::net::TcpConnectionPtr &conn, mprpc::RpcResponseHeader &header,
+									const google::protobuf::Message *body, RpcBatch *batch, uint32_t peer_accepted)
+{
+	size_t body_size = body ? body->ByteSizeLong() : 0;
+	if (peer_accepted != 0)
+	{
+		header.set_accept_compression(RpcCompress::Accepted());
+	}
+	// 调用方能解压的大响应：先序列化再压缩，encoded保存最终要发出的body（压缩没有收益时就是原始数据）
+	std::string encoded;
+	const uint32_t codec = body ? RpcCompress::Choose(peer_accepted, body_size) : mprpc::RPC_COMPRESS_NONE;
+	if (codec != mprpc::RPC_COMPRESS_NONE)
+	{
+		if (!body->SerializeToString(&encoded)) return false;
+		std::string compressed;
+		if (RpcCompress::Compress(codec, encoded.data(), encoded.size(), &compressed))
+		{
+			header.set_compression(codec);
+			header.set_raw_size((uint32_t)encoded.size());
+			encoded.swap(compressed);
+		}
+		body = nullptr;
+		body_size = encoded.size();
+	}
+	header.set_body_size((uint32_t)body_size);
+	const size_t header_size = header.ByteSizeLong();
+
+	muduo::net::Buffer frame;
+	frame.ensureWritableBytes(header_size + body_size);
+	uint8_t *target = reinterpret_cast<uint8_t *>(frame.beginWrite());
+	target = header.SerializeWithCachedSizesToArray(target);
+	if (body)
+	{
+		uint8_t *end = body->SerializeWithCachedSizesToArray(target);
+		if ((size_t)(end - target) != body_size) return false;
+	}
+	else if (!encoded.empty())
+	{
+		::memcpy(target, encoded.data(), encoded.size());
 	}
+	frame.hasWritten(header_size + body_size);
 
-}
\ No newline at end of file
+	uint32_t len = (uint32_t)header_size;
+	frame.prepend(&len, sizeof(len));
+	if (batch == nullptr)
+	{
+		WriteFrame(conn, &frame);
+		return true;
+	}
+
+	// 批量请求的子调用：先攒着，批内的响应到齐后一起发出
+	batch->m_body.append(frame.peek(), frame.readableBytes());
+	ReleaseBatchSlot(conn, batch);
+	return true;
+}
+
+void RpcProvider::ReleaseBatchSlot(const muduo::net::TcpConnectionPtr &conn, RpcBatch *batch)
+{
+	if (--batch->m_remaining > 0) return;
+	mprpc::RpcResponseHeader header;
+	header.set_request_id(batch->m_requestId);
+	header.set_batch_count(batch->m_count);
+	header.set_body_size((uint32_t)batch->m_body.readableBytes());
+	const std::string header_str = header.SerializeAsString();
+	uint32_t len = (uint32_t)header_str.size();
+	muduo::net::Buffer frame;
+	frame.append(reinterpret_cast<const char *>(&len), sizeof(len));
+	frame.append(header_str);
+	frame.append(batch->m_body.peek(), batch->m_body.readableBytes());
+	WriteFrame(conn, &frame);
+	delete batch;
+}
+
+void RpcProvider::WriteFrame(const muduo::net::TcpConnectionPtr &conn, muduo::net::Buffer *frame)
+{
+	// 业务线程上发出的帧（流式消息等）由muduo转交IO线程，不参与合并
+	muduo::net::EventLoop *loop = conn->getLoop();
+	if (!m_coalesceReplies || !loop->isInLoopThread())
+	{
+		conn->send(frame);
+		return;
+	}
+	PendingReplies &pending = t_pendingReplies;
+	auto it = pending.m_index.find(conn.get());
+	if (it == pending.m_index.end())
+	{
+		// 本轮第一帧直接交换进去，不拷贝
+		pending.m_index.emplace(conn.get(), pending.m_replies.size());
+		pending.m_replies.emplace_back(conn, muduo::net::Buffer());
+		pending.m_replies.back().second.swap(*frame);
+	}
+	else
+	{
+		pending.m_replies[it->second].second.append(frame->peek(), frame->readableBytes());
+	}
+	if (!pending.m_flushQueued)
+	{
+		pending.m_flushQueued = true;
+		loop->queueInLoop(FlushReplies);
+	}
+}
+
+void RpcProvider::HandleBatch(const muduo::net::TcpConnectionPtr &conn, const mprpc::RpcHeader &rpcHeader,
+							  const char *args, size_t args_size)
+{
+	// 先把所有子帧解析出来并校验数量，格式不对时整个批量请求以RPC_BAD_REQUEST失败
+	struct SubRequest
+	{
+		mprpc::RpcHeader header;
+		const char *args;
+	};
+	std::vector<SubRequest> subs;
+	subs.reserve(rpcHeader.batch_count());
+	size_t offset = 0;
+	while (offset + 4 <= args_size)
+	{
+		uint32_t header_size = 0;
+		::memcpy(&header_size, args + offset, 4);
+		SubRequest sub;
+		if (offset + 4 + header_size > args_size ||
+			!sub.header.ParseFromArray(args + offset + 4, (int)header_size) ||
+			offset + 4 + header_size + sub.header.args_size() > args_size)
+		{
+			break;
+		}
+		sub.args = args + offset + 4 + header_size;
+		offset += 4 + header_size + sub.header.args_size();
+		subs.push_back(std::move(sub));
+	}
+	if (offset != args_size || subs.size() != rpcHeader.batch_count())
+	{
+		LOG_ERROR << "malformed batch request, request_id: " << rpcHeader.request_id();
+		m_metrics.OnUnroutedError();
+		SendRpcError(conn, rpcHeader.request_id(), mprpc::RPC_BAD_REQUEST, "malformed batch request");
+		return;
+	}
+
+	// 子调用可能在分发过程中就结束（参数错误、直接在IO线程上执行完），多占一个名额，全部分发完再释放
+	RpcBatch *batch = new RpcBatch;
+	batch->m_requestId = rpcHeader.request_id();
+	batch->m_count = (uint32_t)subs.size();
+	batch->m_remaining = batch->m_count + 1;
+	for (const SubRequest &sub : subs)
+	{
+		HandleRequest(conn, sub.header, sub.args, sub.header.args_size(), batch);
+	}
+	ReleaseBatchSlot(conn, batch);
+}
+
+std::string RpcProvider::DumpStats()
+{
+	// 服务端自己的调用统计和准入状态，加上本进程作为客户端时连接池的计数
+	return m_metrics.Dump() + m_admission.Dump() + MprpcConnectionPool::GetInstance().Dump();
+}
+
+void RpcProvider::OnStatsMessage(const muduo::net::TcpConnectionPtr &conn, muduo::net::Buffer *buffer, muduo::Timestamp)
+{
+	// 不解析请求内容，按HTTP/1.0回一份纯文本，curl和nc都能直接看
+	buffer->retrieveAll();
+	std::string body = DumpStats();
+	std::string reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+						"\r\nConnection: close\r\n\r\n" + body;
+	conn->send(reply);
+	conn->shutdown();
+}
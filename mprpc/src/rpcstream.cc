@@ -0,0 +1,88 @@
+#include "rpcstream.h"
+#include "rpcheader.pb.h"
+#include <muduo/net/Buffer.h>
+
+RpcStreamWriter::RpcStreamWriter(const muduo::net::TcpConnectionPtr &conn, uint64_t request_id, uint32_t method_id,
+								 uint32_t window, Clock::time_point deadline, FinishCallback on_finish)
+	: m_conn(conn), m_requestId(request_id), m_methodId(method_id), m_deadline(deadline)
+	, m_onFinish(std::move(on_finish)), m_credit(window), m_cancelled(false), m_finished(false)
+{
+}
+
+bool RpcStreamWriter::Write(const google::protobuf::Message &msg)
+{
+	{
+		std::unique_lock<std::mutex> lk(m_mu);
+		auto ready = [this]() { return m_credit > 0 || m_cancelled || m_finished; };
+		if (m_deadline == Clock::time_point::max())
+		{
+			m_cv.wait(lk, ready);
+		}
+		else if (!m_cv.wait_until(lk, m_deadline, ready))
+		{
+			return false;
+		}
+		if (m_cancelled || m_finished || !m_conn->connected()) return false;
+		--m_credit;
+	}
+
+	// 在业务线程上序列化，TcpConnection::send会把数据转交给连接所属的IO线程，先写的消息先发出
+	mprpc::RpcResponseHeader header;
+	header.set_request_id(m_requestId);
+	header.set_method_id(m_methodId);
+	header.set_stream_more(true);
+	const size_t body_size = msg.ByteSizeLong();
+	header.set_body_size((uint32_t)body_size);
+	const size_t header_size = header.ByteSizeLong();
+
+	muduo::net::Buffer frame;
+	frame.ensureWritableBytes(header_size + body_size);
+	uint8_t *target = reinterpret_cast<uint8_t *>(frame.beginWrite());
+	target = header.SerializeWithCachedSizesToArray(target);
+	uint8_t *end = msg.SerializeWithCachedSizesToArray(target);
+	if ((size_t)(end - target) != body_size)
+	{
+		Finish(mprpc::RPC_INTERNAL, "serialize stream message error!");
+		return false;
+	}
+	frame.hasWritten(header_size + body_size);
+	uint32_t len = (uint32_t)header_size;
+	frame.prepend(&len, sizeof(len));
+	m_conn->send(&frame);
+	return true;
+}
+
+void RpcStreamWriter::Finish(int error_code, const std::string &error_text)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		if (m_finished) return;
+		m_finished = true;
+	}
+	m_cv.notify_all();
+	m_onFinish(error_code, error_text);
+}
+
+bool RpcStreamWriter::Cancelled() const
+{
+	std::lock_guard<std::mutex> lk(m_mu);
+	return m_cancelled || !m_conn->connected();
+}
+
+void RpcStreamWriter::AddCredit(uint32_t credit)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		m_credit += credit;
+	}
+	m_cv.notify_all();
+}
+
+void RpcStreamWriter::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mu);
+		m_cancelled = true;
+	}
+	m_cv.notify_all();
+}
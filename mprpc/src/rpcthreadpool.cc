@@ -0,0 +1,84 @@
+#include "rpcthreadpool.h"
+#include "logger/logger.h"
+
+namespace {
+thread_local RpcThreadPool *t_currentPool = nullptr;
+}
+
+RpcThreadPool::RpcThreadPool(const std::string &name, int thread_num, size_t queue_capacity)
+	: m_name(name)
+	, m_threadNum(thread_num > 0 ? thread_num : 1)
+	, m_capacity(queue_capacity > 0 ? queue_capacity : 1)
+	, m_stopped(false)
+{
+}
+
+RpcThreadPool::~RpcThreadPool()
+{
+	Stop();
+}
+
+void RpcThreadPool::Start()
+{
+	m_threads.reserve(m_threadNum);
+	for (int i = 0; i < m_threadNum; ++i)
+	{
+		m_threads.emplace_back(&RpcThreadPool::WorkerLoop, this);
+	}
+	LOG_INFO << "RpcThreadPool " << m_name << " started, threads: " << m_threadNum
+			 << " queue_capacity: " << m_capacity;
+}
+
+void RpcThreadPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		if (m_stopped) return;
+		m_stopped = true;
+	}
+	m_cond.notify_all();
+	for (auto &t : m_threads)
+	{
+		if (t.joinable()) t.join();
+	}
+	m_threads.clear();
+}
+
+bool RpcThreadPool::Submit(Task task)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		if (m_stopped || m_queue.size() >= m_capacity) return false;
+		m_queue.push_back(std::move(task));
+	}
+	m_cond.notify_one();
+	return true;
+}
+
+size_t RpcThreadPool::QueueSize() const
+{
+	std::lock_guard<std::mutex> lk(m_mutex);
+	return m_queue.size();
+}
+
+RpcThreadPool *RpcThreadPool::Current()
+{
+	return t_currentPool;
+}
+
+void RpcThreadPool::WorkerLoop()
+{
+	t_currentPool = this;
+	while (true)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+			m_cond.wait(lk, [this]() { return m_stopped || !m_queue.empty(); });
+			if (m_queue.empty()) return; // 已停止且队列清空
+			task = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,222 @@
+#include "rpctrace.h"
+#include "mprpcapplication.h"
+#include "logger/logger.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+
+namespace {
+const size_t kDefaultBufferSize = 16384;
+const int kDefaultFlushIntervalMs = 200;
+
+thread_local RpcTraceContext t_current;
+
+// 每个线程一个splitmix64序列，种子来自random_device，id只需要足够分散，不需要密码学强度
+uint64_t NextId()
+{
+	thread_local uint64_t t_state = ((uint64_t)std::random_device{}() << 32) ^ std::random_device{}();
+	uint64_t z = (t_state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+	return z != 0 ? z : 1;
+}
+
+// JSON字符串里只需要转义引号、反斜杠和控制字符
+void AppendJsonString(std::string &out, const char *s)
+{
+	out += '"';
+	for (; *s; ++s)
+	{
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+		else if (c < 0x20) { char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+		else out += (char)c;
+	}
+	out += '"';
+}
+}
+
+RpcTracer &RpcTracer::GetInstance()
+{
+	static RpcTracer tracer;
+	return tracer;
+}
+
+RpcTracer::RpcTracer()
+	: m_head(0), m_tail(0), m_dropped(0), m_fp(nullptr), m_stop(false)
+{
+	MprpcConfig &config = MprpcApplication::GetConfig();
+	std::string rate = config.Load("trace_sample_rate");
+	m_sampleRate = rate.empty() ? 0.0 : atof(rate.c_str());
+
+	char pid[32] = {0};
+	snprintf(pid, sizeof(pid), "%d", (int)::getpid());
+	m_file = config.Load("trace_file");
+	if (m_file.empty()) m_file = std::string("mprpc_trace.") + pid + ".log";
+	m_process = std::string(program_invocation_short_name) + ":" + pid;
+
+	m_flushIntervalMs = config.LoadInt("trace_flush_interval_ms", kDefaultFlushIntervalMs);
+	if (m_flushIntervalMs <= 0) m_flushIntervalMs = kDefaultFlushIntervalMs;
+
+	int n = config.LoadInt("trace_buffer_size", (int)kDefaultBufferSize);
+	size_t size = 1;
+	while (size < (size_t)(n > 0 ? n : (int)kDefaultBufferSize)) size <<= 1;
+	m_mask = size - 1;
+	m_ring.reset(new Slot[size]);
+}
+
+RpcTracer::~RpcTracer()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_stopMu);
+		m_stop = true;
+	}
+	m_stopCv.notify_all();
+	if (m_flusher.joinable()) m_flusher.join();
+}
+
+const RpcTraceContext &RpcTracer::Current()
+{
+	return t_current;
+}
+
+void RpcTracer::SetCurrent(const RpcTraceContext &ctx)
+{
+	t_current = ctx;
+}
+
+RpcTraceContext RpcTracer::StartSpan(const RpcTraceContext &parent)
+{
+	RpcTraceContext span;
+	span.spanId = NextId();
+	if (parent.Valid())
+	{
+		span.traceId = parent.traceId;
+		span.sampled = parent.sampled;
+		return span;
+	}
+	span.traceId = NextId();
+	// 用新trace_id的高位做采样判断，省掉一次随机数
+	span.sampled = m_sampleRate > 0 && (double)(span.traceId >> 11) * (1.0 / 9007199254740992.0) < m_sampleRate;
+	return span;
+}
+
+void RpcTracer::Record(const RpcTraceContext &span, uint64_t parent_span_id, SpanKind kind, const std::string &name,
+					   Clock::time_point start, Clock::time_point end, int status)
+{
+	if (!span.sampled) return;
+	std::call_once(m_flusherOnce, [this]() { m_flusher = std::thread([this]() { FlushLoop(); }); });
+
+	// 单调时钟的起点换算成墙上时间，不同进程的span才能放到同一条时间线上
+	const Clock::time_point now = Clock::now();
+	const auto wall_now = std::chrono::system_clock::now();
+	const int64_t start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+								 (wall_now - (now - start)).time_since_epoch()).count();
+
+	const uint64_t pos = m_head.fetch_add(1, std::memory_order_relaxed);
+	Slot &slot = m_ring[pos & m_mask];
+	slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	SpanRecord &r = slot.record;
+	r.traceId = span.traceId;
+	r.spanId = span.spanId;
+	r.parentSpanId = parent_span_id;
+	r.startUs = start_us;
+	r.durationUs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	r.status = status;
+	r.kind = (char)kind;
+	size_t len = std::min(name.size(), sizeof(r.name) - 1);
+	::memcpy(r.name, name.data(), len);
+	r.name[len] = '\0';
+	slot.seq.store(2 * pos + 2, std::memory_order_release);
+}
+
+void RpcTracer::FlushLoop()
+{
+	FILE *fp = ::fopen(m_file.c_str(), "a");
+	if (fp == nullptr)
+	{
+		LOG_ERROR << "RpcTracer: open " << m_file << " failed, errno: " << errno << ", sampled spans are discarded";
+		return;
+	}
+	LOG_INFO << "RpcTracer: writing sampled spans to " << m_file;
+	{
+		std::lock_guard<std::mutex> lk(m_flushMu);
+		m_fp = fp;
+	}
+	bool stop = false;
+	while (!stop)
+	{
+		{
+			std::unique_lock<std::mutex> lk(m_stopMu);
+			stop = m_stopCv.wait_for(lk, std::chrono::milliseconds(m_flushIntervalMs), [this]() { return m_stop; });
+		}
+		// 收到停止时也先刷完这一轮，缓冲区里最后的span不丢
+		FlushNow();
+	}
+	std::lock_guard<std::mutex> lk(m_flushMu);
+	::fclose(m_fp);
+	m_fp = nullptr;
+}
+
+void RpcTracer::FlushNow()
+{
+	std::lock_guard<std::mutex> lk(m_flushMu);
+	if (m_fp != nullptr) Flush(m_fp);
+}
+
+void RpcTracer::Flush(FILE *fp)
+{
+	const uint64_t head = m_head.load(std::memory_order_acquire);
+	const uint64_t capacity = m_mask + 1;
+	if (head - m_tail > capacity)
+	{
+		// 刷盘跟不上，最旧的span已经被覆盖
+		m_dropped.fetch_add(head - m_tail - capacity, std::memory_order_relaxed);
+		m_tail = head - capacity;
+	}
+
+	std::string out;
+	char buf[256];
+	for (; m_tail < head; ++m_tail)
+	{
+		Slot &slot = m_ring[m_tail & m_mask];
+		const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+		if (seq < 2 * m_tail + 2) break; // 还没写完，下一轮再来
+		if (seq > 2 * m_tail + 2)
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		SpanRecord r;
+		::memcpy(&r, &slot.record, sizeof(r));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.seq.load(std::memory_order_relaxed) != seq)
+		{
+			// 拷贝期间被新的span覆盖
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		r.name[sizeof(r.name) - 1] = '\0';
+		snprintf(buf, sizeof(buf),
+				 "{\"trace\":\"%016llx\",\"span\":\"%016llx\",\"parent\":\"%016llx\",\"kind\":\"%c\","
+				 "\"start_us\":%lld,\"dur_us\":%lld,\"status\":%d,\"name\":",
+				 (unsigned long long)r.traceId, (unsigned long long)r.spanId, (unsigned long long)r.parentSpanId,
+				 r.kind, (long long)r.startUs, (long long)r.durationUs, (int)r.status);
+		out += buf;
+		AppendJsonString(out, r.name);
+		out += ",\"proc\":";
+		AppendJsonString(out, m_process.c_str());
+		out += "}\n";
+	}
+	if (!out.empty())
+	{
+		::fwrite(out.data(), 1, out.size(), fp);
+		::fflush(fp);
+	}
+}
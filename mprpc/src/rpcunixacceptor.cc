@@ -0,0 +1,115 @@
+#include "rpcunixacceptor.h"
+#include "logger/logger.h"
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpConnection.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+RpcUnixAcceptor::RpcUnixAcceptor(muduo::net::EventLoop *loop, const std::string &path,
+								 std::function<muduo::net::EventLoop *()> next_loop)
+	: m_loop(loop), m_path(path), m_nextLoop(std::move(next_loop)), m_listenFd(-1), m_nextConnId(1)
+{
+}
+
+RpcUnixAcceptor::~RpcUnixAcceptor()
+{
+	StopListening();
+	// 连接的channel还注册在IO线程的poller上，不能在这里直接释放：在各自的IO线程上执行connectDestroyed把channel摘掉，
+	// 并等它们都执行完，之后IO线程上不会再有这些连接的回调（关闭回调引用了this）
+	muduo::CountDownLatch latch((int)m_connections.size());
+	for (auto &item : m_connections)
+	{
+		muduo::net::TcpConnectionPtr conn = item.second;
+		conn->getLoop()->runInLoop([conn, &latch]() {
+			conn->connectDestroyed();
+			latch.countDown();
+		});
+	}
+	latch.wait();
+	m_connections.clear();
+}
+
+void RpcUnixAcceptor::StopListening()
+{
+	if (m_listenFd == -1) return;
+	m_channel->disableAll();
+	m_channel->remove();
+	m_channel.reset();
+	::close(m_listenFd);
+	m_listenFd = -1;
+	// 删掉socket文件，同机的调用方再拨号时直接连不上，退回TCP
+	::unlink(m_path.c_str());
+}
+
+bool RpcUnixAcceptor::Listen()
+{
+	struct sockaddr_un addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (m_path.empty() || m_path.size() >= sizeof(addr.sun_path))
+	{
+		LOG_ERROR << "RpcUnixAcceptor: invalid unix socket path " << m_path;
+		return false;
+	}
+	::memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		LOG_ERROR << "RpcUnixAcceptor: socket failed, errno: " << errno;
+		return false;
+	}
+	// 上一个进程异常退出时socket文件不会被删除，不删掉bind会失败
+	::unlink(m_path.c_str());
+	if (::bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) == -1 || ::listen(fd, SOMAXCONN) == -1)
+	{
+		LOG_ERROR << "RpcUnixAcceptor: listen on " << m_path << " failed, errno: " << errno;
+		::close(fd);
+		return false;
+	}
+	m_listenFd = fd;
+	m_channel.reset(new muduo::net::Channel(m_loop, fd));
+	m_channel->setReadCallback([this](muduo::Timestamp) { HandleAccept(); });
+	m_channel->enableReading();
+	return true;
+}
+
+void RpcUnixAcceptor::HandleAccept()
+{
+	for (;;)
+	{
+		int fd = ::accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				LOG_ERROR << "RpcUnixAcceptor: accept failed, errno: " << errno;
+			}
+			if (errno == EINTR) continue;
+			return;
+		}
+		// 与TcpServer::newConnection相同：连接交给下一个IO线程，连接表只在主loop上维护
+		muduo::net::EventLoop *io_loop = m_nextLoop();
+		std::string name = "RpcProviderUnix#" + std::to_string(m_nextConnId++);
+		// unix域socket没有IP地址，本端和对端地址都留空
+		muduo::net::TcpConnectionPtr conn = std::make_shared<muduo::net::TcpConnection>(
+			io_loop, name, fd, muduo::net::InetAddress(), muduo::net::InetAddress());
+		m_connections[name] = conn;
+		conn->setConnectionCallback(m_connectionCallback);
+		conn->setMessageCallback(m_messageCallback);
+		conn->setCloseCallback([this](const muduo::net::TcpConnectionPtr &c) { RemoveConnection(c); });
+		io_loop->runInLoop([conn]() { conn->connectEstablished(); });
+	}
+}
+
+void RpcUnixAcceptor::RemoveConnection(const muduo::net::TcpConnectionPtr &conn)
+{
+	m_loop->runInLoop([this, conn]() {
+		m_connections.erase(conn->name());
+		conn->getLoop()->queueInLoop([conn]() { conn->connectDestroyed(); });
+	});
+}
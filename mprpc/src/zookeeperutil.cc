@@ -23,6 +23,64 @@ void global_watcher(zhandle_t *zh, int type,
 	}
 }
 
+// 一次性watch触发时回调；连接抖动时的会话事件也会发给所有watcher，但watch本身还在，只在会话过期时释放
+void ZkClient::OnWatch(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx)
+{
+	auto *ctx = static_cast<WatchContext *>(watcherCtx);
+	if (type == ZOO_SESSION_EVENT && state != ZOO_EXPIRED_SESSION_STATE)
+	{
+		return;
+	}
+	ZkClient *client = ctx->client;
+	bool run = false;
+	bool release = false;
+	{
+		std::lock_guard<std::mutex> lk(client->m_watchMu);
+		run = !ctx->fired;
+		ctx->fired = true;
+		release = --ctx->refs == 0;
+		if (release) client->m_watches.erase(ctx);
+	}
+	// 同一个上下文的两个watch都在zk的事件线程上依次回调，cb执行期间上下文不会被另一个watch释放
+	if (run) ctx->cb(type, path == nullptr ? std::string() : std::string(path));
+	if (release) delete ctx;
+}
+
+ZkClient::WatchContext *ZkClient::NewWatch(WatchCallback cb)
+{
+	auto *ctx = new WatchContext{this, std::move(cb), 1, false};
+	std::lock_guard<std::mutex> lk(m_watchMu);
+	m_watches.insert(ctx);
+	return ctx;
+}
+
+void ZkClient::AddWatchRef(WatchContext *ctx)
+{
+	std::lock_guard<std::mutex> lk(m_watchMu);
+	++ctx->refs;
+}
+
+void ZkClient::DropWatch(WatchContext *ctx)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_watchMu);
+		if (--ctx->refs != 0) return;
+		m_watches.erase(ctx);
+	}
+	delete ctx;
+}
+
+// 句柄关闭后zk不会再回调，还挂着的上下文在这里释放
+void ZkClient::ReleaseWatches()
+{
+	std::lock_guard<std::mutex> lk(m_watchMu);
+	for (WatchContext *ctx : m_watches)
+	{
+		delete ctx;
+	}
+	m_watches.clear();
+}
+
 ZkClient::ZkClient()
 	: m_zhandle(nullptr)
 {
@@ -34,6 +92,7 @@ ZkClient::~ZkClient()
 	{
 		zookeeper_close(m_zhandle); // 关闭句柄，释放资源
 	}
+	ReleaseWatches();
 }
 
 // 连接zkserver
@@ -73,6 +132,8 @@ void ZkClient::Start()
 	*/
 
 	fut.get();	//阻塞直到set_value()
+	// prom是局部变量，之后断线重连再收到CONNECTED事件时不能再访问它
+	zoo_set_context(m_zhandle, nullptr);
 	// sem_t sem;
 	// sem_init(&sem, 0, 0);
 	// zoo_set_context(m_zhandle, this);	//将sem交给m_zhandle句柄，句柄帮忙传递给global_watcher，通过以上达到同步的目的(global_watcher调用之后，sem_post(&sem);)
@@ -88,6 +149,17 @@ void ZkClient::Start()
 			LOG_WARN << "ZooKeeper connection state: " << state;
 	}
 }
+void ZkClient::Reconnect()
+{
+	if (m_zhandle != nullptr)
+	{
+		zookeeper_close(m_zhandle);
+		m_zhandle = nullptr;
+	}
+	ReleaseWatches();
+	Start();
+}
+
 // 在zkserver上根据指定的path创建znode节点
 void ZkClient::Create(const char *path, const char *data, int datalen, int state)
 {
@@ -122,19 +194,116 @@ void ZkClient::Create(const char *path, const char *data, int datalen, int state
 	}
 }
 
+// 删除指定path的znode节点，version传-1表示不校验版本
+void ZkClient::Delete(const char *path)
+{
+	int flag = zoo_delete(m_zhandle, path, -1);
+	if (flag != ZOK && flag != ZNONODE)
+	{
+			LOG_ERROR << "znode delete error... path: " << path << " flag: " << flag;
+	}
+}
+
 // 根据参数指定的znode节点路径，获取znode节点的值
 std::string ZkClient::GetData(const char *path)
 {
-	char buffer[64];
+	char buffer[256];
 	int bufferlen = sizeof(buffer);
 	int flag = zoo_get(m_zhandle, path, 0, buffer, &bufferlen, nullptr);
-	if (flag != ZOK)
+	if (flag != ZOK || bufferlen < 0)
 	{
 			LOG_ERROR << "get znode error... path: " << path;
 		return "";
 	}
 	else
 	{
-		return buffer;
+		return std::string(buffer, bufferlen);
+	}
+}
+
+int ZkClient::WatchData(const char *path, std::string &data, WatchCallback cb)
+{
+	char buffer[256];
+	int bufferlen = sizeof(buffer);
+	WatchContext *ctx = NewWatch(std::move(cb));
+	int flag = zoo_wget(m_zhandle, path, OnWatch, ctx, buffer, &bufferlen, nullptr);
+	if (flag == ZOK)
+	{
+		data.assign(buffer, bufferlen < 0 ? 0 : bufferlen);
+		return ZOK;
+	}
+	if (flag != ZNONODE)
+	{
+			LOG_ERROR << "wget znode error... path: " << path << " flag: " << flag;
+		DropWatch(ctx);
+		return flag;
+	}
+	// 节点不存在时zoo_wget不会留下watch，改挂存在性watch，等节点被创建
+	flag = zoo_wexists(m_zhandle, path, OnWatch, ctx, nullptr);
+	if (flag == ZNONODE)
+	{
+		return ZNONODE;
+	}
+	if (flag != ZOK)
+	{
+		DropWatch(ctx);
+		return flag;
+	}
+	// 两次调用之间节点刚好被创建：watch已经挂在zoo_wexists上，这里只补读一次数据
+	bufferlen = sizeof(buffer);
+	flag = zoo_get(m_zhandle, path, 0, buffer, &bufferlen, nullptr);
+	if (flag == ZOK)
+	{
+		data.assign(buffer, bufferlen < 0 ? 0 : bufferlen);
+	}
+	return flag;
+}
+
+int ZkClient::WatchChildren(const char *path, std::vector<std::string> &children, WatchCallback cb)
+{
+	struct String_vector strings = {0, nullptr};
+	WatchContext *ctx = NewWatch(std::move(cb));
+	int flag = zoo_wget_children(m_zhandle, path, OnWatch, ctx, &strings);
+	if (flag == ZOK)
+	{
+		children.clear();
+		for (int i = 0; i < strings.count; ++i)
+		{
+			children.emplace_back(strings.data[i]);
+		}
+		deallocate_String_vector(&strings);
+		return ZOK;
+	}
+	if (flag != ZNONODE)
+	{
+			LOG_ERROR << "wget children error... path: " << path << " flag: " << flag;
+		DropWatch(ctx);
+		return flag;
+	}
+	flag = zoo_wexists(m_zhandle, path, OnWatch, ctx, nullptr);
+	if (flag == ZNONODE)
+	{
+		return ZNONODE;
+	}
+	if (flag != ZOK)
+	{
+		DropWatch(ctx);
+		return flag;
+	}
+	// 两次调用之间节点刚好被创建：存在性watch感知不到子节点变化，同一个上下文再挂一个子节点watch，
+	// 两个watch谁先触发谁回调，cb仍然只执行一次
+	AddWatchRef(ctx);
+	flag = zoo_wget_children(m_zhandle, path, OnWatch, ctx, &strings);
+	if (flag != ZOK)
+	{
+		DropWatch(ctx);
+		return flag;
+	}
+	children.clear();
+	for (int i = 0; i < strings.count; ++i)
+	{
+		children.emplace_back(strings.data[i]);
 	}
+	deallocate_String_vector(&strings);
+	return ZOK;
 }
\ No newline at end of file
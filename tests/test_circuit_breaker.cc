@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+#include "mprpcapplication.h"
+#include "mprpccircuitbreaker.h"
+#include "rpcheader.pb.h"
+
+// 熔断器的配置在第一次使用时读取，这里在所有用例之前把熔断时长调短：
+// 连续3次失败熔断，第一次熔断50ms，之后翻倍，上限200ms；不做离群检测
+namespace {
+const int kBaseEjectMs = 50;
+
+void LoadBreakerConfig()
+{
+    char path[] = "/tmp/mprpc_breaker_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    const char conf[] =
+        "cb_consecutive_failures=3\n"
+        "cb_base_eject_ms=50\n"
+        "cb_max_eject_ms=200\n"
+        "cb_outlier_factor_pct=0\n";
+    ASSERT_EQ(write(fd, conf, sizeof(conf) - 1), (ssize_t)(sizeof(conf) - 1));
+    close(fd);
+    MprpcApplication::GetConfig().LoadConfigFile(path);
+    unlink(path);
+}
+
+using Ticket = MprpcCircuitBreaker::Ticket;
+const Ticket kNoTicket = MprpcCircuitBreaker::kNoTicket;
+
+void SleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+bool Allow(MprpcCircuitBreaker &breaker, Ticket *ticket = nullptr)
+{
+    Ticket t = kNoTicket;
+    const bool allowed = breaker.Allow(&t);
+    if (ticket) *ticket = t;
+    return allowed;
+}
+
+// 连续失败直到熔断
+void Trip(MprpcCircuitBreaker &breaker)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        Ticket ticket = kNoTicket;
+        ASSERT_TRUE(breaker.Allow(&ticket));
+        EXPECT_EQ(ticket, kNoTicket);
+        breaker.Report(ticket, true, 0);
+    }
+    ASSERT_TRUE(breaker.Ejected());
+}
+}
+
+TEST(CircuitBreakerTest, ClosedUntilConsecutiveFailures)
+{
+    MprpcCircuitBreaker breaker;
+    breaker.Report(kNoTicket, true, 0);
+    breaker.Report(kNoTicket, true, 0);
+    EXPECT_FALSE(breaker.Ejected());
+    EXPECT_TRUE(Allow(breaker));
+
+    breaker.Report(kNoTicket, true, 0);
+    EXPECT_TRUE(breaker.Ejected());
+    EXPECT_FALSE(Allow(breaker));
+}
+
+TEST(CircuitBreakerTest, SuccessResetsFailureCount)
+{
+    MprpcCircuitBreaker breaker;
+    breaker.Report(kNoTicket, true, 0);
+    breaker.Report(kNoTicket, true, 0);
+    breaker.Report(kNoTicket, false, 100);
+    breaker.Report(kNoTicket, true, 0);
+    breaker.Report(kNoTicket, true, 0);
+    EXPECT_FALSE(breaker.Ejected());
+    EXPECT_TRUE(Allow(breaker));
+}
+
+TEST(CircuitBreakerTest, HalfOpenAllowsSingleProbe)
+{
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    EXPECT_FALSE(Allow(breaker));
+
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    EXPECT_TRUE(Allow(breaker, &probe));   // 探测请求
+    EXPECT_NE(probe, kNoTicket);
+    EXPECT_FALSE(Allow(breaker));  // 探测在途时其他请求不放行
+    EXPECT_TRUE(breaker.Ejected());
+}
+
+TEST(CircuitBreakerTest, ProbeSuccessCloses)
+{
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &probe));
+
+    breaker.Report(probe, false, 100);
+    EXPECT_FALSE(breaker.Ejected());
+    EXPECT_TRUE(Allow(breaker));
+    EXPECT_TRUE(Allow(breaker));
+    EXPECT_EQ(breaker.LatencyUs(), 100u);
+}
+
+TEST(CircuitBreakerTest, ProbeFailureReopensWithLongerEjection)
+{
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &probe));
+
+    breaker.Report(probe, true, 0);
+    EXPECT_TRUE(breaker.Ejected());
+    EXPECT_FALSE(Allow(breaker));
+
+    // 第二次熔断时长翻倍为100ms，过了第一次的时长仍不放行
+    SleepMs(kBaseEjectMs + 20);
+    EXPECT_FALSE(Allow(breaker));
+    SleepMs(kBaseEjectMs + 20);
+    EXPECT_TRUE(Allow(breaker));
+}
+
+TEST(CircuitBreakerTest, ProbeReportedWithoutLatencyCloses)
+{
+    // 流式调用结束时不带延迟报告结果，同样要释放探测名额
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &probe));
+
+    breaker.Report(probe, false, 0);
+    EXPECT_FALSE(breaker.Ejected());
+    EXPECT_TRUE(Allow(breaker));
+}
+
+TEST(CircuitBreakerTest, UnreportedProbeBlocksUntilReleased)
+{
+    // 放行了探测却既不Report也不Release，实例会一直不被放行；Release归还名额后可以再探测
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &probe));
+
+    SleepMs(kBaseEjectMs + 20);
+    EXPECT_FALSE(Allow(breaker));
+
+    breaker.Release(probe);
+    EXPECT_TRUE(breaker.Ejected());
+    EXPECT_TRUE(Allow(breaker));
+    EXPECT_FALSE(Allow(breaker));
+}
+
+TEST(CircuitBreakerTest, LateReportDoesNotCloseHalfOpen)
+{
+    // 熔断前发出的调用迟到的成功结果不能代替探测请求恢复实例
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &probe));
+
+    breaker.Report(kNoTicket, false, 100);
+    EXPECT_TRUE(breaker.Ejected());
+    EXPECT_FALSE(Allow(breaker));
+
+    breaker.Report(probe, false, 100);
+    EXPECT_FALSE(breaker.Ejected());
+}
+
+TEST(CircuitBreakerTest, LateFailureDoesNotReopenHalfOpen)
+{
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket probe = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &probe));
+
+    breaker.Report(kNoTicket, true, 0);
+    breaker.Release(kNoTicket);
+    EXPECT_FALSE(Allow(breaker));   // 探测名额仍然被probe占着
+
+    breaker.Report(probe, false, 100);
+    EXPECT_FALSE(breaker.Ejected());
+}
+
+TEST(CircuitBreakerTest, StaleProbeTicketIsIgnored)
+{
+    // 上一轮探测的凭证在新一轮half_open中对不上，结果被忽略
+    MprpcCircuitBreaker breaker;
+    Trip(breaker);
+    SleepMs(kBaseEjectMs + 20);
+    Ticket first = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &first));
+    breaker.Eject();    // 探测在途时被判为离群，重新熔断（第二次，100ms）
+
+    SleepMs(2 * kBaseEjectMs + 20);
+    Ticket second = kNoTicket;
+    ASSERT_TRUE(Allow(breaker, &second));
+    EXPECT_NE(first, second);
+
+    breaker.Report(first, false, 100);
+    EXPECT_TRUE(breaker.Ejected());
+    breaker.Report(second, false, 100);
+    EXPECT_FALSE(breaker.Ejected());
+}
+
+TEST(CircuitBreakerTest, ZeroLatencyDoesNotChangeAverage)
+{
+    MprpcCircuitBreaker breaker;
+    breaker.Report(kNoTicket, false, 1000);
+    breaker.Report(kNoTicket, false, 0);
+    EXPECT_EQ(breaker.LatencyUs(), 1000u);
+}
+
+TEST(CircuitBreakerTest, OnlyInstanceErrorsCountAsFailures)
+{
+    EXPECT_TRUE(MprpcCircuitBreaker::IsFailure(mprpc::RPC_UNAVAILABLE));
+    EXPECT_TRUE(MprpcCircuitBreaker::IsFailure(mprpc::RPC_DEADLINE_EXCEEDED));
+    EXPECT_TRUE(MprpcCircuitBreaker::IsFailure(mprpc::RPC_OVERLOADED));
+    EXPECT_FALSE(MprpcCircuitBreaker::IsFailure(mprpc::RPC_OK));
+    EXPECT_FALSE(MprpcCircuitBreaker::IsFailure(mprpc::RPC_NO_METHOD));
+    EXPECT_FALSE(MprpcCircuitBreaker::IsFailure(mprpc::RPC_BAD_REQUEST));
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    LoadBreakerConfig();
+    return RUN_ALL_TESTS();
+}
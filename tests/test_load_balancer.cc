@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "mprpcloadbalancer.h"
+
+// 一致性哈希：同一个键总是落到同一个实例，键在实例之间分布均匀，实例增减时只迁移少量键
+namespace {
+MprpcEndpointListPtr MakeList(int n, int skip = -1)
+{
+    auto list = std::make_shared<MprpcEndpointList>();
+    for (int i = 0; i < n; ++i)
+    {
+        if (i == skip) continue;
+        MprpcEndpoint ep;
+        ep.id = "10.0.0." + std::to_string(i + 1) + ":8000";
+        ep.outstanding = std::make_shared<std::atomic<uint32_t>>(0);
+        ep.breaker = std::make_shared<MprpcCircuitBreaker>();
+        list->endpoints.push_back(ep);
+    }
+    return list;
+}
+
+std::string Key(int i)
+{
+    return "uid:" + std::to_string(i);
+}
+}
+
+TEST(ConsistentHashTest, SameKeySameEndpoint)
+{
+    std::shared_ptr<MprpcLoadBalancer> balancer = MprpcLoadBalancer::Create("consistent_hash");
+    ASSERT_TRUE(balancer);
+    MprpcEndpointListPtr list = MakeList(5);
+    // 实例列表刷新后（新的列表对象，相同的实例）键仍然落在同一个实例上，不同进程之间也一样
+    MprpcEndpointListPtr refreshed = MakeList(5);
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::string &first = balancer->Select(*list, Key(i)).id;
+        EXPECT_EQ(balancer->Select(*list, Key(i)).id, first);
+        EXPECT_EQ(balancer->Select(*refreshed, Key(i)).id, first);
+    }
+}
+
+TEST(ConsistentHashTest, KeysSpreadAcrossEndpoints)
+{
+    std::shared_ptr<MprpcLoadBalancer> balancer = MprpcLoadBalancer::Create("consistent_hash");
+    const int kEndpoints = 5;
+    const int kKeys = 20000;
+    MprpcEndpointListPtr list = MakeList(kEndpoints);
+    std::map<std::string, int> counts;
+    for (int i = 0; i < kKeys; ++i)
+    {
+        ++counts[balancer->Select(*list, Key(i)).id];
+    }
+    ASSERT_EQ(counts.size(), (size_t)kEndpoints);
+    // 每个实例160个虚拟节点，各实例分到的键与平均值的偏差在30%以内
+    for (const auto &kv : counts)
+    {
+        EXPECT_GT(kv.second, kKeys / kEndpoints * 7 / 10) << kv.first;
+        EXPECT_LT(kv.second, kKeys / kEndpoints * 13 / 10) << kv.first;
+    }
+}
+
+TEST(ConsistentHashTest, RemovingEndpointOnlyMovesItsKeys)
+{
+    std::shared_ptr<MprpcLoadBalancer> balancer = MprpcLoadBalancer::Create("consistent_hash");
+    const int kKeys = 10000;
+    MprpcEndpointListPtr before = MakeList(5);
+    MprpcEndpointListPtr after = MakeList(5, 2);
+    const std::string removed = before->endpoints[2].id;
+    int moved = 0;
+    for (int i = 0; i < kKeys; ++i)
+    {
+        const std::string &old_id = balancer->Select(*before, Key(i)).id;
+        const std::string &new_id = balancer->Select(*after, Key(i)).id;
+        if (old_id == removed)
+        {
+            EXPECT_NE(new_id, removed);
+            ++moved;
+        }
+        else
+        {
+            EXPECT_EQ(new_id, old_id) << Key(i);
+        }
+    }
+    EXPECT_GT(moved, 0);
+    EXPECT_LT(moved, kKeys * 3 / 10);
+}
+
+TEST(ConsistentHashTest, EmptyKeyFallsBack)
+{
+    std::shared_ptr<MprpcLoadBalancer> balancer = MprpcLoadBalancer::Create("consistent_hash");
+    MprpcEndpointListPtr list = MakeList(3);
+    for (int i = 0; i < 10; ++i)
+    {
+        const MprpcEndpoint &ep = balancer->Select(*list, "");
+        EXPECT_TRUE(&ep >= list->endpoints.data() && &ep < list->endpoints.data() + list->endpoints.size());
+    }
+}
+
+TEST(LoadBalancerTest, UnknownPolicy)
+{
+    EXPECT_FALSE(MprpcLoadBalancer::Create("no_such_policy"));
+    EXPECT_TRUE(MprpcLoadBalancer::Create("round_robin"));
+    EXPECT_TRUE(MprpcLoadBalancer::Create("p2c"));
+}
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "mprpcchannel.h"
+#include "mprpcclosure.h"
+#include "mprpccontroller.h"
+#include "rpcprovider.h"
+#include "test_local.pb.h"
+
+// 同一进程内发布的服务走本地调用：RpcProvider::StartLocal只登记到本地注册表，不需要zk和网络
+namespace {
+class EchoServiceImpl : public mprpctest::EchoService
+{
+public:
+    void Echo(google::protobuf::RpcController *controller, const mprpctest::EchoRequest *request,
+              mprpctest::EchoResponse *response, google::protobuf::Closure *done) override
+    {
+        calls.fetch_add(1);
+        response->add_msgs(request->msg());
+        done->Run();
+    }
+
+    std::atomic<int> calls{0};
+};
+
+class LocalCallTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        provider.NotifyService(&service);
+        provider.StartLocal();
+    }
+
+    void TearDown() override
+    {
+        provider.StopLocal();
+    }
+
+    EchoServiceImpl service;
+    RpcProvider provider;
+    MprpcChannel channel;
+};
+
+const google::protobuf::MethodDescriptor *EchoMethod()
+{
+    return mprpctest::EchoService::descriptor()->FindMethodByName("Echo");
+}
+}
+
+TEST_F(LocalCallTest, CallMethodRunsLocally)
+{
+    mprpctest::EchoService_Stub stub(&channel);
+    mprpctest::EchoRequest request;
+    request.set_msg("hello");
+    mprpctest::EchoResponse response;
+    MprpcController controller;
+    stub.Echo(&controller, &request, &response, nullptr);
+
+    EXPECT_FALSE(controller.Failed()) << controller.ErrorText();
+    ASSERT_EQ(response.msgs_size(), 1);
+    EXPECT_EQ(response.msgs(0), "hello");
+    EXPECT_EQ(service.calls.load(), 1);
+}
+
+TEST_F(LocalCallTest, ReusedResponseIsCleared)
+{
+    // 远程调用时handler拿到的是空的response，本地调用复用调用方的response也要先清空
+    mprpctest::EchoService_Stub stub(&channel);
+    mprpctest::EchoRequest request;
+    mprpctest::EchoResponse response;
+    response.add_msgs("stale");
+    request.set_msg("first");
+    stub.Echo(nullptr, &request, &response, nullptr);
+    request.set_msg("second");
+    stub.Echo(nullptr, &request, &response, nullptr);
+
+    ASSERT_EQ(response.msgs_size(), 1);
+    EXPECT_EQ(response.msgs(0), "second");
+}
+
+TEST_F(LocalCallTest, SyncBatchWithNullItemControllers)
+{
+    const int kCalls = 4;
+    std::vector<mprpctest::EchoRequest> requests(kCalls);
+    std::vector<mprpctest::EchoResponse> responses(kCalls);
+    std::vector<MprpcBatchCall> calls(kCalls);
+    for (int i = 0; i < kCalls; ++i)
+    {
+        requests[i].set_msg(std::to_string(i));
+        calls[i].method = EchoMethod();
+        calls[i].request = &requests[i];
+        calls[i].response = &responses[i];
+    }
+    channel.CallBatch(calls, nullptr, nullptr);
+
+    for (int i = 0; i < kCalls; ++i)
+    {
+        ASSERT_EQ(responses[i].msgs_size(), 1);
+        EXPECT_EQ(responses[i].msgs(0), std::to_string(i));
+    }
+    EXPECT_EQ(service.calls.load(), kCalls);
+}
+
+TEST_F(LocalCallTest, AsyncBatchWithNullItemControllers)
+{
+    const int kCalls = 4;
+    std::vector<mprpctest::EchoRequest> requests(kCalls);
+    std::vector<mprpctest::EchoResponse> responses(kCalls);
+    std::vector<MprpcBatchCall> calls(kCalls);
+    for (int i = 0; i < kCalls; ++i)
+    {
+        requests[i].set_msg(std::to_string(i));
+        calls[i].method = EchoMethod();
+        calls[i].request = &requests[i];
+        calls[i].response = &responses[i];
+    }
+
+    std::mutex mu;
+    std::condition_variable cv;
+    bool finished = false;
+    channel.CallBatch(calls, nullptr, NewMprpcClosure([&]() {
+        std::lock_guard<std::mutex> lk(mu);
+        finished = true;
+        cv.notify_one();
+    }));
+    {
+        std::unique_lock<std::mutex> lk(mu);
+        ASSERT_TRUE(cv.wait_for(lk, std::chrono::seconds(10), [&finished]() { return finished; }));
+    }
+
+    for (int i = 0; i < kCalls; ++i)
+    {
+        ASSERT_EQ(responses[i].msgs_size(), 1);
+        EXPECT_EQ(responses[i].msgs(0), std::to_string(i));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+#include "rpcloopgroup.h"
+
+// rpc_io_cores 的核列表解析："0-3,8,10-11" 形式，格式错误的部分忽略
+TEST(RpcLoopGroupTest, ParseCpuListRangesAndSingles)
+{
+    EXPECT_EQ(RpcLoopGroup::ParseCpuList("0-3,8,10-11"), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(RpcLoopGroup::ParseCpuList("5"), (std::vector<int>{5}));
+    EXPECT_EQ(RpcLoopGroup::ParseCpuList("2-2"), (std::vector<int>{2}));
+}
+
+TEST(RpcLoopGroupTest, ParseCpuListEmpty)
+{
+    EXPECT_TRUE(RpcLoopGroup::ParseCpuList("").empty());
+    EXPECT_TRUE(RpcLoopGroup::ParseCpuList(",,").empty());
+}
+
+TEST(RpcLoopGroupTest, ParseCpuListSkipsMalformedItems)
+{
+    // 非数字、负数、倒序区间、缺少上界的区间都跳过，其余照常解析
+    EXPECT_EQ(RpcLoopGroup::ParseCpuList("a,1,-2,5-3,7-,9"), (std::vector<int>{1, 9}));
+}
+
+TEST(RpcLoopGroupTest, ParseCpuListKeepsOrderAndDuplicates)
+{
+    // 按书写顺序展开，重复的核保留：loop按下标轮流绑到这些核上
+    EXPECT_EQ(RpcLoopGroup::ParseCpuList("3,1-2,1"), (std::vector<int>{3, 1, 2, 1}));
+}
+
+TEST(RpcLoopGroupTest, ParseCpuListStopsAtCpuSetSize)
+{
+    const std::vector<int> cpus = RpcLoopGroup::ParseCpuList("0-100000");
+    ASSERT_EQ(cpus.size(), (size_t)CPU_SETSIZE);
+    EXPECT_EQ(cpus.back(), CPU_SETSIZE - 1);
+}
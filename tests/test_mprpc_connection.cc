@@ -0,0 +1,390 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "mprpcapplication.h"
+#include "mprpcchannel.h"
+#include "mprpcclosure.h"
+#include "mprpcconnection.h"
+#include "mprpccontroller.h"
+#include "rpcheader.pb.h"
+#include "test_local.pb.h"
+
+// 客户端连接的帧编解码：测试里起一个按协议收发帧的unix域socket服务端，直接驱动MprpcConnection
+// 写合并在main里打开（配置只在第一次使用时读取），并发用例因此走合并发送的路径
+namespace {
+void LoadCodecConfig()
+{
+    char path[] = "/tmp/mprpc_codec_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    const char conf[] =
+        "rpc_write_coalesce=1\n"
+        "rpc_coalesce_window_us=50\n";
+    ASSERT_EQ(write(fd, conf, sizeof(conf) - 1), (ssize_t)(sizeof(conf) - 1));
+    close(fd);
+    MprpcApplication::GetConfig().LoadConfigFile(path);
+    unlink(path);
+}
+
+const google::protobuf::MethodDescriptor *EchoMethod()
+{
+    return mprpctest::EchoService::descriptor()->FindMethodByName("Echo");
+}
+
+bool ReadFull(int fd, char *buf, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::recv(fd, buf, size, 0);
+        if (n <= 0) return false;
+        buf += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool WriteFull(int fd, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// header_size(4) + header + payload
+std::string Frame(const google::protobuf::Message &header, const std::string &payload)
+{
+    const std::string header_str = header.SerializeAsString();
+    const uint32_t header_size = (uint32_t)header_str.size();
+    std::string frame(reinterpret_cast<const char *>(&header_size), 4);
+    frame += header_str;
+    frame += payload;
+    return frame;
+}
+
+std::string RequestFrame(uint64_t request_id, const std::string &msg)
+{
+    mprpctest::EchoRequest request;
+    request.set_msg(msg);
+    const std::string args = request.SerializeAsString();
+    mprpc::RpcHeader header;
+    header.set_service_name(EchoMethod()->service()->name());
+    header.set_method_name(EchoMethod()->name());
+    header.set_args_size((uint32_t)args.size());
+    header.set_request_id(request_id);
+    return Frame(header, args);
+}
+
+std::string EchoResponseFrame(uint64_t request_id, const std::string &args)
+{
+    mprpctest::EchoRequest request;
+    request.ParseFromString(args);
+    mprpctest::EchoResponse response;
+    response.add_msgs(request.msg());
+    const std::string body = response.SerializeAsString();
+    mprpc::RpcResponseHeader header;
+    header.set_request_id(request_id);
+    header.set_body_size((uint32_t)body.size());
+    return Frame(header, body);
+}
+
+// 只接受一条连接的服务端，收到的每个请求帧交给handler处理（在服务端线程上）
+class FakeServer
+{
+public:
+    using Handler = std::function<void(int fd, const mprpc::RpcHeader &header, const std::string &args)>;
+
+    explicit FakeServer(Handler handler) : m_handler(std::move(handler))
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/tmp/mprpc_codec_%d_%d.sock", (int)getpid(), s_seq.fetch_add(1));
+        m_path = name;
+        ::unlink(m_path.c_str());
+        m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+        EXPECT_EQ(::bind(m_listenFd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+        EXPECT_EQ(::listen(m_listenFd, 1), 0);
+        m_thread = std::thread([this]() { Serve(); });
+    }
+
+    ~FakeServer()
+    {
+        ::shutdown(m_listenFd, SHUT_RDWR);
+        if (m_connFd >= 0) ::shutdown(m_connFd, SHUT_RDWR);
+        m_thread.join();
+        ::close(m_listenFd);
+        if (m_connFd >= 0) ::close(m_connFd);
+        ::unlink(m_path.c_str());
+    }
+
+    const std::string &Path() const { return m_path; }
+    size_t Requests() const { return m_requests.load(); }
+
+private:
+    void Serve()
+    {
+        m_connFd = ::accept(m_listenFd, nullptr, nullptr);
+        if (m_connFd < 0) return;
+        for (;;)
+        {
+            uint32_t header_size = 0;
+            if (!ReadFull(m_connFd, reinterpret_cast<char *>(&header_size), 4)) return;
+            std::string header_str(header_size, '\0');
+            if (!ReadFull(m_connFd, &header_str[0], header_size)) return;
+            mprpc::RpcHeader header;
+            if (!header.ParseFromString(header_str))
+            {
+                ADD_FAILURE() << "bad request header";
+                return;
+            }
+            std::string args(header.args_size(), '\0');
+            if (!ReadFull(m_connFd, &args[0], args.size())) return;
+            m_requests.fetch_add(1);
+            m_handler(m_connFd, header, args);
+        }
+    }
+
+    static std::atomic<int> s_seq;
+    Handler m_handler;
+    std::string m_path;
+    int m_listenFd = -1;
+    int m_connFd = -1;
+    std::atomic<size_t> m_requests{0};
+    std::thread m_thread;
+};
+
+std::atomic<int> FakeServer::s_seq{0};
+
+void EchoHandler(int fd, const mprpc::RpcHeader &header, const std::string &args)
+{
+    WriteFull(fd, EchoResponseFrame(header.request_id(), args));
+}
+}
+
+TEST(MprpcConnectionTest, RequestAndResponseFrames)
+{
+    mprpc::RpcHeader seen;
+    FakeServer server([&seen](int fd, const mprpc::RpcHeader &header, const std::string &args) {
+        seen = header;
+        EchoHandler(fd, header, args);
+    });
+    std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(server.Path(), 1000);
+    ASSERT_TRUE(conn);
+
+    mprpctest::EchoResponse response;
+    MprpcController controller;
+    EXPECT_TRUE(conn->Call(7, EchoMethod(), RequestFrame(7, "hello"), &response, &controller));
+    EXPECT_FALSE(controller.Failed()) << controller.ErrorText();
+    ASSERT_EQ(response.msgs_size(), 1);
+    EXPECT_EQ(response.msgs(0), "hello");
+
+    EXPECT_EQ(seen.request_id(), 7u);
+    EXPECT_EQ(seen.service_name(), "EchoService");
+    EXPECT_EQ(seen.method_name(), "Echo");
+    EXPECT_EQ(conn->Inflight(), 0u);
+}
+
+TEST(MprpcConnectionTest, OutOfOrderResponsesMatchByRequestId)
+{
+    // 服务端收齐之后倒序回包，响应按request_id交给各自的调用
+    const int kCalls = 8;
+    std::vector<std::string> pending;
+    FakeServer server([&pending](int fd, const mprpc::RpcHeader &header, const std::string &args) {
+        pending.push_back(EchoResponseFrame(header.request_id(), args));
+        if (pending.size() < (size_t)kCalls) return;
+        for (auto it = pending.rbegin(); it != pending.rend(); ++it) WriteFull(fd, *it);
+    });
+    std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(server.Path(), 1000);
+    ASSERT_TRUE(conn);
+
+    std::vector<mprpctest::EchoResponse> responses(kCalls);
+    std::vector<MprpcController> controllers(kCalls);
+    std::mutex mu;
+    std::condition_variable cv;
+    int finished = 0;
+    for (int i = 0; i < kCalls; ++i)
+    {
+        conn->Call(100 + i, EchoMethod(), RequestFrame(100 + i, std::to_string(i)), &responses[i], &controllers[i],
+                   NewMprpcClosure([&]() {
+            std::lock_guard<std::mutex> lk(mu);
+            ++finished;
+            cv.notify_one();
+        }));
+    }
+    {
+        std::unique_lock<std::mutex> lk(mu);
+        ASSERT_TRUE(cv.wait_for(lk, std::chrono::seconds(10), [&finished]() { return finished == kCalls; }));
+    }
+    for (int i = 0; i < kCalls; ++i)
+    {
+        EXPECT_FALSE(controllers[i].Failed()) << controllers[i].ErrorText();
+        ASSERT_EQ(responses[i].msgs_size(), 1);
+        EXPECT_EQ(responses[i].msgs(0), std::to_string(i));
+    }
+}
+
+TEST(MprpcConnectionTest, BatchFraming)
+{
+    // 批量请求的args由子请求帧拼成，子帧的request_id为批内下标；响应同样拼接，顺序不定
+    // 第0项成功，第1项返回错误，第2项没有回应
+    std::vector<mprpc::RpcHeader> subs;
+    FakeServer server([&subs](int fd, const mprpc::RpcHeader &header, const std::string &args) {
+        size_t offset = 0;
+        std::vector<std::string> sub_args;
+        while (offset + 4 <= args.size())
+        {
+            uint32_t header_size = 0;
+            memcpy(&header_size, args.data() + offset, 4);
+            mprpc::RpcHeader sub;
+            sub.ParseFromArray(args.data() + offset + 4, (int)header_size);
+            sub_args.push_back(args.substr(offset + 4 + header_size, sub.args_size()));
+            subs.push_back(sub);
+            offset += 4 + header_size + sub.args_size();
+        }
+        mprpc::RpcResponseHeader failed;
+        failed.set_request_id(1);
+        failed.set_error_code(mprpc::RPC_NO_METHOD);
+        failed.set_error_text("no such method");
+        const std::string body = Frame(failed, "") + EchoResponseFrame(0, sub_args[0]);
+        mprpc::RpcResponseHeader outer;
+        outer.set_request_id(header.request_id());
+        outer.set_batch_count(header.batch_count());
+        outer.set_body_size((uint32_t)body.size());
+        WriteFull(fd, Frame(outer, body));
+    });
+    std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(server.Path(), 1000);
+    ASSERT_TRUE(conn);
+
+    const int kCalls = 3;
+    std::vector<mprpctest::EchoRequest> requests(kCalls);
+    std::vector<mprpctest::EchoResponse> responses(kCalls);
+    std::vector<MprpcController> controllers(kCalls);
+    std::vector<MprpcBatchCall> calls(kCalls);
+    std::string body;
+    for (int i = 0; i < kCalls; ++i)
+    {
+        calls[i].method = EchoMethod();
+        calls[i].request = &requests[i];
+        calls[i].response = &responses[i];
+        calls[i].controller = &controllers[i];
+        body += RequestFrame(i, "item" + std::to_string(i));
+    }
+    mprpc::RpcHeader header;
+    header.set_request_id(42);
+    header.set_batch_count(kCalls);
+    header.set_args_size((uint32_t)body.size());
+    MprpcController controller;
+    EXPECT_TRUE(conn->CallBatch(42, Frame(header, body), &calls, &controller));
+
+    EXPECT_FALSE(controller.Failed()) << controller.ErrorText();
+    ASSERT_EQ(subs.size(), (size_t)kCalls);
+    for (int i = 0; i < kCalls; ++i) EXPECT_EQ(subs[i].request_id(), (uint64_t)i);
+
+    EXPECT_FALSE(controllers[0].Failed()) << controllers[0].ErrorText();
+    ASSERT_EQ(responses[0].msgs_size(), 1);
+    EXPECT_EQ(responses[0].msgs(0), "item0");
+    EXPECT_EQ(controllers[1].ErrorCode(), mprpc::RPC_NO_METHOD);
+    EXPECT_EQ(controllers[1].ErrorText(), "no such method");
+    EXPECT_TRUE(controllers[2].Failed());
+    EXPECT_EQ(controllers[2].ErrorText(), "missing response in batch");
+}
+
+TEST(MprpcConnectionTest, ConcurrentCallsWithWriteCoalescing)
+{
+    // 写合并时多个线程的帧由同一个写者成批发出，服务端必须收到完整、不交错的帧
+    FakeServer server(EchoHandler);
+    std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(server.Path(), 1000);
+    ASSERT_TRUE(conn);
+
+    const int kThreads = 8;
+    const int kCallsPerThread = 200;
+    std::atomic<uint64_t> next_id{1};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < kCallsPerThread; ++i)
+            {
+                const uint64_t id = next_id.fetch_add(1);
+                const std::string msg = std::to_string(t) + ":" + std::to_string(i);
+                mprpctest::EchoResponse response;
+                MprpcController controller;
+                if (!conn->Call(id, EchoMethod(), RequestFrame(id, msg), &response, &controller) ||
+                    response.msgs_size() != 1 || response.msgs(0) != msg)
+                {
+                    failures.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(server.Requests(), (size_t)(kThreads * kCallsPerThread));
+    EXPECT_TRUE(conn->Alive());
+}
+
+TEST(MprpcConnectionTest, ResponseHeaderLargerThanReadBuffer)
+{
+    // 响应头比初始的64KB读缓冲区大：缓冲区扩容后照常解析，不能被当成对端关闭
+    const std::string text(100 * 1024, 'x');
+    FakeServer server([&text](int fd, const mprpc::RpcHeader &header, const std::string &) {
+        mprpc::RpcResponseHeader response;
+        response.set_request_id(header.request_id());
+        response.set_error_code(mprpc::RPC_INTERNAL);
+        response.set_error_text(text);
+        WriteFull(fd, Frame(response, ""));
+    });
+    std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(server.Path(), 1000);
+    ASSERT_TRUE(conn);
+
+    mprpctest::EchoResponse response;
+    MprpcController controller;
+    conn->Call(1, EchoMethod(), RequestFrame(1, "hello"), &response, &controller);
+    EXPECT_EQ(controller.ErrorCode(), mprpc::RPC_INTERNAL);
+    EXPECT_EQ(controller.ErrorText(), text);
+    EXPECT_TRUE(conn->Alive());
+}
+
+TEST(MprpcConnectionTest, OversizedResponseHeaderIsProtocolError)
+{
+    FakeServer server([](int fd, const mprpc::RpcHeader &, const std::string &) {
+        const uint32_t header_size = 16 * 1024 * 1024;
+        WriteFull(fd, std::string(reinterpret_cast<const char *>(&header_size), 4));
+    });
+    std::shared_ptr<MprpcConnection> conn = MprpcConnection::ConnectUnix(server.Path(), 1000);
+    ASSERT_TRUE(conn);
+
+    mprpctest::EchoResponse response;
+    MprpcController controller;
+    EXPECT_FALSE(conn->Call(1, EchoMethod(), RequestFrame(1, "hello"), &response, &controller));
+    EXPECT_EQ(controller.ErrorCode(), mprpc::RPC_UNAVAILABLE);
+    EXPECT_NE(controller.ErrorText().find("too large"), std::string::npos) << controller.ErrorText();
+    EXPECT_FALSE(conn->Alive());
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    LoadCodecConfig();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "rpccompress.h"
+#include "rpcheader.pb.h"
+
+// 压缩只在构建时找到lz4才可用（Accepted()里带LZ4位），否则round-trip的用例跳过，只验证不压缩的行为
+namespace {
+bool HaveLz4()
+{
+    return (RpcCompress::Accepted() & (1u << mprpc::RPC_COMPRESS_LZ4)) != 0;
+}
+
+std::string Compressible(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+    while (data.size() < size) data += "user_id=12345;status=online;";
+    data.resize(size);
+    return data;
+}
+}
+
+TEST(RpcCompressTest, SmallPayloadIsNotCompressed)
+{
+    // 默认阈值4096字节，小负载即使对端能解压也不压缩
+    EXPECT_EQ(RpcCompress::Choose(~0u, 100), (uint32_t)mprpc::RPC_COMPRESS_NONE);
+}
+
+TEST(RpcCompressTest, PeerWithoutCodecGetsRawPayload)
+{
+    EXPECT_EQ(RpcCompress::Choose(0, 1 << 20), (uint32_t)mprpc::RPC_COMPRESS_NONE);
+}
+
+TEST(RpcCompressTest, RoundTrip)
+{
+    if (!HaveLz4()) GTEST_SKIP() << "built without lz4";
+    const std::string raw = Compressible(64 * 1024);
+    ASSERT_EQ(RpcCompress::Choose(RpcCompress::Accepted(), raw.size()), (uint32_t)mprpc::RPC_COMPRESS_LZ4);
+
+    std::string compressed;
+    ASSERT_TRUE(RpcCompress::Compress(mprpc::RPC_COMPRESS_LZ4, raw.data(), raw.size(), &compressed));
+    EXPECT_LT(compressed.size(), raw.size());
+
+    std::string out;
+    ASSERT_TRUE(RpcCompress::Decompress(mprpc::RPC_COMPRESS_LZ4, compressed.data(), compressed.size(), raw.size(), &out));
+    EXPECT_EQ(out, raw);
+}
+
+TEST(RpcCompressTest, IncompressibleDataIsSentRaw)
+{
+    if (!HaveLz4()) GTEST_SKIP() << "built without lz4";
+    std::string raw(8192, '\0');
+    uint64_t x = 88172645463325252ULL;
+    for (char &c : raw)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        c = (char)x;
+    }
+    std::string compressed;
+    EXPECT_FALSE(RpcCompress::Compress(mprpc::RPC_COMPRESS_LZ4, raw.data(), raw.size(), &compressed));
+}
+
+TEST(RpcCompressTest, RawSizeMismatchIsRejected)
+{
+    if (!HaveLz4()) GTEST_SKIP() << "built without lz4";
+    const std::string raw = Compressible(16 * 1024);
+    std::string compressed;
+    ASSERT_TRUE(RpcCompress::Compress(mprpc::RPC_COMPRESS_LZ4, raw.data(), raw.size(), &compressed));
+
+    std::string out;
+    EXPECT_FALSE(RpcCompress::Decompress(mprpc::RPC_COMPRESS_LZ4, compressed.data(), compressed.size(), raw.size() - 1, &out));
+    EXPECT_FALSE(RpcCompress::Decompress(mprpc::RPC_COMPRESS_LZ4, compressed.data(), compressed.size(), raw.size() + 1, &out));
+}
+
+TEST(RpcCompressTest, RawSizeAboveLimitIsRejected)
+{
+    // 解压后的上限是64MB，超过时不申请内存直接失败，与是否支持lz4无关
+    const std::string raw = Compressible(16 * 1024);
+    std::string compressed = raw;
+    if (HaveLz4())
+    {
+        ASSERT_TRUE(RpcCompress::Compress(mprpc::RPC_COMPRESS_LZ4, raw.data(), raw.size(), &compressed));
+    }
+    std::string out;
+    EXPECT_FALSE(RpcCompress::Decompress(mprpc::RPC_COMPRESS_LZ4, compressed.data(), compressed.size(),
+                                         64 * 1024 * 1024 + 1, &out));
+    EXPECT_TRUE(out.empty());
+}
+
+TEST(RpcCompressTest, UnknownCodecIsRejected)
+{
+    const std::string raw = Compressible(16 * 1024);
+    std::string out;
+    EXPECT_FALSE(RpcCompress::Compress(7, raw.data(), raw.size(), &out));
+    EXPECT_FALSE(RpcCompress::Decompress(7, raw.data(), raw.size(), raw.size(), &out));
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+
+#include "rpcmetrics.h"
+
+// 调用统计的延迟直方图：分桶的相对误差不超过12.5%，分位数取所在桶的上界（不超过最大值）
+TEST(RpcLatencyHistogramTest, BucketBoundsCoverValues)
+{
+    for (uint64_t us = 0; us < (1ull << 20); us = us < 64 ? us + 1 : us + us / 7)
+    {
+        const int index = RpcLatencyHistogram::BucketIndex(us);
+        ASSERT_GE(index, 0);
+        ASSERT_LT(index, (int)RpcLatencyHistogram::kBuckets);
+        const uint64_t upper = RpcLatencyHistogram::BucketUpperBound(index);
+        EXPECT_GE(upper, us);
+        EXPECT_LE((double)upper, (double)us * 1.125 + 1) << us;
+        if (index > 0) EXPECT_LT(RpcLatencyHistogram::BucketUpperBound(index - 1), us) << us;
+    }
+}
+
+TEST(RpcLatencyHistogramTest, HugeValuesLandInLastBucket)
+{
+    EXPECT_EQ(RpcLatencyHistogram::BucketIndex(1ull << 40), (int)RpcLatencyHistogram::kBuckets - 1);
+}
+
+TEST(RpcLatencyHistogramTest, EmptySnapshot)
+{
+    RpcLatencyHistogram h;
+    RpcLatencyHistogram::Snapshot snap;
+    EXPECT_EQ(snap.Percentile(0.5), 0u);
+    snap.Merge(h);
+    EXPECT_EQ(snap.count, 0u);
+    EXPECT_EQ(snap.Percentile(0.99), 0u);
+}
+
+TEST(RpcLatencyHistogramTest, UniformPercentiles)
+{
+    RpcLatencyHistogram h;
+    for (uint64_t us = 1; us <= 10000; ++us) h.Record(us);
+    RpcLatencyHistogram::Snapshot snap;
+    snap.Merge(h);
+
+    EXPECT_EQ(snap.count, 10000u);
+    EXPECT_EQ(snap.sum, 10000u * 10001u / 2);
+    EXPECT_EQ(snap.max, 10000u);
+    const double qs[] = {0.5, 0.9, 0.99};
+    for (double q : qs)
+    {
+        const double expected = q * 10000;
+        const uint64_t p = snap.Percentile(q);
+        EXPECT_GE((double)p, expected) << q;
+        EXPECT_LE((double)p, expected * 1.125 + 1) << q;
+    }
+    EXPECT_EQ(snap.Percentile(1.0), 10000u);
+}
+
+TEST(RpcLatencyHistogramTest, PercentileCappedAtMax)
+{
+    RpcLatencyHistogram h;
+    h.Record(1000);
+    RpcLatencyHistogram::Snapshot snap;
+    snap.Merge(h);
+    // 1000所在桶的上界大于1000，但不会报出比最大值还大的分位数
+    EXPECT_EQ(snap.Percentile(0.5), 1000u);
+    EXPECT_EQ(snap.Percentile(0.999), 1000u);
+}
+
+TEST(RpcLatencyHistogramTest, MergeShards)
+{
+    RpcLatencyHistogram fast;
+    RpcLatencyHistogram slow;
+    for (int i = 0; i < 90; ++i) fast.Record(100);
+    for (int i = 0; i < 10; ++i) slow.Record(5000);
+    RpcLatencyHistogram::Snapshot snap;
+    snap.Merge(fast);
+    snap.Merge(slow);
+
+    EXPECT_EQ(snap.count, 100u);
+    EXPECT_EQ(snap.max, 5000u);
+    EXPECT_LE(snap.Percentile(0.5), 112u);
+    EXPECT_GE(snap.Percentile(0.95), 5000u);
+}
+
+TEST(RpcLatencyHistogramTest, ResetClearsCounts)
+{
+    RpcLatencyHistogram h;
+    h.Record(42);
+    h.Reset();
+    RpcLatencyHistogram::Snapshot snap;
+    snap.Merge(h);
+    EXPECT_EQ(snap.count, 0u);
+    EXPECT_EQ(snap.max, 0u);
+}